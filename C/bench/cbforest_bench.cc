@@ -0,0 +1,857 @@
+//
+//  cbforest_bench.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+// Standalone benchmark of the C API. Runs a fixed sequence of workloads against a scratch
+// database and writes their throughput and latency percentiles to stdout as JSON.
+// All random choices come from generators seeded with --seed, so runs are repeatable.
+// Run with --help for the parameters.
+
+#include "c4.h"
+#include "c4ExpiryEnumerator.h"
+#include "Stats.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+using namespace cbforest;
+
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+
+static const char* const kWorkloads[] = {
+    "insert_sequential", "insert_random", "insert_uuid", "insert_uuid_ordered", "read_random",
+    "update", "all_docs", "changes", "view_build", "view_update", "query_range", "query_keys",
+    "query_fulltext", "query_geo", "mixed", "expiry_purge", "compact",
+};
+
+static const unsigned kNumViews = 3;
+static const char* const kViewNames[kNumViews] = {"byNumber", "fullText", "geo"};
+enum {kNumberView, kFullTextView, kGeoView};
+
+
+struct Options {
+    unsigned docs           = 100000;   // docs created by insert_sequential (and each insert_*)
+    unsigned bodySize       = 200;      // approximate size of a doc's text, in bytes
+    unsigned batchSize      = 1000;     // writes per transaction
+    unsigned updates        = 10000;    // revisions added by update
+    unsigned hotDocs        = 500;      // update spreads its revisions over this many docs
+    unsigned reads          = 10000;    // docs read by read_random, and by each mixed reader
+    unsigned reindexDocs    = 1000;     // docs changed before view_update
+    unsigned queries        = 1000;     // queries run by each query workload
+    unsigned rangeWidth     = 100;      // number of keys spanned by each query_range query
+    unsigned multiKeys      = 50;       // number of keys in each query_keys query
+    unsigned readers        = 4;        // reader threads in mixed
+    unsigned expireDocs     = 10000;    // docs purged by expiry_purge
+    unsigned purgeBatch     = 500;      // batch size of the expiry purger
+    uint64_t seed           = 42;
+    std::string dir         = "/tmp";
+    std::set<std::string> only;         // workloads to report; empty means all
+};
+
+
+/** The outcome of one workload: its throughput, and the latency distribution of its operations. */
+struct Result {
+    std::string name;
+    uint64_t ops {0};
+    uint64_t rows {0};          // docs or rows returned, for enumerations and queries
+    uint64_t nanos {0};         // wall-clock time of the whole workload
+    uint64_t fileBytes {0};     // size of the database file afterwards, if it's a separate one
+    LatencyHistogram latency;
+};
+
+
+static void check(bool ok, const C4Error &error, const char *what) {
+    if (ok)
+        return;
+    C4SliceResult message = c4error_getMessage(error);
+    fprintf(stderr, "cbforest_bench: %s failed: %.*s (%d/%d)\n",
+            what, (int)message.size, (const char*)message.buf, error.domain, error.code);
+    c4slice_free(message);
+    exit(1);
+}
+
+
+class Bench {
+public:
+    Bench(const Options &options)
+    :_options(options),
+     _dbPath(options.dir + "/cbforest_bench.fdb")
+    {
+        std::mt19937_64 rng = rngFor("vocabulary");
+        for (unsigned i = 0; i < 1000; ++i) {
+            std::string word;
+            unsigned length = 4 + rng() % 6;
+            for (unsigned j = 0; j < length; ++j)
+                word += (char)('a' + rng() % 26);
+            _vocabulary.push_back(word);
+        }
+    }
+
+    ~Bench() {
+        C4Error error;
+        for (unsigned i = 0; i < kNumViews; ++i)
+            if (_views[i])
+                c4view_delete(_views[i], &error), c4view_free(_views[i]);
+        if (_db)
+            c4db_delete(_db, &error), c4db_free(_db);
+    }
+
+    void run() {
+        C4Error error;
+        c4db_deleteAtPath(c4str(_dbPath.c_str()), kC4DB_Create, &error);
+        _db = c4db_open(c4str(_dbPath.c_str()), kC4DB_Create, NULL, &error);
+        check(_db != NULL, error, "opening database");
+        for (unsigned i = 0; i < kNumViews; ++i) {
+            std::string path = viewPath(i);
+            c4view_deleteAtPath(c4str(path.c_str()), kC4DB_Create, &error);
+            _views[i] = c4view_open(_db, c4str(path.c_str()), c4str(kViewNames[i]), c4str("1"),
+                                    kC4DB_Create, NULL, &error);
+            check(_views[i] != NULL, error, "opening view");
+        }
+        c4view_setGeoIndexType(_views[kGeoView], kC4GeohashIndex, NULL);
+
+        workload("insert_sequential",   &Bench::insertSequential);
+        workload("insert_random",       &Bench::insertRandom);
+        workload("insert_uuid",         &Bench::insertUUID);
+        workload("insert_uuid_ordered", &Bench::insertUUIDOrdered);
+        workload("read_random",         &Bench::readRandom);
+        workload("update",              &Bench::update);
+        workload("all_docs",            &Bench::allDocs);
+        workload("changes",             &Bench::changes);
+        workload("view_build",          &Bench::viewBuild);
+        workload("view_update",         &Bench::viewUpdate);
+        workload("query_range",         &Bench::queryRange);
+        workload("query_keys",          &Bench::queryKeys);
+        workload("query_fulltext",      &Bench::queryFullText);
+        workload("query_geo",           &Bench::queryGeo);
+        workload("mixed",               &Bench::mixed);
+        workload("expiry_purge",        &Bench::expiryPurge);
+        workload("compact",             &Bench::compact);
+    }
+
+    void writeJSON(FILE *out) const;
+
+private:
+    typedef void (Bench::*WorkloadFn)(Result&);
+
+    // Workloads run in a fixed order, since later ones use the docs and indexes earlier ones
+    // create. A workload that isn't selected still runs (if a later one depends on it), but
+    // isn't reported.
+    void workload(const char *name, WorkloadFn fn) {
+        bool selected = _options.only.empty() || _options.only.count(name);
+        if (!selected && !needed(name))
+            return;
+        std::unique_ptr<Result> result(new Result);
+        result->name = name;
+        fprintf(stderr, "cbforest_bench: %s...\n", name);
+        auto start = Clock::now();
+        (this->*fn)(*result);
+        if (result->nanos == 0)
+            result->nanos = nanosSince(start);
+        if (selected) {
+            fprintf(stderr, "cbforest_bench: %s: %llu ops in %.3f sec\n",
+                    name, (unsigned long long)result->ops, result->nanos / 1.0e9);
+            _results.push_back(std::move(result));
+            if (_extraResult)
+                _results.push_back(std::move(_extraResult));
+        }
+        _extraResult.reset();
+    }
+
+    // Is the named workload a prerequisite of a selected workload that comes after it?
+    bool needed(const char *name) const {
+        static const std::set<std::string> kSetupWorkloads = {"insert_sequential", "view_build"};
+        if (!kSetupWorkloads.count(name))
+            return false;
+        bool after = false;
+        for (auto w : kWorkloads) {
+            if (after && _options.only.count(w))
+                return true;
+            if (strcmp(w, name) == 0)
+                after = true;
+        }
+        return false;
+    }
+
+    // Each workload gets its own generator, so its choices don't depend on which other
+    // workloads ran. (FNV-1a rather than std::hash, so the seeds are the same on every platform.)
+    std::mt19937_64 rngFor(const char *name, unsigned instance =0) const {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (const char *c = name; *c; ++c)
+            h = (h ^ (uint8_t)*c) * 0x100000001b3ull;
+        return std::mt19937_64(h ^ (_options.seed + instance));
+    }
+
+    static double randomFraction(std::mt19937_64 &rng) {
+        return (rng() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    std::string viewPath(unsigned i) const {
+        return _options.dir + "/cbforest_bench_" + kViewNames[i] + ".fdb";
+    }
+
+    static std::string docIDFor(unsigned n) {
+        char docID[20];
+        sprintf(docID, "doc-%08u", n);
+        return docID;
+    }
+
+    // Doc bodies are JSON objects with a fixed field order, so the map functions can parse them
+    // with sscanf. The location is a function of n, so updates don't move docs.
+    std::string bodyFor(unsigned n, unsigned revision, std::mt19937_64 &rng) const {
+        std::mt19937_64 geoRng(n ^ _options.seed);
+        double lat = randomFraction(geoRng) * 160.0 - 80.0;
+        double lon = randomFraction(geoRng) * 340.0 - 170.0;
+        char prefix[100];
+        sprintf(prefix, "{\"n\":%u,\"lat\":%.6f,\"lon\":%.6f,\"rev\":%u,\"text\":\"",
+                n, lat, lon, revision);
+        std::string body = prefix;
+        std::string text;
+        while (text.size() < _options.bodySize) {
+            if (!text.empty())
+                text += ' ';
+            text += _vocabulary[rng() % _vocabulary.size()];
+        }
+        return body + text + "\"}";
+    }
+
+    static C4Document* putDoc(C4Database *db, const std::string &docID, const std::string &body,
+                              C4Slice parentRevID =kC4SliceNull)
+    {
+        C4DocPutRequest rq = {};
+        if (!docID.empty())
+            rq.docID = c4str(docID.c_str());    // else c4doc_put generates one
+        rq.body = c4str(body.c_str());
+        if (parentRevID.buf) {
+            rq.history = &parentRevID;
+            rq.historyCount = 1;
+        }
+        rq.save = true;
+        C4Error error;
+        C4Document *doc = c4doc_put(db, &rq, NULL, &error);
+        check(doc != NULL, error, "c4doc_put");
+        return doc;
+    }
+
+    // Adds a revision to an existing doc. Returns the number of revisions it now has.
+    static unsigned updateDoc(C4Database *db, unsigned n, const std::string &body) {
+        C4Error error;
+        std::string docID = docIDFor(n);
+        C4Document *doc = c4doc_get(db, c4str(docID.c_str()), true, &error);
+        check(doc != NULL, error, "c4doc_get");
+        C4Document *newDoc = putDoc(db, docID, body, doc->revID);
+        unsigned generation = c4rev_getGeneration(newDoc->revID);
+        c4doc_free(newDoc);
+        c4doc_free(doc);
+        return generation;
+    }
+
+    static void beginTransaction(C4Database *db) {
+        C4Error error;
+        check(c4db_beginTransaction(db, &error), error, "beginTransaction");
+    }
+
+    static void endTransaction(C4Database *db) {
+        C4Error error;
+        check(c4db_endTransaction(db, true, &error), error, "endTransaction");
+    }
+
+    void insertDocs(C4Database *db, const std::vector<std::string> &docIDs, Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        for (unsigned i = 0; i < docIDs.size(); ++i) {
+            if (i % _options.batchSize == 0) {
+                if (i > 0)
+                    endTransaction(db);
+                beginTransaction(db);
+            }
+            std::string body = bodyFor(i, 1, rng);
+            LatencyTimer timer(r.latency);
+            c4doc_free(putDoc(db, docIDs[i], body));
+            ++r.ops;
+        }
+        if (!docIDs.empty())
+            endTransaction(db);
+    }
+
+
+    //////// WORKLOADS:
+
+
+    void insertSequential(Result &r) {
+        std::vector<std::string> docIDs;
+        for (unsigned i = 0; i < _options.docs; ++i)
+            docIDs.push_back(docIDFor(i));
+        insertDocs(_db, docIDs, r);
+    }
+
+    // Inserts UUID-like docIDs in random order, into a separate database.
+    void insertRandom(Result &r) {
+        std::mt19937_64 rng = rngFor("insert_random_ids");
+        std::vector<std::string> docIDs;
+        for (unsigned i = 0; i < _options.docs; ++i) {
+            uint64_t hi = rng();
+            uint64_t lo = rng();
+            char docID[40];
+            sprintf(docID, "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+            docIDs.push_back(docID);
+        }
+        insertIntoScratchDB(docIDs, r);
+    }
+
+    // Inserts docs without docIDs, so c4doc_put generates random ones, into a separate database.
+    void insertUUID(Result &r) {
+        insertIntoScratchDB(std::vector<std::string>(_options.docs), r);
+    }
+
+    // Like insert_uuid, but with time-ordered generated docIDs.
+    void insertUUIDOrdered(Result &r) {
+        c4doc_generateTimeOrderedDocIDs(true);
+        insertIntoScratchDB(std::vector<std::string>(_options.docs), r);
+        c4doc_generateTimeOrderedDocIDs(false);
+    }
+
+    void insertIntoScratchDB(const std::vector<std::string> &docIDs, Result &r) {
+        std::string path = _options.dir + "/cbforest_bench_" + r.name + ".fdb";
+        C4Error error;
+        c4db_deleteAtPath(c4str(path.c_str()), kC4DB_Create, &error);
+        C4Database *db = c4db_open(c4str(path.c_str()), kC4DB_Create, NULL, &error);
+        check(db != NULL, error, "opening database");
+        insertDocs(db, docIDs, r);
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0)
+            r.fileBytes = st.st_size;
+        c4db_delete(db, &error);
+        c4db_free(db);
+    }
+
+    void readRandom(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        r.ops = r.rows = readDocs(_db, _options.reads, rng, r.latency);
+    }
+
+    // Reads random docs, recording into a histogram that may be shared with other threads.
+    unsigned readDocs(C4Database *db, unsigned count, std::mt19937_64 &rng,
+                      LatencyHistogram &latency)
+    {
+        for (unsigned i = 0; i < count; ++i) {
+            std::string docID = docIDFor(rng() % _options.docs);
+            LatencyTimer timer(latency);
+            C4Error error;
+            C4Document *doc = c4doc_get(db, c4str(docID.c_str()), true, &error);
+            check(doc != NULL, error, "c4doc_get");
+            c4doc_free(doc);
+        }
+        return count;
+    }
+
+    // Adds revisions to a small set of docs, so their revision trees grow deep.
+    void update(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        unsigned hotDocs = std::min(_options.hotDocs, _options.docs);
+        for (unsigned i = 0; i < _options.updates; ++i) {
+            if (i % _options.batchSize == 0) {
+                if (i > 0)
+                    endTransaction(_db);
+                beginTransaction(_db);
+            }
+            unsigned n = rng() % hotDocs;
+            std::string body = bodyFor(n, i + 2, rng);
+            LatencyTimer timer(r.latency);
+            updateDoc(_db, n, body);
+            ++r.ops;
+        }
+        if (_options.updates > 0)
+            endTransaction(_db);
+    }
+
+    void enumerate(C4DocEnumerator *e, Result &r) {
+        C4Error error = {};
+        for (;;) {
+            C4Document *doc;
+            {
+                LatencyTimer timer(r.latency);
+                doc = c4enum_nextDocument(e, &error);
+            }
+            if (!doc)
+                break;
+            c4doc_free(doc);
+            ++r.ops;
+            ++r.rows;
+        }
+        check(error.code == 0, error, "enumerating docs");
+        c4enum_free(e);
+    }
+
+    void allDocs(Result &r) {
+        C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+        options.flags &= ~kC4IncludeBodies;
+        C4Error error;
+        auto e = c4db_enumerateAllDocs(_db, kC4SliceNull, kC4SliceNull, &options, &error);
+        check(e != NULL, error, "c4db_enumerateAllDocs");
+        enumerate(e, r);
+    }
+
+    void changes(Result &r) {
+        C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+        C4Error error;
+        auto e = c4db_enumerateChanges(_db, 0, &options, &error);
+        check(e != NULL, error, "c4db_enumerateChanges");
+        enumerate(e, r);
+    }
+
+    // Indexes all three views in one pass; each op is the mapping of one doc.
+    void indexViews(Result &r) {
+        C4Error error;
+        C4Indexer *indexer = c4indexer_begin(_db, _views, kNumViews, &error);
+        check(indexer != NULL, error, "c4indexer_begin");
+        C4DocEnumerator *e = c4indexer_enumerateDocuments(indexer, &error);
+        if (!e) {
+            check(error.code == 0, error, "c4indexer_enumerateDocuments");
+            check(c4indexer_end(indexer, true, &error), error, "c4indexer_end");
+            return;
+        }
+        C4Document *doc;
+        while (NULL != (doc = c4enum_nextDocument(e, &error))) {
+            LatencyTimer timer(r.latency);
+            std::string body((const char*)doc->selectedRev.body.buf, doc->selectedRev.body.size);
+            unsigned n = 0;
+            double lat = 0, lon = 0;
+            bool parsed = sscanf(body.c_str(), "{\"n\":%u,\"lat\":%lf,\"lon\":%lf",
+                                 &n, &lat, &lon) == 3;
+            for (unsigned v = 0; v < kNumViews; ++v) {
+                if (!c4indexer_shouldIndexDocument(indexer, v, doc))
+                    continue;
+                C4Key *key = NULL;
+                if (parsed) {
+                    switch (v) {
+                        case kNumberView:
+                            key = c4key_new();
+                            c4key_addNumber(key, n);
+                            break;
+                        case kFullTextView: {
+                            auto textStart = body.find("\"text\":\"");
+                            if (textStart != std::string::npos) {
+                                textStart += 8;
+                                auto textEnd = body.find('"', textStart);
+                                std::string text = body.substr(textStart, textEnd - textStart);
+                                key = c4key_newFullTextString(c4str(text.c_str()), c4str("en"));
+                            }
+                            break;
+                        }
+                        case kGeoView: {
+                            C4GeoArea area = {lon, lat, lon + 0.1, lat + 0.1};
+                            key = c4key_newGeoJSON(c4str("{\"geo\":true}"), area);
+                            break;
+                        }
+                    }
+                }
+                C4Slice value = c4str("1234");
+                check(c4indexer_emit(indexer, doc, v, (key ? 1 : 0), &key, &value, &error),
+                      error, "c4indexer_emit");
+                c4key_free(key);
+            }
+            c4doc_free(doc);
+            ++r.ops;
+        }
+        c4enum_free(e);
+        check(error.code == 0, error, "enumerating docs to index");
+        check(c4indexer_end(indexer, true, &error), error, "c4indexer_end");
+    }
+
+    void viewBuild(Result &r) {
+        indexViews(r);
+    }
+
+    // Changes some docs (untimed), then times the incremental update of the views.
+    void viewUpdate(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        beginTransaction(_db);
+        for (unsigned i = 0; i < _options.reindexDocs; ++i) {
+            unsigned n = rng() % _options.docs;
+            updateDoc(_db, n, bodyFor(n, 1000000 + i, rng));
+        }
+        endTransaction(_db);
+        auto start = Clock::now();
+        indexViews(r);
+        r.nanos = nanosSince(start);
+    }
+
+    // Runs a query, counting its rows; each op is one complete query.
+    template <class START>
+    void runQuery(Result &r, START startQuery) {
+        LatencyTimer timer(r.latency);
+        C4Error error = {};
+        C4QueryEnumerator *e = startQuery(&error);
+        check(e != NULL, error, "starting query");
+        while (c4queryenum_next(e, &error))
+            ++r.rows;
+        check(error.code == 0, error, "enumerating query");
+        c4queryenum_free(e);
+        ++r.ops;
+    }
+
+    void queryRange(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        for (unsigned i = 0; i < _options.queries; ++i) {
+            unsigned first = rng() % _options.docs;
+            C4Key *startKey = c4key_new(), *endKey = c4key_new();
+            c4key_addNumber(startKey, first);
+            c4key_addNumber(endKey, first + _options.rangeWidth - 1);
+            C4QueryOptions options = kC4DefaultQueryOptions;
+            options.startKey = startKey;
+            options.endKey = endKey;
+            runQuery(r, [&](C4Error *error) {
+                return c4view_query(_views[kNumberView], &options, error);
+            });
+            c4key_free(startKey);
+            c4key_free(endKey);
+        }
+    }
+
+    void queryKeys(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        std::vector<C4Key*> keys(_options.multiKeys);
+        for (unsigned i = 0; i < _options.queries; ++i) {
+            for (auto &key : keys) {
+                key = c4key_new();
+                c4key_addNumber(key, rng() % _options.docs);
+            }
+            C4QueryOptions options = kC4DefaultQueryOptions;
+            options.keys = (const C4Key**)keys.data();
+            options.keysCount = keys.size();
+            runQuery(r, [&](C4Error *error) {
+                return c4view_query(_views[kNumberView], &options, error);
+            });
+            for (auto key : keys)
+                c4key_free(key);
+        }
+    }
+
+    void queryFullText(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        for (unsigned i = 0; i < _options.queries; ++i) {
+            std::string query = _vocabulary[rng() % _vocabulary.size()];
+            query += " " + _vocabulary[rng() % _vocabulary.size()];
+            runQuery(r, [&](C4Error *error) {
+                return c4view_fullTextQuery(_views[kFullTextView], c4str(query.c_str()),
+                                            c4str("en"), NULL, error);
+            });
+        }
+    }
+
+    void queryGeo(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        for (unsigned i = 0; i < _options.queries; ++i) {
+            double lat = randomFraction(rng) * 150.0 - 75.0;
+            double lon = randomFraction(rng) * 330.0 - 165.0;
+            C4GeoArea area = {lon, lat, lon + 5.0, lat + 5.0};
+            runQuery(r, [&](C4Error *error) {
+                return c4view_geoQuery(_views[kGeoView], area, error);
+            });
+        }
+    }
+
+    // Reader threads doing random reads while one writer thread updates random docs. Each
+    // thread has its own database handle. The reads are reported here; the writes as "mixed_write".
+    void mixed(Result &r) {
+        std::unique_ptr<Result> writes(new Result);
+        writes->name = "mixed_write";
+        std::atomic<bool> done {false};
+        auto start = Clock::now();
+
+        std::thread writer([&]{
+            C4Database *db = openHandle();
+            std::mt19937_64 rng = rngFor("mixed_write");
+            unsigned revision = 2000000;
+            while (!done) {
+                beginTransaction(db);
+                for (unsigned i = 0; i < 10; ++i) {
+                    unsigned n = rng() % _options.docs;
+                    std::string body = bodyFor(n, revision++, rng);
+                    LatencyTimer timer(writes->latency);
+                    updateDoc(db, n, body);
+                    ++writes->ops;
+                }
+                endTransaction(db);
+            }
+            c4db_free(db);
+        });
+
+        std::vector<std::thread> readers;
+        std::atomic<uint64_t> reads {0};
+        for (unsigned t = 0; t < _options.readers; ++t) {
+            readers.push_back(std::thread([&, t]{
+                C4Database *db = openHandle();
+                std::mt19937_64 rng = rngFor("mixed", t);
+                reads += readDocs(db, _options.reads, rng, r.latency);
+                c4db_free(db);
+            }));
+        }
+        for (auto &reader : readers)
+            reader.join();
+        done = true;
+        writer.join();
+
+        r.ops = r.rows = reads;
+        writes->nanos = nanosSince(start);
+        _extraResult = std::move(writes);
+    }
+
+    C4Database* openHandle() {
+        C4Error error;
+        C4Database *db = c4db_open(c4str(_dbPath.c_str()), 0, NULL, &error);
+        check(db != NULL, error, "opening database");
+        return db;
+    }
+
+    // Gives a batch of docs expiration times in the past, then times the background purger
+    // as it removes them. Each op is one purged doc; the latencies are of whole batches.
+    void expiryPurge(Result &r) {
+        std::mt19937_64 rng = rngFor(r.name.c_str());
+        unsigned count = std::min(_options.expireDocs, _options.docs);
+        std::vector<unsigned> docNumbers(_options.docs);
+        for (unsigned i = 0; i < _options.docs; ++i)
+            docNumbers[i] = i;
+        for (unsigned i = 0; i < count; ++i)      // partial Fisher-Yates shuffle
+            std::swap(docNumbers[i], docNumbers[i + rng() % (_options.docs - i)]);
+
+        std::vector<std::string> docIDs;
+        std::vector<C4Slice> docIDSlices;
+        for (unsigned i = 0; i < count; ++i)
+            docIDs.push_back(docIDFor(docNumbers[i]));
+        for (auto &docID : docIDs)
+            docIDSlices.push_back(c4str(docID.c_str()));
+        std::vector<uint64_t> timestamps(count, (uint64_t)time(NULL) - 1);
+        C4Error error;
+        check(c4db_setExpirations(_db, docIDSlices.data(), timestamps.data(), count, &error),
+              error, "c4db_setExpirations");
+
+        PurgeProgress progress(r);
+        auto start = Clock::now();
+        check(c4db_startExpiryPurger(_db, _options.purgeBatch, &PurgeProgress::callback,
+                                     &progress, &error),
+              error, "c4db_startExpiryPurger");
+        while (progress.purged < count && nanosSince(start) < 60 * 1000000000ull)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        r.nanos = nanosSince(start);
+        c4db_stopExpiryPurger(_db);
+        r.ops = progress.purged;
+    }
+
+    struct PurgeProgress {
+        PurgeProgress(Result &r)    :result(r), lastBatch(Clock::now()) { }
+        Result &result;
+        Clock::time_point lastBatch;
+        std::atomic<unsigned> purged {0};
+
+        static void callback(void *context, unsigned purgedCount) {
+            auto self = (PurgeProgress*)context;
+            self->result.latency.record(nanosSince(self->lastBatch));
+            self->lastBatch = Clock::now();
+            self->purged += purgedCount;
+        }
+    };
+
+    void compact(Result &r) {
+        C4Error error;
+        LatencyTimer timer(r.latency);
+        check(c4db_compact(_db, &error), error, "c4db_compact");
+        ++r.ops;
+    }
+
+    const Options _options;
+    const std::string _dbPath;
+    std::vector<std::string> _vocabulary;
+    C4Database *_db {NULL};
+    C4View *_views[kNumViews] {};
+    std::vector<std::unique_ptr<Result>> _results;
+    std::unique_ptr<Result> _extraResult;      // a second result reported by the last workload
+};
+
+
+static void writeLatency(FILE *out, const char *name, const LatencyHistogram &h) {
+    uint64_t count = h.count();
+    fprintf(out, "\"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+            name, (unsigned long long)count,
+            (unsigned long long)(count ? h.totalNanos() / count : 0),
+            (unsigned long long)h.percentile(50), (unsigned long long)h.percentile(90),
+            (unsigned long long)h.percentile(99), (unsigned long long)h.percentile(99.9),
+            (unsigned long long)h.maxNanos());
+}
+
+static void writeLatency(FILE *out, const char *name, const C4LatencyStats &s) {
+    fprintf(out, "\"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"max\": %llu}",
+            name, (unsigned long long)s.count, (unsigned long long)s.meanNanos,
+            (unsigned long long)s.p50Nanos, (unsigned long long)s.p90Nanos,
+            (unsigned long long)s.p99Nanos, (unsigned long long)s.maxNanos);
+}
+
+void Bench::writeJSON(FILE *out) const {
+    const Options &o = _options;
+    fprintf(out, "{\n  \"config\": {\"docs\": %u, \"bodySize\": %u, \"batchSize\": %u, "
+            "\"updates\": %u, \"hotDocs\": %u, \"reads\": %u, \"reindexDocs\": %u, "
+            "\"queries\": %u, \"rangeWidth\": %u, \"multiKeys\": %u, \"readers\": %u, "
+            "\"expireDocs\": %u, \"purgeBatch\": %u, \"seed\": %llu},\n",
+            o.docs, o.bodySize, o.batchSize, o.updates, o.hotDocs, o.reads, o.reindexDocs,
+            o.queries, o.rangeWidth, o.multiKeys, o.readers, o.expireDocs, o.purgeBatch,
+            (unsigned long long)o.seed);
+
+    fprintf(out, "  \"results\": [");
+    for (size_t i = 0; i < _results.size(); ++i) {
+        const Result &r = *_results[i];
+        double seconds = r.nanos / 1.0e9;
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"ops\": %llu, \"rows\": %llu, "
+                "\"seconds\": %.6f, \"opsPerSec\": %.1f, ",
+                (i > 0 ? "," : ""), r.name.c_str(),
+                (unsigned long long)r.ops, (unsigned long long)r.rows,
+                seconds, (seconds > 0 ? r.ops / seconds : 0.0));
+        if (r.fileBytes > 0)
+            fprintf(out, "\"fileBytes\": %llu, ", (unsigned long long)r.fileBytes);
+        writeLatency(out, "latencyNanos", r.latency);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]");
+
+    if (_db) {
+        C4DatabaseStats s;
+        c4db_getStats(_db, &s);
+        fprintf(out, ",\n  \"dbStats\": {\"gets\": %llu, \"sets\": %llu, \"deletes\": %llu, "
+                "\"iteratorSteps\": %llu, \"bytesRead\": %llu, \"bytesWritten\": %llu, "
+                "\"indexRowsAdded\": %llu, \"indexRowsRemoved\": %llu, "
+                "\"compactions\": %llu,\n    ",
+                (unsigned long long)s.gets, (unsigned long long)s.sets,
+                (unsigned long long)s.deletes, (unsigned long long)s.iteratorSteps,
+                (unsigned long long)s.bytesRead, (unsigned long long)s.bytesWritten,
+                (unsigned long long)s.indexRowsAdded, (unsigned long long)s.indexRowsRemoved,
+                (unsigned long long)s.compactions);
+        writeLatency(out, "transactionWait", s.transactionWait);
+        fprintf(out, ",\n    ");
+        writeLatency(out, "commit", s.commit);
+        fprintf(out, ",\n    ");
+        writeLatency(out, "revTreeDecode", s.revTreeDecode);
+        fprintf(out, ",\n    ");
+        writeLatency(out, "revTreeEncode", s.revTreeEncode);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n}\n");
+}
+
+
+static void usage() {
+    fprintf(stderr,
+        "usage: cbforest_bench [options]\n"
+        "  --docs N            docs to insert (%u)\n"
+        "  --body-size N       approximate bytes of text per doc (%u)\n"
+        "  --batch N           writes per transaction (%u)\n"
+        "  --updates N         revisions added by 'update' (%u)\n"
+        "  --hot-docs N        docs that 'update' spreads its revisions over (%u)\n"
+        "  --reads N           random reads, per thread in 'mixed' (%u)\n"
+        "  --reindex-docs N    docs changed before 'view_update' (%u)\n"
+        "  --queries N         queries per query workload (%u)\n"
+        "  --range-width N     keys spanned by each 'query_range' query (%u)\n"
+        "  --multi-keys N      keys per 'query_keys' query (%u)\n"
+        "  --readers N         reader threads in 'mixed' (%u)\n"
+        "  --expire-docs N     docs purged by 'expiry_purge' (%u)\n"
+        "  --purge-batch N     expiry purger batch size (%u)\n"
+        "  --seed N            random seed (%llu)\n"
+        "  --dir PATH          directory for the scratch databases (%s)\n"
+        "  --only W1,W2,...    report only these workloads\n"
+        "workloads:",
+        Options().docs, Options().bodySize, Options().batchSize, Options().updates,
+        Options().hotDocs, Options().reads, Options().reindexDocs, Options().queries,
+        Options().rangeWidth, Options().multiKeys, Options().readers, Options().expireDocs,
+        Options().purgeBatch, (unsigned long long)Options().seed, Options().dir.c_str());
+    for (auto w : kWorkloads)
+        fprintf(stderr, " %s", w);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+int main(int argc, const char *argv[]) {
+    Options options;
+    struct {const char *flag; unsigned *value;} kNumericFlags[] = {
+        {"--docs", &options.docs},              {"--body-size", &options.bodySize},
+        {"--batch", &options.batchSize},        {"--updates", &options.updates},
+        {"--hot-docs", &options.hotDocs},       {"--reads", &options.reads},
+        {"--reindex-docs", &options.reindexDocs}, {"--queries", &options.queries},
+        {"--range-width", &options.rangeWidth}, {"--multi-keys", &options.multiKeys},
+        {"--readers", &options.readers},        {"--expire-docs", &options.expireDocs},
+        {"--purge-batch", &options.purgeBatch},
+    };
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        const char *value = argv[++i];
+        bool found = false;
+        for (auto &f : kNumericFlags) {
+            if (strcmp(arg, f.flag) == 0) {
+                *f.value = (unsigned)strtoul(value, NULL, 10);
+                found = true;
+            }
+        }
+        if (found) {
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--dir") == 0) {
+            options.dir = value;
+        } else if (strcmp(arg, "--only") == 0) {
+            std::string list = value;
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = std::min(list.find(',', pos), list.size());
+                std::string name = list.substr(pos, comma - pos);
+                if (std::find_if(std::begin(kWorkloads), std::end(kWorkloads),
+                                 [&](const char *w) {return name == w;}) == std::end(kWorkloads)) {
+                    fprintf(stderr, "cbforest_bench: unknown workload '%s'\n", name.c_str());
+                    usage();
+                }
+                options.only.insert(name);
+                pos = comma + 1;
+            }
+        } else {
+            usage();
+        }
+    }
+    if (options.docs == 0 || options.batchSize == 0 || options.bodySize == 0
+            || options.hotDocs == 0)
+        usage();
+
+    {
+        Bench bench(options);
+        bench.run();
+        bench.writeJSON(stdout);
+    }
+    c4_shutdown(NULL);
+    return 0;
+}
@@ -0,0 +1,441 @@
+//
+//  cbforest_microbench.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+// Microbenchmarks of the encoding kernels: Collatable, varint, revid, RevTree, geohash,
+// slice::hash and TokenIterator. Each kernel runs over a fixed corpus generated from --seed.
+// After a warm-up, the number of passes per sample is calibrated so that a sample takes at
+// least --min-sample-ms; the per-operation times of the samples are then reported to stdout
+// as JSON (median, mean, standard deviation, 95% confidence interval of the mean, min.)
+
+#include "Collatable.hh"
+#include "Geohash.hh"
+#include "RevID.hh"
+#include "RevTree.hh"
+#include "Tokenizer.hh"
+#include "varint.hh"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace cbforest;
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Results of the kernels are folded into this, so the compiler can't discard the work.
+static volatile uint64_t sSink;
+
+
+struct Options {
+    unsigned samples        = 15;
+    unsigned minSampleMs    = 10;
+    unsigned warmupMs       = 100;
+    uint64_t seed           = 42;
+    std::set<std::string> only;         // kernels to run; empty means all
+};
+
+
+/** A kernel to time. Each call to `pass` performs `opsPerPass` operations (usually one per
+    corpus item.) */
+struct Kernel {
+    const char *name;
+    size_t opsPerPass;
+    std::function<void()> pass;
+};
+
+
+struct Timing {
+    std::string name;
+    uint64_t passesPerSample;
+    std::vector<double> nsPerOp;        // one per sample, sorted
+
+    double median() const   {size_t n = nsPerOp.size();
+                             return (nsPerOp[(n-1)/2] + nsPerOp[n/2]) / 2.0;}
+    double mean() const {
+        double sum = 0;
+        for (double t : nsPerOp)
+            sum += t;
+        return sum / nsPerOp.size();
+    }
+    double stddev() const {
+        if (nsPerOp.size() < 2)
+            return 0;
+        double m = mean(), sum = 0;
+        for (double t : nsPerOp)
+            sum += (t - m) * (t - m);
+        return sqrt(sum / (nsPerOp.size() - 1));
+    }
+    // Half-width of the 95% confidence interval of the mean (normal approximation.)
+    double ci95() const     {return 1.96 * stddev() / sqrt((double)nsPerOp.size());}
+};
+
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static Timing measure(const Kernel &k, const Options &options) {
+    // Warm up caches, branch predictors and lazily-initialized state:
+    auto start = Clock::now();
+    do {
+        k.pass();
+    } while (secondsSince(start) * 1000 < options.warmupMs);
+
+    // Calibrate: double the passes per sample until a sample takes long enough to time.
+    uint64_t passes = 1;
+    for (;;) {
+        start = Clock::now();
+        for (uint64_t i = 0; i < passes; ++i)
+            k.pass();
+        if (secondsSince(start) * 1000 >= options.minSampleMs || passes >= (1ull << 30))
+            break;
+        passes *= 2;
+    }
+
+    Timing timing;
+    timing.name = k.name;
+    timing.passesPerSample = passes;
+    for (unsigned s = 0; s < options.samples; ++s) {
+        start = Clock::now();
+        for (uint64_t i = 0; i < passes; ++i)
+            k.pass();
+        double ns = secondsSince(start) * 1.0e9;
+        timing.nsPerOp.push_back(ns / (passes * k.opsPerPass));
+    }
+    std::sort(timing.nsPerOp.begin(), timing.nsPerOp.end());
+    return timing;
+}
+
+
+//////// CORPORA:
+
+
+// A stand-in file offset for decoded rev trees; encoding a tree whose non-leaf revisions have
+// bodies requires one.
+static const uint64_t kDocOffset = 1234;
+
+// Common English words, for full-text passages.
+static const char* const kWords[] = {
+    "the", "of", "and", "to", "in", "is", "was", "that", "for", "with", "as", "on", "by", "at",
+    "from", "his", "her", "they", "which", "were", "been", "have", "their", "would", "there",
+    "about", "running", "houses", "quickly", "government", "information", "development",
+    "children", "system", "program", "question", "working", "national", "business", "service",
+    "company", "country", "important", "different", "following", "without", "something",
+    "general", "possible", "political", "interest", "experience", "community", "education",
+    "problems", "university", "security", "economic", "building", "language", "character",
+    "especially", "particular", "questions", "results", "mountains", "rivers", "libraries",
+    "résumé", "café", "naïve", "coöperate", "Zürich", "São", "Paulo", "documents", "database",
+};
+
+
+/** Fixed inputs for the kernels, generated from the seed. */
+struct Corpus {
+    struct ViewKey {
+        std::string type;
+        double number;
+        std::string date;
+    };
+
+    std::vector<ViewKey> keys;              // typical emitted keys: [type, number, date]
+    std::vector<alloc_slice> encodedKeys;
+    std::vector<std::string> docIDs;        // random UUIDs
+    std::vector<std::string> revIDs;        // ASCII revIDs with MD5-size digests
+    std::vector<revidBuffer> compressedRevIDs;
+    std::vector<uint64_t> varints;          // mixed sizes, mostly small
+    std::vector<uint8_t> encodedVarints;
+    std::vector<alloc_slice> revTrees;      // deep trees with a few conflicting branches
+    std::vector<geohash::coord> coords;
+    std::vector<geohash::area> areas;       // sizes ranging from a city block to a country
+    std::vector<std::string> passages;      // ~50-word English text
+
+    explicit Corpus(uint64_t seed) {
+        std::mt19937_64 rng(seed);
+        auto fraction = [&]{return (rng() >> 11) * (1.0 / 9007199254740992.0);};
+        char buf[100];
+
+        static const char* const kTypes[] = {"user", "order", "product", "comment", "invoice",
+                                             "session", "shipment", "review"};
+        // (Each rng() call is a separate statement: the evaluation order of function arguments
+        // is unspecified, and the corpus has to be the same with every compiler.)
+        for (unsigned i = 0; i < 1000; ++i) {
+            unsigned date[5];
+            for (unsigned j = 0; j < 5; ++j)
+                date[j] = (unsigned)(rng() % 60);
+            sprintf(buf, "2016-%02u-%02uT%02u:%02u:%02uZ",
+                    1 + date[0] % 12, 1 + date[1] % 28, date[2] % 24, date[3], date[4]);
+            ViewKey key = {kTypes[rng() % 8], (double)(rng() % 100000) / 100.0, buf};
+            keys.push_back(key);
+            CollatableBuilder builder;
+            builder.beginArray() << key.type << key.number << key.date;
+            builder.endArray();
+            encodedKeys.push_back(builder.extractOutput());
+        }
+
+        for (unsigned i = 0; i < 1000; ++i) {
+            uint64_t a = rng();
+            uint64_t b = rng();
+            sprintf(buf, "%08llx-%04llx-4%03llx-%04llx-%012llx",
+                    (unsigned long long)(a >> 32), (unsigned long long)((a >> 16) & 0xFFFF),
+                    (unsigned long long)(a & 0xFFF), (unsigned long long)(0x8000 | (b >> 50)),
+                    (unsigned long long)(b & 0xFFFFFFFFFFFFull));
+            docIDs.push_back(buf);
+
+            int len = sprintf(buf, "%u-", (unsigned)(1 + rng() % 2000));
+            for (unsigned j = 0; j < 2; ++j)
+                len += sprintf(buf + len, "%016llx", (unsigned long long)rng());
+            revIDs.push_back(buf);
+            compressedRevIDs.push_back(revidBuffer(slice(revIDs.back())));
+        }
+
+        for (unsigned i = 0; i < 4096; ++i) {
+            unsigned kind = rng() % 10;
+            uint64_t n = rng();
+            if (kind < 5)
+                n &= 0x7F;
+            else if (kind < 8)
+                n &= 0x1FFFFF;
+            varints.push_back(n);
+            uint8_t encoded[kMaxVarintLen64];
+            encodedVarints.insert(encodedVarints.end(), encoded, encoded + PutUVarInt(encoded, n));
+        }
+
+        for (unsigned t = 0; t < 10; ++t)
+            revTrees.push_back(makeRevTree(100, 3, rng));
+
+        for (unsigned i = 0; i < 1000; ++i) {
+            double lat = fraction() * 180.0 - 90.0;
+            double lon = fraction() * 360.0 - 180.0;
+            coords.push_back(geohash::coord(lat, lon));
+        }
+        for (unsigned i = 0; i < 100; ++i) {
+            double size = 0.01 * pow(1000.0, fraction());     // 0.01 to 10 degrees
+            double lat = fraction() * 160.0 - 80.0;
+            double lon = fraction() * 340.0 - 170.0;
+            areas.push_back(geohash::area(geohash::coord(lat, lon),
+                                          geohash::coord(lat + size, lon + size)));
+        }
+
+        for (unsigned i = 0; i < 100; ++i) {
+            std::string passage;
+            for (unsigned w = 0; w < 50; ++w) {
+                if (w > 0)
+                    passage += ' ';
+                passage += kWords[rng() % (sizeof(kWords) / sizeof(kWords[0]))];
+            }
+            passages.push_back(passage);
+        }
+    }
+
+    // Builds a tree with a linear history of `depth` revisions, plus `branches` conflicting
+    // leaves near the top, as a long-lived replicated document would have.
+    static alloc_slice makeRevTree(unsigned depth, unsigned branches, std::mt19937_64 &rng) {
+        RevTree tree;
+        int httpStatus;
+        std::vector<revidBuffer> history;
+        char buf[50];
+        for (unsigned gen = 1; gen <= depth; ++gen) {
+            sprintf(buf, "%u-%016llx", gen, (unsigned long long)rng());
+            history.push_back(revidBuffer(slice(buf)));
+            revid parent = (gen > 1) ? (revid)history[gen - 2] : revid();
+            tree.insert(history.back(), slice("{\"name\":\"value\",\"count\":17}"),
+                        false, false, parent, false, httpStatus);
+        }
+        for (unsigned b = 0; b < branches; ++b) {
+            unsigned gen = depth - 1 - b;
+            sprintf(buf, "%u-%016llx", gen + 1, (unsigned long long)rng());
+            tree.insert(revidBuffer(slice(buf)), slice("{\"conflict\":true}"),
+                        false, false, history[gen - 1], true, httpStatus);
+        }
+        // Round-trip once so that, as in a stored document, only the leaves have bodies:
+        alloc_slice raw = tree.encode();
+        RevTree stored(raw, 1, kDocOffset);
+        return stored.encode();
+    }
+};
+
+
+//////// KERNELS:
+
+
+static std::vector<Kernel> makeKernels(const Corpus &c) {
+    std::vector<Kernel> kernels;
+
+    kernels.push_back({"collatable_encode", c.keys.size(), [&c]{
+        CollatableBuilder builder;
+        for (auto &key : c.keys) {
+            builder.reset();
+            builder.beginArray() << key.type << key.number << key.date;
+            builder.endArray();
+            sSink += builder.size();
+        }
+    }});
+
+    kernels.push_back({"collatable_decode", c.encodedKeys.size(), [&c]{
+        for (auto &encoded : c.encodedKeys) {
+            CollatableReader reader(encoded);
+            reader.beginArray();
+            sSink += reader.readString().size;
+            sSink += (uint64_t)reader.readDouble();
+            sSink += reader.readString().size;
+            reader.endArray();
+        }
+    }});
+
+    kernels.push_back({"varint_put", c.varints.size(), [&c]{
+        uint8_t buf[kMaxVarintLen64];
+        for (uint64_t n : c.varints)
+            sSink += PutUVarInt(buf, n);
+    }});
+
+    kernels.push_back({"varint_get", c.varints.size(), [&c]{
+        slice in(c.encodedVarints.data(), c.encodedVarints.size());
+        uint64_t n;
+        while (ReadUVarInt(&in, &n))
+            sSink += n;
+    }});
+
+    kernels.push_back({"revid_parse", c.revIDs.size(), [&c]{
+        revidBuffer rev;
+        for (auto &revID : c.revIDs) {
+            rev.parse(slice(revID));
+            sSink += rev.size;
+        }
+    }});
+
+    kernels.push_back({"revid_expand", c.compressedRevIDs.size(), [&c]{
+        for (auto &rev : c.compressedRevIDs)
+            sSink += rev.expanded().size;
+    }});
+
+    kernels.push_back({"revtree_decode", c.revTrees.size(), [&c]{
+        for (auto &raw : c.revTrees) {
+            RevTree tree(raw, 1, kDocOffset);
+            sSink += tree.size();
+        }
+    }});
+
+    auto decodedTrees = std::make_shared<std::vector<std::unique_ptr<RevTree>>>();
+    for (auto &raw : c.revTrees)
+        decodedTrees->emplace_back(new RevTree(raw, 1, kDocOffset));
+    kernels.push_back({"revtree_encode", decodedTrees->size(), [decodedTrees]{
+        for (auto &tree : *decodedTrees)
+            sSink += tree->encode().size;
+    }});
+
+    kernels.push_back({"geohash_encode", c.coords.size(), [&c]{
+        for (auto &coord : c.coords)
+            sSink += geohash::hash(coord, 12).string[0];
+    }});
+
+    kernels.push_back({"geohash_cover", c.areas.size(), [&c]{
+        for (auto &area : c.areas)
+            sSink += area.coveringHashRanges(50).size();
+    }});
+
+    kernels.push_back({"slice_hash", c.docIDs.size(), [&c]{
+        for (auto &docID : c.docIDs)
+            sSink += slice(docID).hash();
+    }});
+
+    kernels.push_back({"tokenize", c.passages.size(), [&c]{
+        static Tokenizer tokenizer("english", true);
+        for (auto &passage : c.passages) {
+            for (TokenIterator i(tokenizer, slice(passage)); i; ++i)
+                sSink += i.token().size;
+        }
+    }});
+
+    return kernels;
+}
+
+
+//////// MAIN:
+
+
+static void usage() {
+    Options o;
+    fprintf(stderr,
+        "usage: cbforest_microbench [options]\n"
+        "  --samples N         timed samples per kernel (%u)\n"
+        "  --min-sample-ms N   minimum duration of a sample (%u)\n"
+        "  --warmup-ms N       warm-up time per kernel (%u)\n"
+        "  --seed N            seed of the generated corpora (%llu)\n"
+        "  --only K1,K2,...    run only these kernels\n",
+        o.samples, o.minSampleMs, o.warmupMs, (unsigned long long)o.seed);
+    exit(1);
+}
+
+
+int main(int argc, const char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        const char *value = argv[++i];
+        if (strcmp(arg, "--samples") == 0)
+            options.samples = (unsigned)strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--min-sample-ms") == 0)
+            options.minSampleMs = (unsigned)strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--warmup-ms") == 0)
+            options.warmupMs = (unsigned)strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0)
+            options.seed = strtoull(value, NULL, 10);
+        else if (strcmp(arg, "--only") == 0) {
+            std::string list = value;
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = std::min(list.find(',', pos), list.size());
+                options.only.insert(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        } else
+            usage();
+    }
+    if (options.samples == 0)
+        usage();
+
+    Corpus corpus(options.seed);
+    std::vector<Timing> timings;
+    for (auto &kernel : makeKernels(corpus)) {
+        if (!options.only.empty() && !options.only.count(kernel.name))
+            continue;
+        fprintf(stderr, "cbforest_microbench: %s...\n", kernel.name);
+        timings.push_back(measure(kernel, options));
+    }
+
+    printf("{\n  \"config\": {\"samples\": %u, \"minSampleMs\": %u, \"warmupMs\": %u, "
+           "\"seed\": %llu},\n  \"results\": [",
+           options.samples, options.minSampleMs, options.warmupMs,
+           (unsigned long long)options.seed);
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const Timing &t = timings[i];
+        printf("%s\n    {\"name\": \"%s\", \"passesPerSample\": %llu, \"nsPerOp\": "
+               "{\"median\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, \"ci95\": %.3f, "
+               "\"min\": %.3f}}",
+               (i > 0 ? "," : ""), t.name.c_str(), (unsigned long long)t.passesPerSample,
+               t.median(), t.mean(), t.stddev(), t.ci95(), t.nsPerOp.front());
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
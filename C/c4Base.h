@@ -188,6 +188,21 @@ typedef void (*C4LogCallback)(C4LogLevel level, C4Slice message);
     @param callback  The logging callback, or NULL to disable logging entirely. */
 void c4log_register(C4LogLevel level, C4LogCallback callback);
 
+/** Enables or disables asynchronous logging. When enabled, messages are formatted into a
+    bounded queue and the callback is invoked on a background thread, so logging never blocks
+    the calling thread on the callback. If messages arrive faster than the callback handles
+    them, the excess is dropped and counted, and a warning reports the count.
+    Disabling delivers all pending messages first. Don't enable this if the callback has to
+    run on the thread that logged (e.g. one that needs a thread-local environment.) */
+void c4log_setAsync(bool async);
+
+/** Blocks until all messages logged so far have been delivered to the callback.
+    Does nothing if logging isn't asynchronous. */
+void c4log_flush(void);
+
+/** Returns the number of messages dropped because the asynchronous log queue was full. */
+uint64_t c4log_getDroppedCount(void);
+
 
 /** Returns the number of objects that have been created but not yet freed. */
 int c4_getObjectCount(void);
@@ -16,11 +16,16 @@
 #include "c4Impl.hh"
 #include "c4Database.h"
 #include "c4Private.h"
+#include "c4ExpiryEnumerator.h"
 
+#include "CompactionScheduler.hh"
 #include "Database.hh"
 #include "Document.hh"
 #include "DocEnumerator.hh"
+#include "FileSyncer.hh"
 #include "LogInternal.hh"
+#include "LogQueue.hh"
+#include "MemoryBudget.hh"
 #include "VersionedDocument.hh"
 
 using namespace cbforest;
@@ -156,12 +161,40 @@ void c4log_register(C4LogLevel level, C4LogCallback callback) {
 }
 
 
+void c4log_setAsync(bool async) {
+    if (async)
+        LogQueue::shared().start();
+    else
+        LogQueue::shared().stop();
+}
+
+
+void c4log_flush(void) {
+    LogQueue::shared().flush();
+}
+
+
+uint64_t c4log_getDroppedCount(void) {
+    return LogQueue::shared().droppedCount();
+}
+
+
 #pragma mark - DATABASES:
 
 
 c4Database::c4Database(std::string path, const config& cfg)
 :Database(path, cfg)
-{ }
+{
+    CompactionScheduler::shared().addFile(filename(), cfg);
+    _registeredForCompaction = true;
+}
+
+void c4Database::unregisterForCompaction() {
+    if (_registeredForCompaction) {
+        _registeredForCompaction = false;
+        CompactionScheduler::shared().removeFile(filename());
+    }
+}
 
 void c4Database::beginTransaction() {
 #if C4DB_THREADSAFE
@@ -223,6 +256,7 @@ namespace c4Internal {
         auto config = Database::defaultConfig();
         // global to all databases:
         config.buffercache_size = kDBBufferCacheSize;
+        MemoryBudget::shared().configure(config);
         config.compress_document_body = true;
         config.compactor_sleep_duration = kAutoCompactInterval;
         config.num_compactor_threads = 1;
@@ -238,6 +272,10 @@ namespace c4Internal {
         config.wal_flush_before_commit = true;
         config.seqtree_opt = FDB_SEQTREE_USE;
         config.compaction_mode = (flags & kC4DB_AutoCompact) ? FDB_COMPACTION_AUTO : FDB_COMPACTION_MANUAL;
+        if (flags & kC4DB_SyncPeriodically)
+            Database::setDurability(config, Database::kDurabilityPeriodicSync);
+        else if (flags & kC4DB_NoSync)
+            Database::setDurability(config, Database::kDurabilityNoSync);
         if (key) {
             config.encryption_key.algorithm = key->algorithm;
             memcpy(config.encryption_key.bytes, key->bytes, sizeof(config.encryption_key.bytes));
@@ -245,6 +283,12 @@ namespace c4Internal {
         return config;
     }
 
+    // Call after opening with c4DbConfig(flags).
+    void setSyncInterval(Database *db, C4DatabaseFlags flags) {
+        if ((flags & kC4DB_SyncPeriodically) && db->syncInterval() == 0)
+            db->setSyncInterval(Database::kDefaultSyncInterval);
+    }
+
 }
 
 
@@ -256,8 +300,9 @@ C4Database* c4db_open(C4Slice path,
     auto pathStr = (std::string)path;
     auto config = c4DbConfig(flags, encryptionKey);
     try {
+        C4Database *db;
         try {
-            return (new c4Database(pathStr, config))->retain();
+            db = (new c4Database(pathStr, config))->retain();
         } catch (cbforest::error error) {
             if (error.status == FDB_RESULT_INVALID_COMPACTION_MODE
                         && config.compaction_mode == FDB_COMPACTION_AUTO) {
@@ -265,13 +310,14 @@ C4Database* c4db_open(C4Slice path,
                 // Opening them with auto-compact causes this error. Upgrade such a database by
                 // switching its compaction mode:
                 config.compaction_mode = FDB_COMPACTION_MANUAL;
-                auto db = (new c4Database(pathStr, config))->retain();
+                db = (new c4Database(pathStr, config))->retain();
                 db->setCompactionMode(FDB_COMPACTION_AUTO);
-                return db;
             } else {
                 throw error;
             }
         }
+        setSyncInterval(db, flags);
+        return db;
     }catchError(outError);
     return NULL;
 }
@@ -282,9 +328,11 @@ bool c4db_close(C4Database* database, C4Error *outError) {
         return true;
     if (!database->mustNotBeInTransaction(outError))
         return false;
+    c4db_stopExpiryPurger(database);
     WITH_LOCK(database);
     try {
         database->close();
+        database->unregisterForCompaction();
         return true;
     } catchError(outError);
     return false;
@@ -296,6 +344,7 @@ bool c4db_free(C4Database* database) {
         return true;
     if (!database->mustNotBeInTransaction(NULL))
         return false;
+    c4db_stopExpiryPurger(database);
     WITH_LOCK(database);
     try {
         database->release();
@@ -308,11 +357,13 @@ bool c4db_free(C4Database* database) {
 bool c4db_delete(C4Database* database, C4Error *outError) {
     if (!database->mustNotBeInTransaction(outError))
         return false;
+    c4db_stopExpiryPurger(database);
     WITH_LOCK(database);
     try {
         if (database->refCount() > 1) {
             recordError(ForestDBDomain, FDB_RESULT_FILE_IS_BUSY, outError);
         }
+        database->unregisterForCompaction();
         database->deleteDatabase();
         return true;
     } catchError(outError);
@@ -352,6 +403,51 @@ void c4db_setOnCompactCallback(C4Database *database, C4OnCompactCallback cb, voi
 }
 
 
+void c4_startCompactionScheduler(const C4CompactionSchedulerOptions *options) {
+    CompactionScheduler::Options opts;
+    if (options) {
+        opts.minFragmentation = options->minFragmentation;
+        opts.minReclaimableBytes = options->minReclaimableBytes;
+        opts.maxBytesPerSec = options->maxBytesPerSec;
+        opts.intervalSecs = std::max(options->intervalSecs, 1u);
+    }
+    CompactionScheduler::shared().start(opts);
+}
+
+void c4_stopCompactionScheduler(void) {
+    CompactionScheduler::shared().stop();
+}
+
+namespace c4Internal {
+    void getCompactionStatus(Database *database, C4CompactionStatus *outStatus) {
+        // No lock needed; this doesn't touch the handle's ForestDB state
+        CompactionScheduler::FileStatus status;
+        if (CompactionScheduler::shared().getStatus(database->filename(), status)) {
+            outStatus->fileSize = status.fileSize;
+            outStatus->spaceUsed = status.spaceUsed;
+            outStatus->compacting = status.compacting;
+            outStatus->progress = status.progress;
+        } else {
+            *outStatus = {};
+        }
+        if (database->isCompacting()) {
+            outStatus->compacting = true;
+            outStatus->progress = database->compactionProgress();
+        }
+    }
+}
+
+void c4db_getCompactionStatus(C4Database *database, C4CompactionStatus *outStatus) {
+    getCompactionStatus(database, outStatus);
+}
+
+
+void c4db_setSyncInterval(C4Database* database, unsigned milliseconds) {
+    // No lock needed; the interval is atomic
+    database->setSyncInterval(milliseconds);
+}
+
+
 bool c4db_rekey(C4Database* database, const C4EncryptionKey *newKey, C4Error *outError) {
     if (!database->mustNotBeInTransaction(outError))
         return false;
@@ -369,6 +465,7 @@ bool c4Internal::rekey(Database* database, const C4EncryptionKey *newKey,
             memcpy(key.bytes, newKey->bytes, sizeof(key.bytes));
         }
         database->rekey(key);
+        CompactionScheduler::shared().setConfig(database->filename(), database->getConfig());
         return true;
     } catchError(outError);
     return false;
@@ -469,15 +566,106 @@ uint64_t c4db_nextDocExpiration(C4Database *database)
     return 0ul;
 }
 
+#pragma mark - STATISTICS:
+
+
+static void exportLatency(const LatencyHistogram &h, C4LatencyStats *out) {
+    out->count = h.count();
+    out->meanNanos = out->count ? h.totalNanos() / out->count : 0;
+    out->p50Nanos = h.percentile(50);
+    out->p90Nanos = h.percentile(90);
+    out->p99Nanos = h.percentile(99);
+    out->maxNanos = h.maxNanos();
+}
+
+namespace c4Internal {
+    void exportStats(const DatabaseStats &stats, C4DatabaseStats *out) {
+        out->gets = stats.gets;
+        out->sets = stats.sets;
+        out->deletes = stats.deletes;
+        out->iteratorSteps = stats.iteratorSteps;
+        out->bytesRead = stats.bytesRead;
+        out->bytesWritten = stats.bytesWritten;
+        out->indexRowsAdded = stats.indexRowsAdded;
+        out->indexRowsRemoved = stats.indexRowsRemoved;
+        out->compactions = stats.compactions;
+        out->docCacheHits = stats.docCacheHits;
+        out->docCacheMisses = stats.docCacheMisses;
+        out->docIDFilterSkips = stats.keyFilterSkips;
+        out->docIDFilterFalsePositives = stats.keyFilterFalsePositives;
+        exportLatency(stats.transactionWait, &out->transactionWait);
+        exportLatency(stats.commit, &out->commit);
+        exportLatency(stats.revTreeDecode, &out->revTreeDecode);
+        exportLatency(stats.revTreeEncode, &out->revTreeEncode);
+        exportLatency(stats.fileSync, &out->fileSync);
+    }
+}
+
+void c4db_getStats(C4Database *database, C4DatabaseStats *outStats) {
+    // No lock needed; the counters are atomic
+    exportStats(database->stats(), outStats);
+}
+
+void c4db_resetStats(C4Database *database) {
+    database->stats().reset();
+}
+
+void c4db_setDocumentCacheSize(C4Database *database, size_t maxBytes) {
+    // No lock needed; the cache is thread-safe
+    database->docCache()->setCapacity(maxBytes);
+}
+
+bool c4db_setDocIDFilterEnabled(C4Database *database, bool enabled, C4Error *outError) {
+    if (!database->mustNotBeInTransaction(outError))
+        return false;
+    WITH_LOCK(database);
+    try {
+        database->setKeyFilterEnabled("", enabled);
+        return true;
+    } catchError(outError);
+    return false;
+}
+
+
 bool c4_shutdown(C4Error *outError) {
     fdb_status err = fdb_shutdown();
     if (err) {
         recordError(err, outError);
         return false;
     }
+    MemoryBudget::shared().forestDBShutDown();
     return true;
 }
 
+
+void c4_stopFileSyncer(void) {
+    FileSyncer::shared().stop();
+}
+
+
+#pragma mark - MEMORY:
+
+
+void c4_setMemoryBudget(uint64_t maxBytes) {
+    MemoryBudget::shared().setBudget(maxBytes);
+}
+
+void c4_trimMemory(C4MemoryTrimLevel level) {
+    MemoryBudget::shared().trim(level == kC4TrimCritical ? MemoryBudget::kTrimCritical
+                                                         : MemoryBudget::kTrimModerate);
+}
+
+void c4_getMemoryUsage(C4MemoryUsage *outUsage) {
+    auto usage = MemoryBudget::shared().usage();
+    outUsage->budget = usage.budget;
+    outUsage->forestDBCache = usage.bufferCache;
+    outUsage->writeAheadLogs = usage.wal;
+    outUsage->documentCaches = usage.docCaches;
+    outUsage->documentCacheLimit = usage.docCacheCapacity;
+    outUsage->docIDFilters = usage.keyFilters;
+    outUsage->openFiles = usage.openFiles;
+}
+
 #pragma mark - RAW DOCUMENTS:
 
 
@@ -25,6 +25,9 @@ extern "C" {
         kC4DB_Create        = 1,    /**< Create the file if it doesn't exist */
         kC4DB_ReadOnly      = 2,    /**< Open file read-only */
         kC4DB_AutoCompact   = 4,    /**< Enable auto-compaction */
+        kC4DB_SyncPeriodically = 8, /**< Don't fsync on commit; sync in the background soon after */
+        kC4DB_NoSync        = 16,   /**< Don't fsync on commit; leave it to the OS */
+        kC4DB_SharedIndexFile = 32, /**< (Views only) The file may hold other views' indexes */
     };
 
     /** Encryption algorithms. */
@@ -42,7 +45,17 @@ extern "C" {
     /** Opaque handle to an opened database. */
     typedef struct c4Database C4Database;
 
-    /** Opens a database. */
+    /** Opens a database.
+
+        By default every commit is synced to disk before it returns. For data that can be
+        recreated, like caches and view indexes, the kC4DB_SyncPeriodically and kC4DB_NoSync
+        flags trade durability for commit speed: commits don't wait for a sync. After a process
+        crash, all committed changes will be there, since they've been written to the OS. After
+        an OS crash or power failure, changes committed in the last sync interval (see
+        c4db_setSyncInterval) may be lost; with kC4DB_NoSync, the window is however long the OS
+        takes to write its cache. Since unsynced writes can also reach the disk out of order, an
+        OS crash can occasionally leave such a file unreadable, so use these flags only for data
+        that can be rebuilt. */
     C4Database* c4db_open(C4Slice path,
                           C4DatabaseFlags flags,
                           const C4EncryptionKey *encryptionKey,
@@ -76,6 +89,42 @@ extern "C" {
         careful of thread safety. */
     void c4db_setOnCompactCallback(C4Database *database, C4OnCompactCallback cb, void *context);
 
+    /** Settings of the background compaction scheduler. */
+    typedef struct {
+        double minFragmentation;        ///< Min fraction of a file that's unused (default 0.5)
+        uint64_t minReclaimableBytes;   ///< Min bytes compaction would free (default 1MB)
+        uint64_t maxBytesPerSec;        ///< Compaction I/O rate limit; 0 = unlimited (default)
+        unsigned intervalSecs;          ///< How often to check the files (default 60)
+    } C4CompactionSchedulerOptions;
+
+    /** Starts a background thread that periodically checks the fragmentation of every open
+        database and view index file, and compacts the one that would free the most space,
+        limiting its I/O rate so foreground activity isn't starved. Files opened with
+        kC4DB_AutoCompact are left to ForestDB's own compactor. If the scheduler is already
+        running, this changes its options. Pass NULL for the default options. The scheduler
+        compacts with its own handle, so OnCompact callbacks aren't called. */
+    void c4_startCompactionScheduler(const C4CompactionSchedulerOptions *options);
+
+    /** Stops the compaction scheduler, after finishing (without throttling) any compaction in
+        progress. */
+    void c4_stopCompactionScheduler(void);
+
+    /** Compaction status of a database or view index file. */
+    typedef struct {
+        uint64_t fileSize;          ///< File size, as of the scheduler's last check (or 0)
+        uint64_t spaceUsed;         ///< Bytes in use, as of the scheduler's last check (or 0)
+        bool compacting;            ///< Is it being compacted now?
+        double progress;            ///< Approximate fraction of the file compacted so far
+    } C4CompactionStatus;
+
+    /** Gets the status of a database's compaction, by the scheduler or by c4db_compact. */
+    void c4db_getCompactionStatus(C4Database *database, C4CompactionStatus *outStatus);
+
+    /** Sets how long after a commit a database opened with kC4DB_SyncPeriodically is synced to
+        disk, bounding how many recent changes an OS crash or power failure can lose. The default
+        is 1000ms. Applies to all handles on the file. */
+    void c4db_setSyncInterval(C4Database* database, unsigned milliseconds);
+
     /** Changes a database's encryption key (removing encryption if it's NULL.) */
     bool c4db_rekey(C4Database* database,
                     const C4EncryptionKey *newKey,
@@ -110,9 +159,101 @@ extern "C" {
     /** Returns the timestamp at which the next document expiration should take place. */
     uint64_t c4db_nextDocExpiration(C4Database *database);
 
+    //////// STATISTICS:
+
+
+    /** Distribution of the durations of one kind of operation, in nanoseconds.
+        Percentiles are accurate to within 12.5%. */
+    typedef struct {
+        uint64_t count;             ///< Number of operations measured
+        uint64_t meanNanos;
+        uint64_t p50Nanos;          ///< Median
+        uint64_t p90Nanos;
+        uint64_t p99Nanos;
+        uint64_t maxNanos;
+    } C4LatencyStats;
+
+    /** Activity counters of a database file. These are shared by all handles on the same file,
+        and accumulate for the lifetime of the process (or until c4db_resetStats is called.) */
+    typedef struct {
+        uint64_t gets;              ///< Documents read by key, sequence or offset
+        uint64_t sets;
+        uint64_t deletes;
+        uint64_t iteratorSteps;     ///< Documents returned by enumerators
+        uint64_t bytesRead;         ///< Meta + body bytes of documents read
+        uint64_t bytesWritten;      ///< Key + meta + body bytes of documents written
+        uint64_t indexRowsAdded;    ///< View index rows added or overwritten
+        uint64_t indexRowsRemoved;  ///< View index rows removed or overwritten
+        uint64_t compactions;       ///< Completed compactions
+        uint64_t docCacheHits;      ///< Revision trees or old bodies found in the document cache
+        uint64_t docCacheMisses;    ///< Document cache lookups that had to read from the file
+        uint64_t docIDFilterSkips;  ///< Lookups of missing docs answered by the docID filter
+        uint64_t docIDFilterFalsePositives; ///< Lookups the filter passed that found no doc
+        C4LatencyStats transactionWait; ///< Time spent waiting for another transaction to end
+        C4LatencyStats commit;          ///< Time to commit transactions
+        C4LatencyStats revTreeDecode;   ///< Time to decode documents' revision trees
+        C4LatencyStats revTreeEncode;   ///< Time to encode documents' revision trees
+        C4LatencyStats fileSync;        ///< Background syncs of a kC4DB_SyncPeriodically file
+    } C4DatabaseStats;
+
+    /** Copies the database file's current activity counters into *outStats. */
+    void c4db_getStats(C4Database *database, C4DatabaseStats *outStats);
+
+    /** Resets the database file's activity counters to zero. */
+    void c4db_resetStats(C4Database *database);
+
+    /** Sets the maximum size in bytes of the database file's cache of decoded revision trees
+        and old revision bodies, which speeds up repeated reads of the same documents. The cache
+        is shared by all handles on the file. The default is 0, which disables it.
+        While a memory budget is set (see c4_setMemoryBudget) the budget determines the size. */
+    void c4db_setDocumentCacheSize(C4Database *database, size_t maxBytes);
+
+    /** Enables or disables an in-memory Bloom filter of the database's docIDs, which lets
+        lookups of nonexistent documents return without searching the file. It costs about
+        10 bits per document, and enabling it reads every docID. It's shared by all handles on
+        the file, and is disabled by default. Must not be called in a transaction. */
+    bool c4db_setDocIDFilterEnabled(C4Database *database, bool enabled, C4Error *outError);
+
+
     /** Closes down ForestDB state by calling fdb_shutdown(). */
     bool c4_shutdown(C4Error *outError);
 
+    //////// MEMORY:
+
+
+    /** Sets a total budget, in bytes, for the memory used by all open databases and views.
+        Half goes to ForestDB's buffer cache, whose size can only be set before the first file
+        is opened (or after c4_shutdown.) What's left after the files' write-ahead logs and
+        docID filters is divided among the files' document caches, in proportion to how much
+        each file has been accessed lately; this is redone periodically. View index files don't
+        read documents, so they get no share. 0 (the default) means no budget: the buffer cache
+        is 8MB, and document caches are sized individually with c4db_setDocumentCacheSize.
+        Removing a budget disables all the document caches, until that's called again. */
+    void c4_setMemoryBudget(uint64_t maxBytes);
+
+    /** How urgently memory should be freed, e.g. in response to an OS low-memory warning. */
+    typedef C4_ENUM(uint32_t, C4MemoryTrimLevel) {
+        kC4TrimModerate = 0,        ///< Evict the least recently used half of the caches
+        kC4TrimCritical = 1,        ///< Empty the caches
+    };
+
+    /** Frees cached memory. The caches keep their capacities, and refill as they're used. */
+    void c4_trimMemory(C4MemoryTrimLevel level);
+
+    /** Memory use of the open databases and views, by subsystem. */
+    typedef struct {
+        uint64_t budget;            ///< The budget set by c4_setMemoryBudget, or 0
+        uint64_t forestDBCache;     ///< Size of ForestDB's buffer cache (allocated as it fills)
+        uint64_t writeAheadLogs;    ///< Estimated memory of the files' write-ahead log indexes
+        uint64_t documentCaches;    ///< Used by the files' document caches
+        uint64_t documentCacheLimit;///< Total capacity of the document caches
+        uint64_t docIDFilters;      ///< Used by docID filters (c4db_setDocIDFilterEnabled)
+        uint32_t openFiles;         ///< Number of open database and view index files
+    } C4MemoryUsage;
+
+    /** Reports the memory use of the open databases and views. */
+    void c4_getMemoryUsage(C4MemoryUsage *outUsage);
+
     //////// RAW DOCUMENTS (i.e. info or _local)
 
 
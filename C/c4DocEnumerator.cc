@@ -21,6 +21,7 @@
 #include "DocEnumerator.hh"
 #include "LogInternal.hh"
 #include "VersionedDocument.hh"
+#include <memory>
 #include <set>
 
 using namespace cbforest;
@@ -30,7 +31,8 @@ using namespace cbforest;
 
 CBFOREST_API const C4EnumeratorOptions kC4DefaultEnumeratorOptions = {
     0, // skip
-    kC4InclusiveStart | kC4InclusiveEnd | kC4IncludeNonConflicted | kC4IncludeBodies
+    kC4InclusiveStart | kC4InclusiveEnd | kC4IncludeNonConflicted | kC4IncludeBodies,
+    kC4SliceNull // resumeAfter
 };
 
 
@@ -78,6 +80,8 @@ struct C4DocEnumerator: c4Internal::InstanceCounted {
         return options;
     }
 
+    void resumeAfter(slice docID)        {_e.seekPast(docID);}
+
     void setFilter(const EnumFilter &f)  {_filter = f;}
 
     C4Database* database() const {return _database;}
@@ -169,8 +173,12 @@ C4DocEnumerator* c4db_enumerateAllDocs(C4Database *database,
 {
     try {
         WITH_LOCK(database);
-        return new C4DocEnumerator(database, startDocID, endDocID,
-                                   c4options ? *c4options : kC4DefaultEnumeratorOptions);
+        std::unique_ptr<C4DocEnumerator> e(
+                    new C4DocEnumerator(database, startDocID, endDocID,
+                                        c4options ? *c4options : kC4DefaultEnumeratorOptions));
+        if (c4options && c4options->resumeAfter.buf)
+            e->resumeAfter(c4options->resumeAfter);
+        return e.release();
     } catchError(outError);
     return NULL;
 }
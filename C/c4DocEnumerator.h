@@ -36,6 +36,8 @@ extern "C" {
     typedef struct {
         uint64_t          skip;     /**< The number of initial results to skip. */
         C4EnumeratorFlags flags;    /**< Option flags */
+        C4Slice           resumeAfter; /**< All-docs only: start just after this docID (the last
+                                            one seen), instead of using `skip` to page. */
     } C4EnumeratorOptions;
 
     /** Default all-docs enumeration options.
@@ -27,8 +27,8 @@
 #include "SecureDigest.hh"
 #include "varint.hh"
 #include <ctime>
-#include <algorithm>
-
+#include <chrono>
+#include <mutex>
 #include <algorithm>
 
 #include <algorithm>
@@ -185,6 +185,46 @@ static inline C4DocumentInternal *internal(C4Document *doc) {
     return (C4DocumentInternal*)doc;
 }
 
+// Writes the expiry KeyStore key for a doc's expiration into `key`, reusing its buffer.
+static void buildExpiryKey(CollatableBuilder &key, uint64_t timestamp, slice docID) {
+    key.reset();
+    key.beginArray();
+    key << (double)timestamp;
+    key << docID;
+    key.endArray();
+}
+
+// Updates a doc's entries in the expiry KeyStore. `scratchKey` is reused to build keys.
+static void writeExpiration(KeyStoreWriter &writer, CollatableBuilder &scratchKey,
+                            slice docID, uint64_t timestamp)
+{
+    uint8_t tsBuf[kMaxVarintLen64];
+    slice tsValue(tsBuf, PutUVarInt(tsBuf, timestamp));
+
+    Document existingDoc = writer.get(docID);
+    if (existingDoc.exists()) {
+        // Previous entry found
+        if (existingDoc.body().compare(tsValue) == 0) {
+            // No change
+            return;
+        }
+
+        // Remove old entry
+        uint64_t oldTimestamp;
+        GetUVarInt(existingDoc.body(), &oldTimestamp);
+        buildExpiryKey(scratchKey, oldTimestamp, docID);
+        writer.del(scratchKey);
+    }
+
+    if (timestamp == 0) {
+        writer.del(docID);
+    } else {
+        buildExpiryKey(scratchKey, timestamp, docID);
+        writer.set(scratchKey, slice::null);
+        writer.set(docID, tsValue);
+    }
+}
+
 // This helper function is meant to be wrapped in a transaction
 static bool c4doc_setExpirationInternal(C4Database *db, C4Slice docId, uint64_t timestamp, C4Error *outError)
 {
@@ -195,48 +235,13 @@ static bool c4doc_setExpirationInternal(C4Database *db, C4Slice docId, uint64_t
             return false;
         }
 
-        CollatableBuilder tsKeyBuilder;
-        tsKeyBuilder.beginArray();
-        tsKeyBuilder << (double)timestamp;
-        tsKeyBuilder << docId;
-        tsKeyBuilder.endArray();
-        slice tsKey = tsKeyBuilder.data();
-
-        alloc_slice tsValue(SizeOfVarInt(timestamp));
-        PutUVarInt((void *)tsValue.buf, timestamp);
-
         WITH_LOCK(db);
 
         Transaction *t = db->transaction();
         KeyStore& expiry = db->getKeyStore("expiry");
         KeyStoreWriter writer(expiry, *t);
-        Document existingDoc = writer.get(docId);
-        if (existingDoc.exists()) {
-            // Previous entry found
-            if (existingDoc.body().compare(tsValue) == 0) {
-                // No change
-                return true;
-            }
-
-            // Remove old entry
-            uint64_t oldTimestamp;
-            CollatableBuilder oldTsKey;
-            GetUVarInt(existingDoc.body(), &oldTimestamp);
-            oldTsKey.beginArray();
-            oldTsKey << (double)oldTimestamp;
-            oldTsKey << docId;
-            oldTsKey.endArray();
-            writer.del(oldTsKey);
-        }
-
-        if (timestamp == 0) {
-            writer.del(tsKey);
-            writer.del(docId);
-        } else {
-            writer.set(tsKey, slice::null);
-            writer.set(docId, tsValue);
-        }
-
+        CollatableBuilder key;
+        writeExpiration(writer, key, docId, timestamp);
         return true;
     } catchError(outError);
 
@@ -549,7 +554,47 @@ bool c4doc_setExpiration(C4Database *db, C4Slice docId, uint64_t timestamp, C4Er
     }
 
     bool commit = c4doc_setExpirationInternal(db, docId, timestamp, outError);
-    return c4db_endTransaction(db, commit, outError);
+    if (!c4db_endTransaction(db, commit, outError))
+        return false;
+    if (commit && timestamp != 0)
+        wakeExpiryPurger(db);
+    return true;
+}
+
+bool c4db_setExpirations(C4Database *db,
+                         const C4Slice docIDs[],
+                         const uint64_t timestamps[],
+                         size_t count,
+                         C4Error *outError)
+{
+    // Visit the docs in docID order, so the lookups and writes walk the trees sequentially:
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return docIDs[a].compare(docIDs[b]) < 0;
+    });
+
+    if (!c4db_beginTransaction(db, outError))
+        return false;
+    bool commit = false;
+    try {
+        WITH_LOCK(db);
+        Transaction *t = db->transaction();
+        KeyStore& expiry = db->getKeyStore("expiry");
+        KeyStoreWriter writer(expiry, *t);
+        CollatableBuilder key;
+        for (auto i = order.begin(); i != order.end(); ++i) {
+            if (db->get(docIDs[*i], KeyStore::kMetaOnly).exists())
+                writeExpiration(writer, key, docIDs[*i], timestamps[*i]);
+        }
+        commit = true;
+    } catchError(outError);
+
+    if (!c4db_endTransaction(db, commit, outError) || !commit)
+        return false;
+    wakeExpiryPurger(db);
+    return true;
 }
 
 uint64_t c4doc_getExpiration(C4Database *db, C4Slice docID)
@@ -565,25 +610,82 @@ uint64_t c4doc_getExpiration(C4Database *db, C4Slice docID)
     return timestamp;
 }
 
+static bool sGenerateTimeOrderedDocIDs = false;
+
+static const unsigned kDocUUIDLength = 22;  // 22 base64 chars = 132 bits
+static const unsigned kTimeChars = 8;       // 48 bits of milliseconds since 1970, in time-ordered IDs
+
+#if SECURE_RANDOMIZE_AVAILABLE
+// Fills `sextets` with a time-ordered docID's digits: a millisecond timestamp followed by random
+// digits. IDs generated in the same millisecond increment the random part of the previous one,
+// so every ID sorts after the ones generated before it in this process.
+static void timeOrderedDocUUID(uint8_t sextets[kDocUUIDLength]) {
+    static std::mutex sMutex;
+    static uint64_t sLastTime = 0;
+    static uint8_t sLastRandom[kDocUUIDLength - kTimeChars];
+
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(sMutex);
+    if (now > sLastTime) {
+        sLastTime = now;
+        SecureRandomize({sLastRandom, sizeof(sLastRandom)});
+        for (auto &r : sLastRandom)
+            r %= 64;
+    } else {
+        // Same millisecond, or the clock went backwards; keep the last time and count up:
+        int i = sizeof(sLastRandom) - 1;
+        while (i >= 0 && ++sLastRandom[i] == 64)
+            sLastRandom[i--] = 0;
+        if (i < 0)
+            ++sLastTime;        // 84 bits overflowed; borrow the next millisecond
+    }
+    for (unsigned i = 0; i < kTimeChars; ++i)
+        sextets[i] = (sLastTime >> (6 * (kTimeChars - 1 - i))) & 63;
+    memcpy(&sextets[kTimeChars], sLastRandom, sizeof(sLastRandom));
+}
+#endif
+
 static alloc_slice createDocUUID() {
 #if SECURE_RANDOMIZE_AVAILABLE
     static const char kBase64[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
                                     "0123456789-_";
-    const unsigned kLength = 22; // 22 random base64 chars = 132 bits of entropy
-    uint8_t r[kLength];
-    SecureRandomize({r, sizeof(r)});
+    // The same characters in ASCII order, so that time-ordered IDs sort correctly:
+    static const char kSortedBase64[65] = "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                          "_abcdefghijklmnopqrstuvwxyz";
+    uint8_t r[kDocUUIDLength];
+    const char *digits;
+    if (sGenerateTimeOrderedDocIDs) {
+        timeOrderedDocUUID(r);
+        digits = kSortedBase64;
+    } else {
+        SecureRandomize({r, sizeof(r)});
+        digits = kBase64;
+    }
 
-    alloc_slice docIDSlice(1+kLength);
+    alloc_slice docIDSlice(1+kDocUUIDLength);
     char *docID = (char*)docIDSlice.buf;
     docID[0] = '-';
-    for (unsigned i = 0; i < kLength; ++i)
-        docID[i+1] = kBase64[r[i] % 64];
+    for (unsigned i = 0; i < kDocUUIDLength; ++i)
+        docID[i+1] = digits[r[i] % 64];
     return docIDSlice;
 #else
     error::_throw(FDB_RESULT_CRYPTO_ERROR);
 #endif
 }
 
+void c4doc_generateTimeOrderedDocIDs(bool timeOrdered) {
+    sGenerateTimeOrderedDocIDs = timeOrdered;
+}
+
+C4SliceResult c4doc_generateID(C4Error *outError) {
+    try {
+        slice result = createDocUUID().dontFree();
+        return {result.buf, result.size};
+    } catchError(outError);
+    return {NULL, 0};
+}
+
 
 static bool sGenerateOldStyleRevIDs = false;
 
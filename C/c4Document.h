@@ -197,6 +197,21 @@ extern "C" {
                              uint64_t timestamp,
                              C4Error *outError);
 
+    /** Sets expiration dates on many documents at once, in a single transaction. This is much
+        faster than calling c4doc_setExpiration on each one.
+        @param db The database to set the expiration dates in
+        @param docIDs The IDs of the documents
+        @param timestamps The UNIX timestamps of the expiration dates, parallel to docIDs;
+                    as with c4doc_setExpiration, 0 cancels a document's expiration.
+        @param count The number of items in docIDs and timestamps
+        @param outError Information about any error that occurred
+        @return true on success, false on failure. Documents that don't exist are skipped. */
+    bool c4db_setExpirations(C4Database *db,
+                             const C4Slice docIDs[],
+                             const uint64_t timestamps[],
+                             size_t count,
+                             C4Error *outError);
+
     /** Returns the expiration time of a document, if one has been set, else 0. */
     uint64_t c4doc_getExpiration(C4Database *db, C4Slice docId);
 
@@ -243,6 +258,18 @@ extern "C" {
         are identical to the ones Couchbase Lite 1.0--1.2 would create. These use MD5 digests. */
     void c4doc_generateOldStyleRevID(bool generateOldStyle);
 
+    /** Generates a new random document ID, the same way c4doc_put does when it's not given one.
+        Caller is responsible for freeing the result's buf. */
+    C4SliceResult c4doc_generateID(C4Error *outError);
+
+    /** Set this to true to make c4doc_generateID and c4doc_put generate document IDs that start
+        with a millisecond timestamp, followed by random characters. IDs generated later sort
+        after earlier ones (within this process), so new documents are appended to the end of
+        the database's by-ID index instead of being scattered through it, which makes inserts
+        faster and the file smaller. The IDs are the same length as the default purely-random
+        ones, but have 84 bits of randomness instead of 132, and reveal their creation time. */
+    void c4doc_generateTimeOrderedDocIDs(bool timeOrdered);
+
 #ifdef __cplusplus
 }
 #endif
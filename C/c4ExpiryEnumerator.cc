@@ -13,12 +13,30 @@
 #include "KeyStore.hh"
 #include "varint.hh"
 #include "stdint.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #ifdef _MSC_VER
 #include <ctime>
 #endif
 using namespace cbforest;
 
+
+// The expiry KeyStore key just past all entries that expire at or before the given timestamp
+static alloc_slice expiryEndKey(uint64_t timestamp) {
+    CollatableBuilder c;
+    c.beginArray();
+    c << (double)timestamp;
+    c.beginMap();
+    c.endMap();
+    c.endArray();
+    return alloc_slice(c.data());
+}
+
+
 struct C4ExpiryEnumerator
 {
 public:
@@ -56,13 +74,7 @@ public:
     
     void reset()
     {
-        CollatableBuilder c;
-        c.beginArray();
-        c << (double)_endTimestamp;
-        c.beginMap();
-        c.endMap();
-        c.endArray();
-        _e = DocEnumerator(_db->getKeyStore("expiry"), slice::null, c.data());
+        _e = DocEnumerator(_db->getKeyStore("expiry"), slice::null, expiryEndKey(_endTimestamp));
         _reader = CollatableReader(slice::null);
     }
 
@@ -143,3 +155,181 @@ void c4exp_free(C4ExpiryEnumerator *e)
 {
     delete e;
 }
+
+
+#pragma mark - BACKGROUND PURGER:
+
+
+namespace c4Internal {
+
+    // How long the purger pauses between full batches, to let other writers in
+    static const auto kBatchInterval = std::chrono::milliseconds(10);
+    // How long the purger waits before retrying after an error
+    static const auto kRetryInterval = std::chrono::seconds(10);
+    // Longest the purger sleeps before re-checking the next expiration time
+    static const uint64_t kMaxSleepSecs = 60*60;
+
+
+    /** Purges expired documents on a background thread. It opens its own handle on the
+        database file, so it doesn't need the owning C4Database to be thread-safe. */
+    class ExpiryPurger {
+    public:
+        ExpiryPurger(C4Database *database, unsigned batchSize,
+                     C4OnExpiryCallback callback, void *context)
+        :_db((new c4Database(database->filename(), database->getConfig()))->retain()),
+         _batchSize(std::max(batchSize, 1u)),
+         _callback(callback),
+         _context(context)
+        {
+            _thread = std::thread([this]{run();});
+        }
+
+        ~ExpiryPurger() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _cond.notify_one();
+            _thread.join();
+            _db->release();
+        }
+
+        void wake() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _wake = true;
+            }
+            _cond.notify_one();
+        }
+
+    private:
+        void run();
+        bool purgeBatch(uint64_t now, unsigned &outCount);
+
+        C4Database* const _db;
+        const unsigned _batchSize;
+        const C4OnExpiryCallback _callback;
+        void* const _context;
+        std::thread _thread;
+        std::mutex _mutex;              // guards _stopping and _wake
+        std::condition_variable _cond;
+        bool _stopping {false};
+        bool _wake {false};
+    };
+
+
+    void ExpiryPurger::run() {
+        Log("ExpiryPurger %p: Started on %s", this, _db->filename().c_str());
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopping) {
+            _wake = false;
+            lock.unlock();
+
+            uint64_t now = time(NULL);
+            unsigned count = 0;
+            bool ok = purgeBatch(now, count);
+            if (ok && count > 0) {
+                Log("ExpiryPurger %p: Purged %u expired docs", this, count);
+                if (_callback)
+                    _callback(_context, count);
+            }
+            uint64_t next = c4db_nextDocExpiration(_db);
+
+            lock.lock();
+            if (_stopping)
+                break;
+            if (!ok) {
+                _cond.wait_for(lock, kRetryInterval, [this]{return _stopping;});
+            } else if (count >= _batchSize) {
+                // There may be more expired docs; yield before the next batch:
+                _cond.wait_for(lock, kBatchInterval, [this]{return _stopping;});
+            } else if (next == 0) {
+                _cond.wait(lock, [this]{return _stopping || _wake;});
+            } else if (next > now) {
+                auto secs = std::min(next - now, kMaxSleepSecs);
+                _cond.wait_for(lock, std::chrono::seconds(secs),
+                               [this]{return _stopping || _wake;});
+            }
+        }
+        Log("ExpiryPurger %p: Stopped", this);
+    }
+
+
+    // Purges up to _batchSize documents that expired at or before `now`, in one transaction.
+    bool ExpiryPurger::purgeBatch(uint64_t now, unsigned &outCount) {
+        outCount = 0;
+        C4Error c4err;
+        if (!c4db_beginTransaction(_db, &c4err))
+            return false;
+        bool commit = false;
+        try {
+            WITH_LOCK(_db);
+            Transaction *t = _db->transaction();
+            KeyStore& expiry = _db->getKeyStore("expiry");
+            KeyStoreWriter writer(expiry, *t);
+
+            // Collect the batch first, since its entries are about to be deleted:
+            std::vector<alloc_slice> tsKeys, docIDs;
+            auto options = DocEnumerator::Options::kDefault;
+            options.contentOptions = KeyStore::kMetaOnly;
+            DocEnumerator e(expiry, slice::null, expiryEndKey(now), options);
+            while (tsKeys.size() < _batchSize && e.next()) {
+                CollatableReader reader(e.doc().key());
+                reader.skipTag();
+                reader.readInt();
+                docIDs.push_back(reader.readString());
+                tsKeys.push_back(alloc_slice(e.doc().key()));
+            }
+            e.close();
+
+            for (size_t i = 0; i < tsKeys.size(); ++i) {
+                t->del(docIDs[i]);         // the document itself (it may already be gone)
+                writer.del(tsKeys[i]);
+                writer.del(docIDs[i]);
+            }
+            outCount = (unsigned)tsKeys.size();
+            commit = true;
+        } catchError(&c4err);
+
+        c4db_endTransaction(_db, commit, NULL);
+        if (!commit)
+            Warn("ExpiryPurger %p: Error %d/%d purging expired docs",
+                 this, c4err.domain, c4err.code);
+        return commit;
+    }
+
+
+    void wakeExpiryPurger(C4Database *database) {
+        WITH_LOCK(database);
+        if (database->_expiryPurger)
+            database->_expiryPurger->wake();
+    }
+
+}
+
+
+bool c4db_startExpiryPurger(C4Database *database,
+                            unsigned batchSize,
+                            C4OnExpiryCallback callback,
+                            void *context,
+                            C4Error *outError)
+{
+    try {
+        WITH_LOCK(database);
+        if (!database->_expiryPurger)
+            database->_expiryPurger = new ExpiryPurger(database, batchSize, callback, context);
+        return true;
+    } catchError(outError);
+    return false;
+}
+
+void c4db_stopExpiryPurger(C4Database *database)
+{
+    ExpiryPurger *purger;
+    {
+        WITH_LOCK(database);
+        purger = database->_expiryPurger;
+        database->_expiryPurger = NULL;
+    }
+    delete purger;  // waits for its thread to exit
+}
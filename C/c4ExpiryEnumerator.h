@@ -47,6 +47,37 @@ extern "C" {
     /** Frees a C4DocEnumerator handle */
     void c4exp_free(C4ExpiryEnumerator *e);
 
+
+    /** Callback invoked by the background expiry purger after each batch it purges.
+        It's called on the purger's own thread. */
+    typedef void (*C4OnExpiryCallback)(void *context, unsigned purgedCount);
+
+    /** Starts a background thread that purges documents as they expire, along with their
+        expiration entries, so the app doesn't have to poll c4db_nextDocExpiration.
+        Views aren't touched, since they live in other files. As with c4db_purgeDoc, a purge
+        is a ForestDB deletion with its own sequence, so the indexer removes the purged docs'
+        rows the next time the view is updated; if the database is compacted first, the
+        deletions are gone but its purge count changes, and the view is rebuilt instead.
+        The purger sleeps until the next expiration time, then purges the expired documents in
+        transactions of at most batchSize docs, pausing briefly between batches so other writers
+        aren't held up. It uses its own database handle. Does nothing if it's already running.
+        @param database  The database.
+        @param batchSize  Maximum number of documents to purge per transaction.
+        @param callback  Called after each batch is committed; may be NULL.
+        @param context  Value passed to the callback.
+        @param outError  Error will be stored here on failure.
+        @return  True on success, false on failure. */
+    bool c4db_startExpiryPurger(C4Database *database,
+                                unsigned batchSize,
+                                C4OnExpiryCallback callback,
+                                void *context,
+                                C4Error *outError);
+
+    /** Stops the background expiry purger, if it's running, after its current batch.
+        This is called automatically when the database is closed, freed or deleted.
+        Must not be called while in a transaction. */
+    void c4db_stopExpiryPurger(C4Database *database);
+
         
 #ifdef __cplusplus
     }
@@ -73,9 +73,14 @@ namespace c4Internal {
         }
 
     Database::config c4DbConfig(C4DatabaseFlags flags, const C4EncryptionKey *key);
+    void setSyncInterval(Database*, C4DatabaseFlags flags);
 
     bool rekey(Database* database, const C4EncryptionKey *newKey, C4Error *outError);
 
+    void exportStats(const DatabaseStats&, C4DatabaseStats *outStats);
+
+    void getCompactionStatus(Database*, C4CompactionStatus *outStatus);
+
     C4Document* newC4Document(C4Database*, Document&&);
 
     const VersionedDocument& versionedDocument(C4Document*);
@@ -86,6 +91,12 @@ namespace c4Internal {
 
     void setEnumFilter(C4DocEnumerator*, EnumFilter);
 
+    class ExpiryPurger;
+
+    /** Tells the database's background expiry purger, if any, that an expiration has been
+        set, so it can recompute when to wake up. */
+    void wakeExpiryPurger(C4Database*);
+
 
     /** Base class that keeps track of the total instance count of all subclasses,
         which is returned by c4_getObjectCount(). */
@@ -172,13 +183,21 @@ struct c4Database : public Database, RefCounted<c4Database> {
     bool mustNotBeInTransaction(C4Error *outError);
     bool endTransaction(bool commit);
 
+    // Removes the file from the CompactionScheduler; call before closing or deleting it.
+    void unregisterForCompaction();
+
+    ExpiryPurger* _expiryPurger {NULL};     // Background purger, if started (c4ExpiryEnumerator.cc)
+
 #if C4DB_THREADSAFE
     // Mutex for synchronizing Database calls. Non-recursive!
     std::mutex _mutex;
 #endif
 
 private:
-    virtual ~c4Database() { CBFAssert(_transactionLevel == 0); }
+    virtual ~c4Database() {
+        CBFAssert(_transactionLevel == 0);
+        unregisterForCompaction();
+    }
 #if C4DB_THREADSAFE
     // Recursive mutex for accessing _transaction and _transactionLevel.
     // Must be acquired BEFORE _mutex, or deadlock may occur!
@@ -186,6 +205,7 @@ private:
 #endif
     Transaction* _transaction {NULL};
     int _transactionLevel {0};
+    bool _registeredForCompaction {false};
 };
 
 
@@ -20,6 +20,11 @@ C4Document* c4doc_getForPut(C4Database *database,
                             bool deleting,
                             bool allowConflict,
                             C4Error *outError);
+
+/** Performs the pending background syncs of databases opened with kC4DB_SyncPeriodically, and
+    stops the thread that performs them, until another sync is scheduled. Call before fork(),
+    so the child doesn't inherit locks held by that thread. */
+void c4_stopFileSyncer(void);
     
 #ifdef __cplusplus
 }
@@ -18,13 +18,18 @@
 #include "c4Document.h"
 #include "c4DocEnumerator.h"
 #include "Collatable.hh"
+#include "CompactionScheduler.hh"
 #include "MapReduceIndex.hh"
+#include "QueryCache.hh"
+#include "LiveQuery.hh"
 #include "FullTextIndex.hh"
 #include "GeoIndex.hh"
 #include "VersionedDocument.hh"
 #include "Tokenizer.hh"
 #include <math.h>
 #include <limits.h>
+#include <atomic>
+#include <memory>
 using namespace cbforest;
 
 
@@ -47,12 +52,21 @@ struct c4View : public c4Internal::RefCounted<c4View> {
            C4Slice path,
            C4Slice name,
            const Database::config &config,
-           C4Slice version)
+           C4Slice version,
+           bool sharedFile)
     :_sourceDB(sourceDB),
      _viewDB((std::string)path, config),
-     _index(&_viewDB, (std::string)name, sourceDB)
+     _index(&_viewDB, (std::string)name, sourceDB),
+     _queryCache(_index),
+     _sharedFile(sharedFile)
     {
         setVersion(version);
+        CompactionScheduler::shared().addFile(_viewDB.filename(), config);
+        _registeredForCompaction = true;
+    }
+
+    ~c4View() {
+        unregisterForCompaction();
     }
 
     void setVersion(C4Slice version) {
@@ -69,11 +83,35 @@ struct c4View : public c4Internal::RefCounted<c4View> {
 
     void close() {
         _viewDB.close();
+        unregisterForCompaction();
+    }
+
+    // Deletes the index: the whole file, or just the view's KeyStore if the file is shared.
+    void deleteIndex() {
+        unregisterForCompaction();
+        if (_sharedFile) {
+            Transaction t(&_viewDB);
+            _index.storeIn(t).deleteKeyStore(t);
+            t.commit();
+        } else {
+            _viewDB.deleteDatabase();
+        }
+    }
+
+    // Removes the file from the CompactionScheduler; must be called before deleting it.
+    void unregisterForCompaction() {
+        if (_registeredForCompaction) {
+            _registeredForCompaction = false;
+            CompactionScheduler::shared().removeFile(_viewDB.filename());
+        }
     }
 
     Retained<C4Database> _sourceDB;
     Database _viewDB;
     MapReduceIndex _index;
+    QueryCache _queryCache;
+    const bool _sharedFile;
+    bool _registeredForCompaction {false};
 #if C4DB_THREADSAFE
     std::mutex _mutex;
 #endif
@@ -93,9 +131,11 @@ C4View* c4view_open(C4Database* db,
         config.wal_threshold = kViewDBWALThreshold;
         config.seqtree_opt = FDB_SEQTREE_NOT_USE; // indexes don't need by-sequence ordering
         config.purging_interval = 0;              // nor have any use for keeping deleted docs
+        bool sharedFile = (flags & kC4DB_SharedIndexFile) != 0;
 
+        C4View *view;
         try {
-            return (new c4View(db, path, viewName, config, version))->retain();
+            view = (new c4View(db, path, viewName, config, version, sharedFile))->retain();
         } catch (cbforest::error error) {
             if (error.status == FDB_RESULT_INVALID_COMPACTION_MODE
                     && config.compaction_mode == FDB_COMPACTION_AUTO) {
@@ -113,11 +153,13 @@ C4View* c4view_open(C4Database* db,
                     viewdb.close();
                     config.compaction_mode = FDB_COMPACTION_AUTO;
                 }
-                return (new c4View(db, path, viewName, config, version))->retain();
+                view = (new c4View(db, path, viewName, config, version, sharedFile))->retain();
             } else {
                 throw error;
             }
         }
+        setSyncInterval(&view->_viewDB, flags);
+        return view;
     } catchError(outError);
     return NULL;
 }
@@ -171,7 +213,7 @@ bool c4view_delete(C4View *view, C4Error *outError) {
         WITH_LOCK(view);
         if (!view->checkNotBusy(outError))
             return false;
-        view->_viewDB.deleteDatabase();
+        view->deleteIndex();
         view->close();
         return true;
     } catchError(outError)
@@ -222,11 +264,31 @@ void c4view_setDocumentType(C4View *view, C4Slice docType) {
 }
 
 
+bool c4view_setGeoIndexType(C4View *view, C4GeoIndexType type, C4Error *outError) {
+    try {
+        WITH_LOCK(view);
+        view->_index.setGeoKeyScheme(type == kC4HilbertIndex ? MapReduceIndex::kHilbertKeys
+                                                             : MapReduceIndex::kGeohashKeys);
+        return true;
+    } catchError(outError);
+    return false;
+}
+
+
+void c4view_getStats(C4View *view, C4DatabaseStats *outStats) {
+    exportStats(view->_viewDB.stats(), outStats);
+}
+
+
 void c4view_setOnCompactCallback(C4View *view, C4OnCompactCallback cb, void *context) {
     WITH_LOCK(view);
     view->_viewDB.setOnCompact(cb, context);
 }
 
+void c4view_getCompactionStatus(C4View *view, C4CompactionStatus *outStatus) {
+    getCompactionStatus(&view->_viewDB, outStatus);
+}
+
 
 #pragma mark - INDEXING:
 
@@ -445,12 +507,41 @@ struct C4QueryEnumInternal : public C4QueryEnumerator, c4Internal::InstanceCount
 
     virtual void close() { }
 
+    virtual const QueryProfile& profile() const =0;
+
+    virtual alloc_slice resumeToken() const {return alloc_slice();}
+
+    // Called at the end of enumeration, or on close; logs the profile if the query was slow.
+    void finished() {
+        if (_finished)
+            return;
+        _finished = true;
+        uint64_t threshold = sSlowQueryThreshold.load(std::memory_order_relaxed);
+        const QueryProfile &p = profile();
+        if (threshold > 0 && p.elapsedNanos >= threshold) {
+            Warn("Slow query on view '%s': %.3f ms; %llu rows scanned, %llu returned, "
+                 "%llu skipped, %llu rejected, %llu out of range; %llu seeks, %llu key ranges, "
+                 "%llu bytes read",
+                 _view->_index.name().c_str(), p.elapsedNanos / 1.0e6,
+                 (unsigned long long)p.rowsScanned, (unsigned long long)p.rowsReturned,
+                 (unsigned long long)p.rowsSkipped, (unsigned long long)p.rowsRejected,
+                 (unsigned long long)p.rowsOutOfRange, (unsigned long long)p.seeks,
+                 (unsigned long long)p.keyRanges, (unsigned long long)p.bytesRead);
+        }
+    }
+
+    static std::atomic<uint64_t> sSlowQueryThreshold;
+
     Retained<C4View> _view;
 #if C4DB_THREADSAFE
     std::mutex &_mutex;
 #endif
+private:
+    bool _finished {false};
 };
 
+std::atomic<uint64_t> C4QueryEnumInternal::sSlowQueryThreshold {0};
+
 static C4QueryEnumInternal* asInternal(C4QueryEnumerator *e) {return (C4QueryEnumInternal*)e;}
 
 
@@ -461,6 +552,7 @@ bool c4queryenum_next(C4QueryEnumerator *e,
         WITH_LOCK(asInternal(e));
         if (asInternal(e)->next())
             return true;
+        asInternal(e)->finished();
         clearError(outError);      // end of iteration is not an error
     } catchError(outError);
     return false;
@@ -472,10 +564,56 @@ void c4queryenum_close(C4QueryEnumerator *e) {
         try {
             WITH_LOCK(asInternal(e));
             asInternal(e)->close();
+            asInternal(e)->finished();
         } catchError(NULL);
     }
 }
 
+
+static void exportProfile(const QueryProfile &p, C4QueryProfile *outProfile) {
+    outProfile->rowsScanned = p.rowsScanned;
+    outProfile->rowsReturned = p.rowsReturned;
+    outProfile->rowsSkipped = p.rowsSkipped;
+    outProfile->rowsRejected = p.rowsRejected;
+    outProfile->rowsOutOfRange = p.rowsOutOfRange;
+    outProfile->seeks = p.seeks;
+    outProfile->keyRanges = p.keyRanges;
+    outProfile->bytesRead = p.bytesRead;
+    outProfile->elapsedNanos = p.elapsedNanos;
+}
+
+bool c4queryenum_getProfile(C4QueryEnumerator *e, C4QueryProfile *outProfile) {
+    try {
+        WITH_LOCK(asInternal(e));
+        exportProfile(asInternal(e)->profile(), outProfile);
+        return true;
+    } catchError(NULL);
+    return false;
+}
+
+
+C4SliceResult c4queryenum_getResumeToken(C4QueryEnumerator *e) {
+    try {
+        WITH_LOCK(asInternal(e));
+        slice token = slice(asInternal(e)->resumeToken()).copy();
+        return {token.buf, token.size};
+    } catchError(NULL);
+    return {NULL, 0};
+}
+
+
+void c4view_setQueryCacheCapacity(C4View *view, size_t bytes) {
+    try {
+        WITH_LOCK(view);
+        view->_queryCache.setCapacity(bytes);
+    } catchError(NULL);
+}
+
+
+void c4view_setSlowQueryThreshold(uint64_t nanos) {
+    C4QueryEnumInternal::sSlowQueryThreshold.store(nanos, std::memory_order_relaxed);
+}
+
 void c4queryenum_free(C4QueryEnumerator *e) {
     try {
         c4queryenum_close(e);
@@ -504,21 +642,109 @@ struct C4MapReduceEnumerator : public C4QueryEnumInternal {
     { }
 
     virtual bool next() {
-        if (!_enum.next())
+        if (!_enum.next()) {
+            if (_caching) {
+                _view->_queryCache.put(_cacheKey, std::move(_rows), _cacheGeneration);
+                _caching = false;
+            }
             return C4QueryEnumInternal::next();
+        }
         key = asKeyReader(_enum.key());
         value = _enum.value();
         docID = _enum.docID();
         docSequence = _enum.sequence();
+        if (_caching)
+            cacheRow();
         return true;
     }
 
     virtual void close() {
         _enum.close();
+        _caching = false;
+        _rows.clear();
+    }
+
+    virtual const QueryProfile& profile() const {
+        return _enum.profile();
+    }
+
+    virtual alloc_slice resumeToken() const {
+        return _enum.resumeToken();
+    }
+
+    void resumeAfter(slice token) {
+        _enum.resumeAfter(token);
+    }
+
+    // Saves the rows as they're returned, to add them to the view's query cache at the end.
+    void cacheAs(const std::string &cacheKey) {
+        _cacheKey = cacheKey;
+        _cacheGeneration = _view->_queryCache.generation();
+        _caching = true;
     }
 
 private:
+    void cacheRow() {
+        IndexRow row {_enum.resumeToken(), alloc_slice(_enum.value()), _enum.sequence()};
+        _cacheSize += QueryCache::cost(row);
+        if (_cacheSize > _view->_queryCache.capacity()) {
+            _caching = false;           // too big to cache
+            _rows.clear();
+            return;
+        }
+        _rows.push_back(std::move(row));
+    }
+
     IndexEnumerator _enum;
+    bool _caching {false};
+    std::string _cacheKey;
+    uint64_t _cacheGeneration {0};
+    QueryCache::Rows _rows;
+    size_t _cacheSize {0};
+};
+
+
+// Returns rows from the view's query cache.
+struct C4CachedQueryEnumerator : public C4QueryEnumInternal {
+    C4CachedQueryEnumerator(C4View *view, QueryCache::RowsRef rows)
+    :C4QueryEnumInternal(view),
+     _rows(rows)
+    { }
+
+    virtual bool next() {
+        QueryProfile::Timer timer(_profile);
+        if (_closed || _next >= _rows->size())
+            return C4QueryEnumInternal::next();
+        const IndexRow &row = (*_rows)[_next++];
+        CollatableReader reader(row.rowKey);
+        reader.beginArray();
+        key = asKeyReader(CollatableReader(reader.read()));
+        _docID = reader.readString();
+        docID = _docID;
+        value = row.value;
+        docSequence = row.sequence;
+        ++_profile.rowsReturned;
+        return true;
+    }
+
+    virtual void close() {
+        _closed = true;
+    }
+
+    virtual const QueryProfile& profile() const {
+        return _profile;
+    }
+
+    virtual alloc_slice resumeToken() const {
+        return _next > 0 ? (*_rows)[_next - 1].rowKey : alloc_slice();
+    }
+
+private:
+    QueryCache::RowsRef _rows;
+    size_t _next {0};
+    bool _closed {false};
+    alloc_slice _docID;
+    QueryProfile _profile;
 };
 
 
@@ -531,17 +757,28 @@ C4QueryEnumerator* c4view_query(C4View *view,
         if (!c4options)
             c4options = &kC4DefaultQueryOptions;
         DocEnumerator::Options options = convertOptions(c4options);
+        if (c4options->keysOnly)
+            options.contentOptions = KeyStore::kMetaOnly;
 
+        QueryCache &cache = view->_queryCache;
+        std::string cacheKey;
+        std::unique_ptr<C4MapReduceEnumerator> e;
         if (c4options->keysCount == 0 && c4options->keys == NULL) {
             Collatable noKey;
-            return new C4MapReduceEnumerator(view,
-                                           (c4options->startKey ? (Collatable)*c4options->startKey
-                                                                : noKey),
-                                           c4options->startKeyDocID,
-                                           (c4options->endKey ? (Collatable)*c4options->endKey
-                                                              : noKey),
-                                           c4options->endKeyDocID,
-                                           options);
+            Collatable startKey = c4options->startKey ? (Collatable)*c4options->startKey : noKey;
+            Collatable endKey = c4options->endKey ? (Collatable)*c4options->endKey : noKey;
+            if (cache.enabled()) {
+                cacheKey = QueryCache::keyFor(startKey, c4options->startKeyDocID,
+                                              endKey, c4options->endKeyDocID,
+                                              options, c4options->resumeAfter);
+                auto rows = cache.get(cacheKey);
+                if (rows)
+                    return new C4CachedQueryEnumerator(view, rows);
+            }
+            e.reset(new C4MapReduceEnumerator(view,
+                                              startKey, c4options->startKeyDocID,
+                                              endKey, c4options->endKeyDocID,
+                                              options));
         } else {
             std::vector<KeyRange> keyRanges;
             for (size_t i = 0; i < c4options->keysCount; i++) {
@@ -549,13 +786,176 @@ C4QueryEnumerator* c4view_query(C4View *view,
                 if (key)
                     keyRanges.push_back(KeyRange(*key));
             }
-            return new C4MapReduceEnumerator(view, keyRanges, options);
+            if (cache.enabled()) {
+                cacheKey = QueryCache::keyFor(keyRanges, options, c4options->resumeAfter);
+                auto rows = cache.get(cacheKey);
+                if (rows)
+                    return new C4CachedQueryEnumerator(view, rows);
+            }
+            e.reset(new C4MapReduceEnumerator(view, keyRanges, options));
         }
+        if (c4options->resumeAfter.buf)
+            e->resumeAfter(c4options->resumeAfter);
+        if (!cacheKey.empty())
+            e->cacheAs(cacheKey);
+        return e.release();
     } catchError(outError);
     return NULL;
 }
 
 
+bool c4view_parallelQuery(C4View *view,
+                          const C4QueryOptions *c4options,
+                          unsigned threads,
+                          bool ordered,
+                          C4QueryRowCallback callback,
+                          void *context,
+                          C4QueryProfile *outProfile,
+                          C4Error *outError)
+{
+    try {
+        WITH_LOCK(view);
+        if (!c4options)
+            c4options = &kC4DefaultQueryOptions;
+        if (c4options->skip > 0 || c4options->descending || c4options->keys
+                                || c4options->resumeAfter.buf) {
+            recordHTTPError(kC4HTTPBadRequest, outError);
+            return false;
+        }
+        DocEnumerator::Options options = convertOptions(c4options);
+        if (c4options->keysOnly)
+            options.contentOptions = KeyStore::kMetaOnly;
+
+        Collatable noKey;
+        ParallelIndexScan scan(&view->_index,
+                               (c4options->startKey ? (Collatable)*c4options->startKey : noKey),
+                               c4options->startKeyDocID,
+                               (c4options->endKey ? (Collatable)*c4options->endKey : noKey),
+                               c4options->endKeyDocID,
+                               options);
+        scan.run(threads, ordered, [=](slice key, slice docID, slice value, sequence seq) {
+            C4QueryEnumerator row = {};
+            row.key = asKeyReader(CollatableReader(key));
+            row.value = value;
+            row.docID = docID;
+            row.docSequence = seq;
+            callback(context, &row);
+        });
+        if (outProfile)
+            exportProfile(scan.profile(), outProfile);
+        return true;
+    } catchError(outError);
+    return false;
+}
+
+
+#pragma mark LIVE QUERIES:
+
+
+struct c4LiveQuery : c4Internal::InstanceCounted {
+    c4LiveQuery(C4View *view, C4LiveQueryCallback callback, void *context)
+    :_view(view),
+     _callback(callback),
+     _context(context)
+    { }
+
+    // The callback for the LiveQuery, which calls the client's.
+    LiveQuery::Callback notifier() {
+        if (!_callback)
+            return nullptr;
+        return [this]() {_callback(_context, this);};
+    }
+
+    Retained<C4View> _view;
+    std::unique_ptr<LiveQuery> _query;
+private:
+    C4LiveQueryCallback const _callback;
+    void* const _context;
+};
+
+
+C4LiveQuery* c4view_liveQuery(C4View *view,
+                              const C4QueryOptions *c4options,
+                              C4LiveQueryCallback callback,
+                              void *context,
+                              C4Error *outError)
+{
+    try {
+        WITH_LOCK(view);
+        if (!c4options)
+            c4options = &kC4DefaultQueryOptions;
+        if (c4options->skip > 0 || c4options->limit < UINT_MAX || c4options->resumeAfter.buf) {
+            recordHTTPError(kC4HTTPBadRequest, outError);
+            return NULL;
+        }
+        DocEnumerator::Options options = convertOptions(c4options);
+        if (c4options->keysOnly)
+            options.contentOptions = KeyStore::kMetaOnly;
+
+        std::unique_ptr<c4LiveQuery> query(new c4LiveQuery(view, callback, context));
+        if (c4options->keysCount == 0 && c4options->keys == NULL) {
+            Collatable noKey;
+            Collatable startKey = c4options->startKey ? (Collatable)*c4options->startKey : noKey;
+            Collatable endKey = c4options->endKey ? (Collatable)*c4options->endKey : noKey;
+            query->_query.reset(new LiveQuery(&view->_index,
+                                              startKey, c4options->startKeyDocID,
+                                              endKey, c4options->endKeyDocID,
+                                              options, query->notifier()));
+        } else {
+            std::vector<KeyRange> keyRanges;
+            for (size_t i = 0; i < c4options->keysCount; i++) {
+                const C4Key* key = c4options->keys[i];
+                if (key)
+                    keyRanges.push_back(KeyRange(*key));
+            }
+            query->_query.reset(new LiveQuery(&view->_index, keyRanges, options,
+                                              query->notifier()));
+        }
+        return query.release();
+    } catchError(outError);
+    return NULL;
+}
+
+
+bool c4livequery_getChanges(C4LiveQuery *query,
+                            C4RowChangeCallback callback,
+                            void *context,
+                            bool *outReset,
+                            C4Error *outError)
+{
+    try {
+        bool reset;
+        auto changes = query->_query->changes(reset);
+        if (outReset)
+            *outReset = reset;
+        for (auto &change : changes) {
+            CollatableReader reader(change.row.rowKey);
+            reader.beginArray();
+            C4QueryEnumerator row = {};
+            row.key = asKeyReader(CollatableReader(reader.read()));
+            alloc_slice docID = reader.readString();
+            row.docID = docID;
+            row.value = change.row.value;
+            row.docSequence = change.row.sequence;
+            callback(context, (C4RowChangeType)change.type, &row);
+        }
+        return true;
+    } catchError(outError);
+    return false;
+}
+
+
+void c4livequery_free(C4LiveQuery *query) {
+    if (query) {
+        try {
+            Retained<C4View> view((C4View*)query->_view);   // keeps the view's mutex alive
+            WITH_LOCK(view);
+            delete query;
+        } catchError(NULL);
+    }
+}
+
+
 #pragma mark FULL-TEXT QUERIES:
 
 
@@ -591,6 +991,10 @@ struct C4FullTextEnumerator : public C4QueryEnumInternal {
         _enum.close();
     }
 
+    virtual const QueryProfile& profile() const {
+        return _enum.profile();
+    }
+
 private:
     FullTextIndexEnumerator _enum;
     alloc_slice _allocatedValue;
@@ -675,6 +1079,10 @@ struct C4GeoEnumerator : public C4QueryEnumInternal {
         _enum.close();
     }
 
+    virtual const QueryProfile& profile() const {
+        return _enum.profile();
+    }
+
 private:
     GeoIndexEnumerator _enum;
 };
@@ -692,3 +1100,52 @@ C4QueryEnumerator* c4view_geoQuery(C4View *view,
     } catchError(outError);
     return NULL;
 }
+
+
+struct C4GeoNearestEnumerator : public C4QueryEnumInternal {
+    C4GeoNearestEnumerator(C4View *view, const geohash::coord &center, unsigned maxResults)
+    :C4QueryEnumInternal(view),
+     _enum(&view->_index, center, maxResults)
+    { }
+
+    virtual bool next() {
+        if (!_enum.next())
+            return C4QueryEnumInternal::next();
+        docID = _enum.docID();
+        docSequence = _enum.sequence();
+        value = _enum.value();
+        auto bbox = _enum.keyBoundingBox();
+        geoBBox.xmin = bbox.min().longitude;
+        geoBBox.ymin = bbox.min().latitude;
+        geoBBox.xmax = bbox.max().longitude;
+        geoBBox.ymax = bbox.max().latitude;
+        geoJSON = _enum.keyGeoJSON();
+        geoDistance = _enum.distance();
+        return true;
+    }
+
+    virtual void close() {
+        _enum.close();
+    }
+
+    virtual const QueryProfile& profile() const {
+        return _enum.profile();
+    }
+
+private:
+    GeoNearestEnumerator _enum;
+};
+
+
+C4QueryEnumerator* c4view_geoNearestQuery(C4View *view,
+                                          double latitude,
+                                          double longitude,
+                                          unsigned maxResults,
+                                          C4Error *outError)
+{
+    try {
+        WITH_LOCK(view);
+        return new C4GeoNearestEnumerator(view, geohash::coord(latitude, longitude), maxResults);
+    } catchError(outError);
+    return NULL;
+}
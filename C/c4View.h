@@ -27,6 +27,13 @@ extern "C" {
     typedef struct c4View C4View;
 
     /** Opens a view, or creates it if the file doesn't already exist.
+
+        Several views can share one index file, by opening them with the same path and the
+        kC4DB_SharedIndexFile flag (and the same flags and encryption key.) Each view's index is
+        then a separate key-value store in the file, named after the view. This saves file
+        descriptors, and an indexer updating several views of the file commits to it once.
+        Rekeying or compacting any of the views applies to the whole file, and
+        c4view_getStats reports the file's stats.
         @param database  The database the view is associated with.
         @param path  The filesystem path to the view index file.
         @param viewName  The name of the view.
@@ -55,7 +62,8 @@ extern "C" {
     /** Erases the view index, but doesn't delete the database file. */
     bool c4view_eraseIndex(C4View*, C4Error *outError);
 
-    /** Deletes the view's file(s) and closes/frees the C4View. */
+    /** Deletes the view's file(s) and closes/frees the C4View. If the view was opened with
+        kC4DB_SharedIndexFile, only its index is deleted, not the file. */
     bool c4view_delete(C4View*, C4Error *outError);
 
     /** Deletes the file(s) for the view at the given path.
@@ -81,11 +89,31 @@ extern "C" {
         documentType matches will be indexed by this view. */
     void c4view_setDocumentType(C4View*, C4Slice docType);
 
+    /** The ways a view can store geo-JSON keys in its index. */
+    typedef C4_ENUM(uint32_t, C4GeoIndexType) {
+        kC4GeohashIndex,        ///< Geohash strings (the default)
+        kC4HilbertIndex,        ///< Quadtree cells ordered along a Hilbert curve
+    };
+
+    /** Sets how the view indexes geo-JSON keys. The Hilbert scheme keeps nearby cells closer
+        together in the index, so geo queries usually scan fewer rows, especially for wide or
+        tall query areas. If the new value is different from the one previously stored, the
+        index is invalidated. If this isn't called, the view uses the type its index was built
+        with (geohash for a new index.) */
+    bool c4view_setGeoIndexType(C4View*, C4GeoIndexType, C4Error *outError);
+
+    /** Copies the activity counters of the view's index file into *outStats.
+        (Index rows added and removed are counted here, not in the source database's stats.) */
+    void c4view_getStats(C4View*, C4DatabaseStats *outStats);
+
     /** Registers a callback to be invoked when the view's index db starts or finishes compacting.
         The callback is likely to be called on a background thread owned by ForestDB, so be
         careful of thread safety. */
     void c4view_setOnCompactCallback(C4View*, C4OnCompactCallback, void *context);
 
+    /** Gets the status of the view index's compaction by the compaction scheduler. */
+    void c4view_getCompactionStatus(C4View*, C4CompactionStatus *outStatus);
+
 
     //////// INDEXING:
 
@@ -191,6 +219,9 @@ extern "C" {
         
         const C4Key **keys;
         size_t keysCount;
+
+        C4Slice resumeAfter;        ///< Token from c4queryenum_getResumeToken; starts after that row
+        bool keysOnly;              ///< Map/reduce only: don't read values (`value` will be null)
     } C4QueryOptions;
 
     /** Default query options. */
@@ -211,7 +242,7 @@ extern "C" {
         // All query types:
         C4Slice docID;                              ///< ID of doc that emitted this row
         C4SequenceNumber docSequence;               ///< Sequence number of doc that emitted row
-        C4Slice value;                              ///< Encoded emitted value
+        C4Slice value;                              ///< Encoded emitted value (null if keysOnly)
 
         // Map/reduce only:
         C4KeyReader key;                            ///< Encoded emitted key
@@ -224,6 +255,7 @@ extern "C" {
         // Geo-query only:
         C4GeoArea geoBBox;                          ///< Bounding box of emitted geoJSON shape
         C4Slice geoJSON;                            ///< GeoJSON description of the shape
+        double geoDistance;                         ///< Distance (km) to shape, in nearest query
     } C4QueryEnumerator;
 
 
@@ -262,6 +294,21 @@ extern "C" {
                                        C4GeoArea area,
                                        C4Error *outError);
 
+    /** Runs a nearest-neighbor geo-query and returns an enumerator for the results, which will
+        be in order of increasing distance from the given point. The distance to each row's
+        bounding box, in kilometers, is stored in the enumerator's geoDistance field.
+        @param view  The view to query.
+        @param latitude  The latitude of the point to search around.
+        @param longitude  The longitude of the point to search around.
+        @param maxResults  The maximum number of rows to return.
+        @param outError  On failure, error info will be stored here.
+        @return  A new query enumerator. Fields are invalid until c4queryenum_next is called. */
+    C4QueryEnumerator* c4view_geoNearestQuery(C4View *view,
+                                              double latitude,
+                                              double longitude,
+                                              unsigned maxResults,
+                                              C4Error *outError);
+
     /** In a full-text query enumerator, returns the string that was emitted during indexing that
         contained the search term(s). */
     C4SliceResult c4queryenum_fullTextMatched(C4QueryEnumerator *e);
@@ -286,6 +333,154 @@ extern "C" {
     /** Frees a query enumerator. */
     void c4queryenum_free(C4QueryEnumerator *e);
 
+    /** Returns an opaque token identifying the last row returned by a map/reduce query
+        enumerator, or a null slice if there isn't one (or it's another type of query.)
+        To get the next page of results, run the query again with the same options except
+        for `resumeAfter`, set to this token. Unlike `skip`, this doesn't have to read the rows
+        of the previous pages, so every page is equally fast; and rows added or removed before
+        the token don't shift the following pages.
+        The token remains valid after c4queryenum_next returns false. The caller must free it. */
+    C4SliceResult c4queryenum_getResumeToken(C4QueryEnumerator *e);
+
+    /** Enables caching the results of the view's map/reduce queries in memory, using up to
+        `bytes` bytes; 0 (the default) disables the cache and frees it. Repeating a query, with
+        the same options, on an unchanged index then returns the rows from memory instead of
+        reading the index. The cache is emptied whenever the index changes (as indicated by
+        c4view_getLastSequenceChangedAt), and the least recently used results are evicted to
+        stay within the size. Results are only cached if the query is enumerated to the end. */
+    void c4view_setQueryCacheCapacity(C4View *view, size_t bytes);
+
+
+    //////// PROFILING:
+
+    /** Counts of the work a query has done, for finding out why it's slow. */
+    typedef struct {
+        uint64_t rowsScanned;       ///< Index rows read
+        uint64_t rowsReturned;      ///< Rows returned by c4queryenum_next
+        uint64_t rowsSkipped;       ///< Rows passed over because of the `skip` option
+        uint64_t rowsRejected;      ///< Rows filtered out, e.g. outside a geo area or not matching every full-text term
+        uint64_t rowsOutOfRange;    ///< Rows read past the end of a key range
+        uint64_t seeks;             ///< Times the index iterator was repositioned
+        uint64_t keyRanges;         ///< Key ranges visited
+        uint64_t bytesRead;         ///< Bytes of index keys, metadata and values read
+        uint64_t elapsedNanos;      ///< Time spent in the query, not counting the caller's
+    } C4QueryProfile;
+
+    /** Copies a query enumerator's profile so far into `outProfile`. Can be called at any time
+        before the enumerator is freed, including after it's reached the end. */
+    bool c4queryenum_getProfile(C4QueryEnumerator *e,
+                                C4QueryProfile *outProfile);
+
+    /** Queries that take longer than this (in total, when they finish or are closed) log a
+        warning with their profile. Applies to all views in the process. 0 (the default)
+        disables it. */
+    void c4view_setSlowQueryThreshold(uint64_t nanos);
+
+
+    //////// PARALLEL QUERIES:
+
+    /** Callback for c4view_parallelQuery. The row's map/reduce fields are filled in as by
+        c4queryenum_next; it and the memory it points to are only valid during the call. */
+    typedef void (*C4QueryRowCallback)(void *context, const C4QueryEnumerator *row);
+
+    /** Runs a map/reduce query over one key range on several threads at once, so that big
+        scans take less time on multi-core devices. The range is split into partitions, which
+        are scanned by the threads through their own handles on the view's database file, so
+        index changes that haven't been committed aren't seen.
+        The callback must not call any function on the view, which is locked during the query.
+        @param view  The view to query.
+        @param options  Query options, or NULL for the default options. skip, descending, keys
+                    and resumeAfter aren't supported.
+        @param threads  The number of threads to scan with, or 0 for one per CPU core.
+        @param ordered  If true, rows are passed to the callback on the calling thread in key
+                    order; partitions that finish ahead of their turn are buffered in memory.
+                    If false, the callback is called on the scanning threads as rows are read,
+                    concurrently and in no particular order, so it must be thread-safe.
+        @param callback  Called for each row.
+        @param context  Passed to the callback.
+        @param outProfile  If non-NULL, the work done by the query is stored here.
+        @param outError  On failure, error info will be stored here.
+        @return  True on success, false on failure. */
+    bool c4view_parallelQuery(C4View *view,
+                              const C4QueryOptions *options,
+                              unsigned threads,
+                              bool ordered,
+                              C4QueryRowCallback callback,
+                              void *context,
+                              C4QueryProfile *outProfile,
+                              C4Error *outError);
+
+
+    //////// LIVE QUERIES:
+
+    /** Opaque handle to a live query, which follows the changes to a map/reduce query's rows as
+        the view is indexed. */
+    typedef struct c4LiveQuery C4LiveQuery;
+
+    /** The ways a row of a live query can change. */
+    typedef C4_ENUM(uint32_t, C4RowChangeType) {
+        kC4RowAdded,            ///< A row was added to the query's range
+        kC4RowRemoved,          ///< A row was removed; its value is null
+        kC4RowChanged,          ///< A row was rewritten; its value and/or docSequence changed
+    };
+
+    /** Called when a live query has changes to get, after c4livequery_getChanges was last
+        called (or the live query was created.) It's called on the thread that calls
+        c4indexer_end (or that calls a function on the view that finds the index was changed
+        through another handle), while the view is locked, so it may call
+        c4livequery_getChanges but not any function on the view; usually it just schedules a
+        call to c4livequery_getChanges. */
+    typedef void (*C4LiveQueryCallback)(void *context, C4LiveQuery *query);
+
+    /** Callback for c4livequery_getChanges. The row's map/reduce fields are filled in as by
+        c4queryenum_next; it and the memory it points to are only valid during the call. */
+    typedef void (*C4RowChangeCallback)(void *context,
+                                        C4RowChangeType change,
+                                        const C4QueryEnumerator *row);
+
+    /** Starts following the changes to the rows of a map/reduce query. Whenever an indexer
+        commits, the rows it added, removed or rewrote within the query's key range (or keys)
+        are saved for c4livequery_getChanges, without the query being run again. Run the query
+        itself to get the initial rows.
+        Only indexers using this C4View handle report their row changes. If the index is
+        updated or erased through another handle on the same view, this one can't tell which
+        rows changed; the next time it reads the index's state (when it's queried or indexed)
+        the live query is reset instead, and has to be run again.
+        @param view  The view to query.
+        @param options  Query options, or NULL for the default options. skip, limit and
+                    resumeAfter aren't supported, since they'd make the results depend on rows
+                    that didn't change.
+        @param callback  Called when there are changes to get; may be NULL.
+        @param context  Passed to the callback.
+        @param outError  On failure, error info will be stored here.
+        @return  A new live query, to be freed with c4livequery_free. */
+    C4LiveQuery* c4view_liveQuery(C4View *view,
+                                  const C4QueryOptions *options,
+                                  C4LiveQueryCallback callback,
+                                  void *context,
+                                  C4Error *outError);
+
+    /** Passes the row changes saved since the last call to the callback, in the order they
+        were indexed, and forgets them. Applying them in order to the query's earlier results
+        brings them up to date. A row whose key changes is removed and added again.
+        @param query  The live query.
+        @param callback  Called for each changed row.
+        @param context  Passed to the callback.
+        @param outReset  Set to true if the view's index was erased before these changes, in
+                    which case all the earlier rows are gone and the changes only add rows;
+                    or if it was changed through another C4View handle, in which case the
+                    query has to be run again to get its rows.
+        @param outError  On failure, error info will be stored here.
+        @return  True on success, false on failure. */
+    bool c4livequery_getChanges(C4LiveQuery *query,
+                                C4RowChangeCallback callback,
+                                void *context,
+                                bool *outReset,
+                                C4Error *outError);
+
+    /** Stops a live query and frees it. Must not be called from its callback. */
+    void c4livequery_free(C4LiveQuery *query);
+
 #ifdef __cplusplus
 }
 #endif
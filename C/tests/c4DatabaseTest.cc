@@ -15,6 +15,9 @@
 #include "c4DocEnumerator.h"
 #include "c4ExpiryEnumerator.h"
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #ifdef _MSC_VER
 #define random() rand()
@@ -23,6 +26,15 @@
 #define sleep(sec) Sleep((sec)*1000)
 #else
 #include "unistd.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef _MSC_VER
+static const char *kRelaxedDBPath = "C:\\tmp\\forest_relaxed.fdb";
+#else
+static const char *kRelaxedDBPath = "/tmp/forest_relaxed.fdb";
 #endif
 
 class C4DatabaseTest : public C4Test {
@@ -494,6 +506,39 @@ class C4DatabaseTest : public C4Test {
     }
 
 
+    void testAllDocsResume() {
+        setupAllDocs();
+        C4Error error = {};
+
+        // Page through the docs 30 at a time, resuming after each page's last docID:
+        C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+        options.flags &= ~kC4IncludeBodies;
+        std::string lastDocID;
+        int i = 1;
+        for (int page = 0; page < 4; ++page) {
+            options.resumeAfter = c4str(page ? lastDocID.c_str() : NULL);
+            C4DocEnumerator* e = c4db_enumerateAllDocs(db, kC4SliceNull, kC4SliceNull,
+                                                       &options, &error);
+            Assert(e);
+            int n = 0;
+            C4DocumentInfo doc;
+            while (n < 30 && c4enum_next(e, &error)) {
+                Assert(c4enum_getDocumentInfo(e, &doc));
+                char docID[20];
+                sprintf(docID, "doc-%03d", i);
+                AssertEqual(doc.docID, c4str(docID));
+                lastDocID = std::string((const char*)doc.docID.buf, doc.docID.size);
+                ++i;
+                ++n;
+            }
+            c4enum_free(e);
+            AssertEqual(error.code, 0);
+            AssertEqual(n, (page < 3) ? 30 : 9);
+        }
+        AssertEqual(i, 100);
+    }
+
+
     void testChanges() {
         char docID[20];
         for (int i = 1; i < 100; i++) {
@@ -623,6 +668,429 @@ class C4DatabaseTest : public C4Test {
         AssertEqual(expiredCount, 0);
     }
 
+    void testSetExpirations()
+    {
+        static const unsigned kNumDocs = 100;
+        std::vector<std::string> docIDs;
+        std::vector<C4Slice> docIDSlices;
+        std::vector<uint64_t> timestamps;
+        uint64_t now = time(NULL);
+        for (unsigned i = 0; i < kNumDocs; ++i) {
+            char docID[20];
+            sprintf(docID, "doc-%03u", i);
+            docIDs.push_back(docID);
+            if (i > 0)      // leave doc-000 nonexistent
+                createRev(c4str(docID), kRevID, kBody);
+        }
+        // Pass them in reverse order, to exercise the sorting:
+        for (unsigned i = kNumDocs; i-- > 0; ) {
+            docIDSlices.push_back(c4str(docIDs[i].c_str()));
+            timestamps.push_back(now + 1000 + i);
+        }
+
+        C4Error err;
+        Assert(c4db_setExpirations(db, docIDSlices.data(), timestamps.data(), kNumDocs, &err));
+        AssertEqual(c4doc_getExpiration(db, c4str(docIDs[0].c_str())), (uint64_t)0);
+        for (unsigned i = 1; i < kNumDocs; ++i)
+            AssertEqual(c4doc_getExpiration(db, c4str(docIDs[i].c_str())), now + 1000 + i);
+        AssertEqual(c4db_nextDocExpiration(db), now + 1001);
+
+        // Cancel some and change others:
+        for (unsigned i = 0; i < kNumDocs; ++i)
+            timestamps[i] = (i % 2) ? 0 : now + 5000;
+        Assert(c4db_setExpirations(db, docIDSlices.data(), timestamps.data(), kNumDocs, &err));
+        for (unsigned i = 1; i < kNumDocs; ++i) {
+            uint64_t expected = (i % 2) ? now + 5000 : 0;   // docIDSlices is in reverse order
+            AssertEqual(c4doc_getExpiration(db, c4str(docIDs[i].c_str())), expected);
+        }
+        AssertEqual(c4db_nextDocExpiration(db), now + 5000);
+    }
+
+    void testStats() {
+        c4db_resetStats(db);
+        C4DatabaseStats stats;
+        c4db_getStats(db, &stats);
+        AssertEqual(stats.sets, (uint64_t)0);
+        AssertEqual(stats.commit.count, (uint64_t)0);
+
+        for (int i = 0; i < 10; ++i) {
+            char docID[20];
+            sprintf(docID, "doc-%03d", i);
+            createRev(c4str(docID), kRevID, kBody);
+        }
+        C4Error error;
+        C4Document *doc = c4doc_get(db, c4str("doc-005"), true, &error);
+        Assert(doc != NULL);
+        c4doc_free(doc);
+
+        c4db_getStats(db, &stats);
+        Assert(stats.sets >= 10);
+        Assert(stats.bytesWritten > 10 * kBody.size);
+        Assert(stats.gets >= 1);
+        Assert(stats.commit.count >= 10);
+        Assert(stats.commit.p50Nanos <= stats.commit.p99Nanos);
+        Assert(stats.commit.p99Nanos <= stats.commit.maxNanos);
+        Assert(stats.revTreeEncode.count >= 10);
+        Assert(stats.revTreeDecode.count >= 1);
+
+        c4db_resetStats(db);
+        c4db_getStats(db, &stats);
+        AssertEqual(stats.sets, (uint64_t)0);
+        AssertEqual(stats.revTreeEncode.count, (uint64_t)0);
+    }
+
+    void testDocumentCache() {
+        c4db_setDocumentCacheSize(db, 1024*1024);
+        createRev(kDocID, kRevID, kBody);
+        c4db_resetStats(db);
+
+        C4Error error;
+        for (int i = 0; i < 3; ++i) {
+            C4Document *doc = c4doc_get(db, kDocID, true, &error);
+            Assert(doc != NULL);
+            AssertEqual(doc->revID, kRevID);
+            AssertEqual(doc->selectedRev.body, kBody);
+            c4doc_free(doc);
+        }
+        C4DatabaseStats stats;
+        c4db_getStats(db, &stats);
+        AssertEqual(stats.docCacheMisses, (uint64_t)1);
+        AssertEqual(stats.docCacheHits, (uint64_t)2);
+
+        // A new revision replaces the cached tree:
+        createRev(kDocID, kRev2ID, C4STR("{\"ok\":\"go\"}"));
+        C4Document *doc = c4doc_get(db, kDocID, true, &error);
+        Assert(doc != NULL);
+        AssertEqual(doc->revID, kRev2ID);
+        AssertEqual(doc->selectedRev.body, C4STR("{\"ok\":\"go\"}"));
+        c4doc_free(doc);
+
+        c4db_setDocumentCacheSize(db, 0);
+    }
+
+    void testDocIDFilter() {
+        createRev(kDocID, kRevID, kBody);
+        C4Error error;
+        Assert(c4db_setDocIDFilterEnabled(db, true, &error));
+        c4db_resetStats(db);
+
+        // A missing doc is rejected by the filter:
+        C4Document *doc = c4doc_get(db, C4STR("nonexistent"), true, &error);
+        Assert(doc == NULL);
+        AssertEqual((uint32_t)error.domain, (uint32_t)ForestDBDomain);
+        AssertEqual(error.code, (int)FDB_RESULT_KEY_NOT_FOUND);
+        C4DatabaseStats stats;
+        c4db_getStats(db, &stats);
+        AssertEqual(stats.docIDFilterSkips, (uint64_t)1);
+
+        // Existing docs, and ones created after the filter was built, are found:
+        doc = c4doc_get(db, kDocID, true, &error);
+        Assert(doc != NULL);
+        c4doc_free(doc);
+        createRev(C4STR("newdoc"), kRevID, kBody);
+        doc = c4doc_get(db, C4STR("newdoc"), true, &error);
+        Assert(doc != NULL);
+        AssertEqual(doc->revID, kRevID);
+        c4doc_free(doc);
+
+        // Can't be changed inside a transaction:
+        Assert(c4db_beginTransaction(db, &error));
+        Assert(!c4db_setDocIDFilterEnabled(db, false, &error));
+        Assert(c4db_endTransaction(db, false, &error));
+
+        Assert(c4db_setDocIDFilterEnabled(db, false, &error));
+        doc = c4doc_get(db, C4STR("nonexistent"), true, &error);
+        Assert(doc == NULL);
+        c4db_getStats(db, &stats);
+        AssertEqual(stats.docIDFilterSkips, (uint64_t)1);
+    }
+
+    void testMemoryBudget() {
+        C4MemoryUsage usage;
+        c4_getMemoryUsage(&usage);
+        AssertEqual(usage.budget, (uint64_t)0);
+        Assert(usage.openFiles >= 1);
+        Assert(usage.forestDBCache > 0);
+        Assert(usage.writeAheadLogs > 0);
+
+        c4db_setDocumentCacheSize(db, 1024*1024);
+        createRev(kDocID, kRevID, kBody);
+        C4Error error;
+        C4Document *doc = c4doc_get(db, kDocID, true, &error);
+        Assert(doc != NULL);
+        c4doc_free(doc);
+        c4_getMemoryUsage(&usage);
+        Assert(usage.documentCaches > 0);
+        Assert(usage.documentCacheLimit >= 1024*1024);
+
+        // Trimming empties the caches but leaves their capacity alone:
+        c4_trimMemory(kC4TrimCritical);
+        c4_getMemoryUsage(&usage);
+        AssertEqual(usage.documentCaches, (uint64_t)0);
+        Assert(usage.documentCacheLimit >= 1024*1024);
+
+        // With a budget, the document caches get what the other subsystems don't use:
+        const uint64_t kBudget = 64*1024*1024;
+        c4_setMemoryBudget(kBudget);
+        c4_getMemoryUsage(&usage);
+        AssertEqual(usage.budget, kBudget);
+        Assert(usage.documentCacheLimit > 0);
+        Assert(usage.forestDBCache + usage.writeAheadLogs + usage.docIDFilters
+               + usage.documentCacheLimit <= kBudget);
+
+        // Removing the budget disables the document caches again:
+        c4_setMemoryBudget(0);
+        c4_getMemoryUsage(&usage);
+        AssertEqual(usage.documentCacheLimit, (uint64_t)0);
+    }
+
+    void testCompactionScheduler() {
+        // Write and then overwrite a bunch of docs, to leave plenty of garbage in the file:
+        char docID[20], body[100];
+        for (int pass = 0; pass < 3; ++pass) {
+            TransactionHelper t(db);
+            for (int i = 0; i < 500; ++i) {
+                sprintf(docID, "doc-%03d", i);
+                sprintf(body, "{\"pass\":%d,\"padding\":\"%060d\"}", pass, i);
+                C4Error error;
+                Assert(c4raw_put(db, C4STR("raw"), c4str(docID), kC4SliceNull, c4str(body),
+                                 &error));
+            }
+        }
+        c4db_resetStats(db);
+
+        C4CompactionSchedulerOptions options = {};
+        options.minFragmentation = 0.1;
+        options.intervalSecs = 1;
+        options.maxBytesPerSec = 10*1024*1024;
+        c4_startCompactionScheduler(&options);
+
+        C4DatabaseStats stats;
+        for (int i = 0; i < 100; ++i) {
+            c4db_getStats(db, &stats);
+            if (stats.compactions > 0)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        c4_stopCompactionScheduler();
+        AssertEqual(stats.compactions, (uint64_t)1);
+
+        C4CompactionStatus status;
+        c4db_getCompactionStatus(db, &status);
+        Assert(!status.compacting);
+
+        // The data survived:
+        C4Error error;
+        C4RawDocument *doc = c4raw_get(db, C4STR("raw"), C4STR("doc-123"), &error);
+        Assert(doc != NULL);
+        Assert(memcmp(doc->body.buf, "{\"pass\":2,", 10) == 0);
+        c4raw_free(doc);
+    }
+
+    static C4Database* openRelaxedDB(const char *path, C4DatabaseFlags flags) {
+        C4Error error;
+        c4db_deleteAtPath(c4str(path), kC4DB_Create, NULL);
+        C4Database *relaxedDB = c4db_open(c4str(path), flags, NULL, &error);
+        Assert(relaxedDB != NULL);
+        return relaxedDB;
+    }
+
+    static bool putRaw(C4Database *toDB, int i) {
+        char key[20];
+        sprintf(key, "doc-%06d", i);
+        C4Error error;
+        return c4db_beginTransaction(toDB, &error)
+            && c4raw_put(toDB, C4STR("raw"), c4str(key), kC4SliceNull, C4STR("body"), &error)
+            && c4db_endTransaction(toDB, true, &error);
+    }
+
+    void testSyncPeriodically() {
+        C4Database *relaxedDB = openRelaxedDB(kRelaxedDBPath,
+                                              kC4DB_Create | kC4DB_SyncPeriodically);
+        c4db_setSyncInterval(relaxedDB, 50);
+        c4db_resetStats(relaxedDB);
+        for (int i = 0; i < 100; ++i)
+            Assert(putRaw(relaxedDB, i));
+
+        // The commits are batched into a few syncs, one per interval:
+        C4DatabaseStats stats;
+        c4db_getStats(relaxedDB, &stats);
+        Assert(stats.fileSync.count < 100);
+        sleep(1);
+        c4db_getStats(relaxedDB, &stats);
+        Assert(stats.fileSync.count >= 1);
+
+        C4Error error;
+        Assert(c4db_delete(relaxedDB, &error));
+        c4db_free(relaxedDB);
+    }
+
+#ifndef _MSC_VER
+    // Reads an int from a pipe, waiting at most timeoutMs for it. Returns false on timeout or EOF.
+    static bool readInt(int fd, int timeoutMs, int &i) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, timeoutMs) == 1 && read(fd, &i, sizeof(i)) == sizeof(i);
+    }
+
+    // Crash-simulation harness: a child process commits transactions with relaxed durability,
+    // reporting each one through a pipe, and is killed without closing the database. The
+    // database must then open, with every transaction the child reported. (This simulates a
+    // process crash; an OS crash, which can also lose the last sync interval, can't be tested
+    // this way.)
+    void testRelaxedDurabilityCrash() {
+        C4DatabaseFlags flagses[2] = {kC4DB_SyncPeriodically, kC4DB_NoSync};
+        for (C4DatabaseFlags flags : flagses) {
+            c4db_deleteAtPath(c4str(kRelaxedDBPath), kC4DB_Create, NULL);
+            int fds[2];
+            Assert(pipe(fds) == 0);
+            c4_stopFileSyncer();    // (left running by testSyncPeriodically)
+            pid_t pid = fork();
+            Assert(pid >= 0);
+            if (pid == 0) {
+                close(fds[0]);
+                C4Error error;
+                C4Database *childDB = c4db_open(c4str(kRelaxedDBPath), kC4DB_Create | flags,
+                                                NULL, &error);
+                if (!childDB)
+                    _exit(1);
+                c4db_setSyncInterval(childDB, 10);
+                for (int i = 0; putRaw(childDB, i); ++i) {
+                    if (write(fds[1], &i, sizeof(i)) != sizeof(i))
+                        break;
+                }
+                _exit(1);
+            }
+
+            close(fds[1]);
+            int lastCommitted = -1, i;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+            while (true) {
+                auto msLeft = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                            deadline - std::chrono::steady_clock::now()).count();
+                if (msLeft <= 0 || !readInt(fds[0], (int)msLeft, i))
+                    break;
+                lastCommitted = i;
+            }
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            // The child is gone, so its end of the pipe is closed; read whatever it left:
+            while (readInt(fds[0], 0, i))
+                lastCommitted = i;
+            close(fds[0]);
+            Assert(lastCommitted >= 0);
+
+            C4Error error;
+            C4Database *crashedDB = c4db_open(c4str(kRelaxedDBPath), flags, NULL, &error);
+            Assert(crashedDB != NULL);
+            for (i = 0; i <= lastCommitted; ++i) {
+                char key[20];
+                sprintf(key, "doc-%06d", i);
+                C4RawDocument *doc = c4raw_get(crashedDB, C4STR("raw"), c4str(key), &error);
+                Assert(doc != NULL);
+                c4raw_free(doc);
+            }
+            Assert(c4db_delete(crashedDB, &error));
+            c4db_free(crashedDB);
+        }
+    }
+#endif
+
+    static void onExpiry(void *context, unsigned purgedCount) {
+        *(std::atomic_uint*)context += purgedCount;
+    }
+
+    void testExpiryPurger()
+    {
+        C4Slice docID = C4STR("expire_me");
+        createRev(docID, kRevID, kBody);
+        C4Slice docID2 = C4STR("expire_me_too");
+        createRev(docID2, kRevID, kBody);
+        C4Slice docID3 = C4STR("dont_expire_me");
+        createRev(docID3, kRevID, kBody);
+
+        std::atomic_uint purgedCount {0};
+        C4Error err;
+        Assert(c4db_startExpiryPurger(db, 1, onExpiry, &purgedCount, &err));
+
+        time_t expire = time(NULL) + 1;
+        Assert(c4doc_setExpiration(db, docID, expire, &err));
+        Assert(c4doc_setExpiration(db, docID2, expire, &err));
+
+        // Wait (a bounded time) for the purger to wake up and purge both docs:
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (purgedCount < 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        AssertEqual((unsigned)purgedCount, 2u);
+        C4Document *doc = c4doc_get(db, docID, true, &err);
+        Assert(doc == NULL);
+        AssertEqual(err.code, (int)FDB_RESULT_KEY_NOT_FOUND);
+        doc = c4doc_get(db, docID3, true, &err);
+        Assert(doc != NULL);
+        c4doc_free(doc);
+        AssertEqual(c4doc_getExpiration(db, docID), (uint64_t)0);
+        AssertEqual(c4db_nextDocExpiration(db), (uint64_t)0);
+
+        c4db_stopExpiryPurger(db);
+    }
+
+    static std::string generateDocID() {
+        C4Error error;
+        C4SliceResult result = c4doc_generateID(&error);
+        Assert(result.buf != NULL);
+        std::string docID((const char*)result.buf, result.size);
+        c4slice_free(result);
+        return docID;
+    }
+
+    void testGenerateDocIDs() {
+        std::string random = generateDocID();
+        AssertEqual(random.size(), (size_t)23);
+        AssertEqual(random[0], '-');
+        Assert(generateDocID() != random);
+
+        c4doc_generateTimeOrderedDocIDs(true);
+        std::string prev = generateDocID();
+        for (int i = 0; i < 1000; ++i) {
+            std::string docID = generateDocID();
+            AssertEqual(docID.size(), (size_t)23);
+            AssertEqual(docID[0], '-');
+            Assert(docID > prev);
+            prev = docID;
+        }
+        c4doc_generateTimeOrderedDocIDs(false);
+    }
+
+    static std::atomic_uint sTransactionLogCount;
+    static std::thread::id sLogThread;
+
+    static void countTransactionLogs(C4LogLevel level, C4Slice message) {
+        if (c4SliceEqual(message, c4str("Database: commit transaction"))) {
+            sLogThread = std::this_thread::get_id();
+            ++sTransactionLogCount;
+        }
+    }
+
+    void testAsyncLogging() {
+        sTransactionLogCount = 0;
+        c4log_register(kC4LogInfo, countTransactionLogs);
+        c4log_setAsync(true);
+        for (int i = 0; i < 10; ++i) {
+            char docID[20];
+            sprintf(docID, "doc-%03d", i);
+            createRev(c4str(docID), kRevID, kBody);
+        }
+        c4log_flush();
+        AssertEqual((unsigned)sTransactionLogCount, 10u);
+        AssertEqual(c4log_getDroppedCount(), (uint64_t)0);
+        Assert(sLogThread != std::this_thread::get_id());
+
+        // Back to synchronous delivery:
+        c4log_setAsync(false);
+        createRev(C4STR("doc-sync"), kRevID, kBody);
+        AssertEqual((unsigned)sTransactionLogCount, 11u);
+        Assert(sLogThread == std::this_thread::get_id());
+    }
+
     CPPUNIT_TEST_SUITE( C4DatabaseTest );
     CPPUNIT_TEST( testErrorMessages );
     CPPUNIT_TEST( testTransaction );
@@ -632,13 +1100,30 @@ class C4DatabaseTest : public C4Test {
     CPPUNIT_TEST( testInsertRevisionWithHistory );
     CPPUNIT_TEST( testAllDocs );
     CPPUNIT_TEST( testAllDocsInfo );
+    CPPUNIT_TEST( testAllDocsResume );
     CPPUNIT_TEST( testAllDocsIncludeDeleted );
     CPPUNIT_TEST( testChanges );
     CPPUNIT_TEST( testExpired );
     CPPUNIT_TEST( testCancelExpire );
+    CPPUNIT_TEST( testSetExpirations );
+    CPPUNIT_TEST( testStats );
+    CPPUNIT_TEST( testDocumentCache );
+    CPPUNIT_TEST( testDocIDFilter );
+    CPPUNIT_TEST( testMemoryBudget );
+    CPPUNIT_TEST( testCompactionScheduler );
+    CPPUNIT_TEST( testSyncPeriodically );
+#ifndef _MSC_VER
+    CPPUNIT_TEST( testRelaxedDurabilityCrash );
+#endif
+    CPPUNIT_TEST( testExpiryPurger );
+    CPPUNIT_TEST( testAsyncLogging );
+    CPPUNIT_TEST( testGenerateDocIDs );
     CPPUNIT_TEST_SUITE_END();
 };
 
+std::atomic_uint C4DatabaseTest::sTransactionLogCount;
+std::thread::id C4DatabaseTest::sLogThread;
+
 CPPUNIT_TEST_SUITE_REGISTRATION(C4DatabaseTest);
 
 
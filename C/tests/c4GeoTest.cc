@@ -9,13 +9,17 @@
 #include "c4Test.hh"
 #include "c4View.h"
 #include "c4DocEnumerator.h"
+#include "forestdb.h"
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <math.h>
+#include <vector>
 #ifndef _MSC_VER
 #include <unistd.h>
 #else
 #define random() rand()
 #define srandom(seed) srand(seed)
-#include <algorithm>
 #endif
 
 #ifdef _MSC_VER
@@ -27,10 +31,37 @@ static const char *kViewIndexPath = "/tmp/forest_temp.view.index";
 static double randomLat() { return random() / (double)RAND_MAX * 180.0 - 90.0; }
 static double randomLon() { return random() / (double)RAND_MAX * 360.0 - 180.0; }
 
+static double deg2rad(double deg) { return deg * M_PI / 180.0; }
+
+// Great-circle distance in km, computed the same way as CBForest's geohash::coord::distanceTo.
+static double distanceKm(double lat1, double lon1, double lat2, double lon2) {
+    lat1 = deg2rad(lat1);
+    lat2 = deg2rad(lat2);
+    double dLon = deg2rad(lon2 - lon1);
+    double a = cos(lat2)*sin(dLon), b = cos(lat1)*sin(lat2) - sin(lat1)*cos(lat2)*cos(dLon);
+    return 6371.0 * atan2(sqrt(a*a + b*b), sin(lat1)*sin(lat2) + cos(lat1)*cos(lat2)*cos(dLon));
+}
+
+// Distance in km from a point to the nearest point of an area, by brute force: the nearest of
+// the point's own meridian (if it crosses the area) and points sampled along the area's edges.
+static double distanceToArea(double lat, double lon, const C4GeoArea &a) {
+    if (lon >= a.xmin && lon <= a.xmax)
+        return distanceKm(lat, lon, std::min(std::max(lat, a.ymin), a.ymax), lon);
+    static const int kSamples = 200;
+    double best = INFINITY;
+    for (int i = 0; i <= kSamples; ++i) {
+        double edgeLat = a.ymin + (a.ymax - a.ymin) * i / kSamples;
+        best = std::min(best, distanceKm(lat, lon, edgeLat, a.xmin));
+        best = std::min(best, distanceKm(lat, lon, edgeLat, a.xmax));
+    }
+    return best;
+}
+
 class C4GeoTest : public C4Test {
 public:
 
     C4View *view;
+    std::vector<C4GeoArea> docAreas;        // the area of doc "i" is docAreas[i]
 
     virtual void setUp() {
         C4Test::setUp();
@@ -64,6 +95,9 @@ public:
             double lat1 = std::min(lat0 + 0.5, 90.0), lon1 = std::min(lon0 + 0.5, 180.0);
             char body[1000];
             sprintf(body, "(%g, %g, %g, %g)", lon0, lat0, lon1, lat1);
+            C4GeoArea area;             // as parsed by createIndex
+            sscanf(body, "(%lf, %lf, %lf, %lf)", &area.xmin, &area.ymin, &area.xmax, &area.ymax);
+            docAreas.push_back(area);
 
             C4DocPutRequest rq = {};
             rq.docID = c4str(docID);
@@ -110,6 +144,78 @@ public:
         Assert(c4indexer_end(ind, true, &error));
     }
 
+    // Indexes each doc by emitting the shapes given for its docID.
+    void createIndexWithShapes(const std::map<std::string, std::vector<C4GeoArea>> &shapes) {
+        C4Error error;
+        C4Indexer* ind = c4indexer_begin(db, &view, 1, &error);
+        Assert(ind);
+        C4DocEnumerator* e = c4indexer_enumerateDocuments(ind, &error);
+        Assert(e);
+        C4Document *doc;
+        while (NULL != (doc = c4enum_nextDocument(e, &error))) {
+            auto &areas = shapes.at(std::string((const char*)doc->docID.buf, doc->docID.size));
+            std::vector<C4Key*> keys;
+            std::vector<C4Slice> values;
+            for (auto &area : areas) {
+                keys.push_back(c4key_newGeoJSON(c4str("{\"geo\":true}"), area));
+                values.push_back(c4str("1234"));
+            }
+            Assert(c4indexer_emit(ind, doc, 0, (unsigned)keys.size(), keys.data(), values.data(),
+                                  &error));
+            for (auto key : keys)
+                c4key_free(key);
+            c4doc_free(doc);
+        }
+        c4enum_free(e);
+        AssertEqual(error.code, 0);
+        Assert(c4indexer_end(ind, true, &error));
+    }
+
+    // Rewrites the view's geo rows the way older versions wrote them: their values hold only
+    // the ID of the special entry with the shape, without the shape's bounding box.
+    void stripGeoRowBoundingBoxes() {
+        C4Error error;
+        Assert(c4view_close(view, &error));
+        c4view_free(view);
+        view = NULL;
+
+        fdb_config config = fdb_get_default_config();
+        fdb_file_handle *file;
+        fdb_kvs_handle *kvs;
+        fdb_iterator *it;
+        AssertEqual(fdb_open(&file, kViewIndexPath, &config), FDB_RESULT_SUCCESS);
+        AssertEqual(fdb_kvs_open(file, &kvs, "myview", NULL), FDB_RESULT_SUCCESS);
+        AssertEqual(fdb_iterator_init(kvs, &it, NULL, 0, NULL, 0, FDB_ITR_NO_DELETES),
+                    FDB_RESULT_SUCCESS);
+        unsigned stripped = 0;
+        do {
+            fdb_doc *doc = NULL;
+            if (fdb_iterator_get(it, &doc) != FDB_RESULT_SUCCESS)
+                break;
+            // A geo row's key is a collatable array (tag 7) starting with a geohash (tag 9) or
+            // a Hilbert cell string (tag 6); its value is a number (a tag and 8 bytes) followed
+            // by the bounding box:
+            auto key = (const uint8_t*)doc->key;
+            static const size_t kNumberSize = 9;
+            if (doc->keylen > 1 && key[0] == 7 && (key[1] == 9 || key[1] == 6)
+                    && doc->bodylen > kNumberSize) {
+                doc->bodylen = kNumberSize;
+                AssertEqual(fdb_set(kvs, doc), FDB_RESULT_SUCCESS);
+                ++stripped;
+            }
+            fdb_doc_free(doc);
+        } while (fdb_iterator_next(it) == FDB_RESULT_SUCCESS);
+        fdb_iterator_close(it);
+        AssertEqual(fdb_commit(file, FDB_COMMIT_NORMAL), FDB_RESULT_SUCCESS);
+        fdb_kvs_close(kvs);
+        fdb_close(file);
+        Assert(stripped > 0);
+
+        view = c4view_open(db, c4str(kViewIndexPath), c4str("myview"), c4str("1"),
+                           kC4DB_Create, encryptionKey(), &error);
+        Assert(view);
+    }
+
     void testCreateIndex() {
         createDocs(100);
         createIndex();
@@ -146,10 +252,206 @@ public:
         AssertEqual(found, 2u);
     }
 
+    void testReopenHilbertIndex() {
+        C4Error error;
+        Assert(c4view_setGeoIndexType(view, kC4HilbertIndex, &error));
+        createDocs(100);
+        createIndex();
+
+        // Reopen the view without setting the index type; it should keep using Hilbert keys,
+        // not invalidate the index or query it as geohashes:
+        Assert(c4view_close(view, &error));
+        c4view_free(view);
+        view = c4view_open(db, c4str(kViewIndexPath), c4str("myview"), c4str("1"),
+                           kC4DB_Create, encryptionKey(), &error);
+        Assert(view != NULL);
+        AssertEqual(c4view_getLastSequenceIndexed(view), (C4SequenceNumber)100);
+
+        C4GeoArea queryArea = {10, 10, 40, 40};
+        C4QueryEnumerator* e = c4view_geoQuery(view, queryArea, &error);
+        Assert(e);
+        unsigned found = 0;
+        while (c4queryenum_next(e, &error))
+            ++found;
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        AssertEqual(found, 2u);
+
+        // Explicitly switching to geohash keys invalidates it:
+        Assert(c4view_setGeoIndexType(view, kC4GeohashIndex, &error));
+        AssertEqual(c4view_getLastSequenceIndexed(view), (C4SequenceNumber)0);
+    }
+
+    void testQueryBoundingBoxes() {
+        createDocs(100);
+        createIndex();
+        checkQueryBoundingBoxes();
+    }
+
+    void checkQueryBoundingBoxes() {
+        // Each row should report the bbox of its own doc, and all intersecting docs be found:
+        C4GeoArea queryArea = {-60, -60, 60, 60};
+        unsigned expectedCount = 0;
+        for (auto &a : docAreas) {
+            if (a.xmin <= queryArea.xmax && a.xmax >= queryArea.xmin
+                    && a.ymin <= queryArea.ymax && a.ymax >= queryArea.ymin)
+                ++expectedCount;
+        }
+        Assert(expectedCount > 2);
+
+        C4Error error;
+        C4QueryEnumerator* e = c4view_geoQuery(view, queryArea, &error);
+        Assert(e);
+        unsigned found = 0;
+        while (c4queryenum_next(e, &error)) {
+            ++found;
+            unsigned docIndex = atoi(std::string((const char*)e->docID.buf, e->docID.size).c_str());
+            Assert(docIndex < docAreas.size());
+            const C4GeoArea &expected = docAreas[docIndex];
+            AssertEqual(e->geoBBox.xmin, expected.xmin);
+            AssertEqual(e->geoBBox.ymin, expected.ymin);
+            AssertEqual(e->geoBBox.xmax, expected.xmax);
+            AssertEqual(e->geoBBox.ymax, expected.ymax);
+            C4Slice expectedJSON = C4STR("{\"geo\":true}");
+            AssertEqual(e->geoJSON, expectedJSON);
+        }
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        AssertEqual(found, expectedCount);
+    }
+
+    void testNearestQuery() {
+        static const bool verbose = false;
+        createDocs(100, verbose);
+        createIndex();
+
+        // The docs nearest to (25, 25), found by brute force:
+        std::vector<std::pair<double, unsigned>> byDistance;
+        for (unsigned i = 0; i < docAreas.size(); ++i)
+            byDistance.push_back({distanceToArea(25, 25, docAreas[i]), i});
+        std::sort(byDistance.begin(), byDistance.end());
+
+        // Find the nearest 5, checking that they're the same docs, in order of distance:
+        C4Error error;
+        C4QueryEnumerator* e = c4view_geoNearestQuery(view, 25, 25, 5, &error);
+        Assert(e);
+        unsigned found = 0;
+        double lastDistance = 0.0;
+        while (c4queryenum_next(e, &error)) {
+            if (verbose) {
+                C4GeoArea a = e->geoBBox;
+                fprintf(stderr, "Found doc %.*s : (%g, %g)--(%g, %g) at %g km\n",
+                    (int)e->docID.size, e->docID.buf, a.xmin, a.ymin, a.xmax, a.ymax,
+                    e->geoDistance);
+            }
+            Assert(found < 5);
+            AssertEqual(std::string((const char*)e->docID.buf, e->docID.size),
+                        std::to_string(byDistance[found].second));
+            Assert(fabs(e->geoDistance - byDistance[found].first) < 1.0);
+            ++found;
+            Assert(e->geoDistance >= lastDistance);
+            lastDistance = e->geoDistance;
+            C4Slice expected = C4STR("1234");
+            AssertEqual(e->value, expected);
+            expected = C4STR("{\"geo\":true}");
+            AssertEqual(e->geoJSON, expected);
+        }
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        AssertEqual(found, 5u);
+
+        // Asking for more than exist should return every doc exactly once, in order (from a
+        // point where some docs are nearest across the South Pole):
+        byDistance.clear();
+        for (unsigned i = 0; i < docAreas.size(); ++i)
+            byDistance.push_back({distanceToArea(-60, 120, docAreas[i]), i});
+        std::sort(byDistance.begin(), byDistance.end());
+        e = c4view_geoNearestQuery(view, -60, 120, 1000, &error);
+        Assert(e);
+        found = 0;
+        lastDistance = 0.0;
+        while (c4queryenum_next(e, &error)) {
+            Assert(found < 100);
+            AssertEqual(std::string((const char*)e->docID.buf, e->docID.size),
+                        std::to_string(byDistance[found].second));
+            Assert(fabs(e->geoDistance - byDistance[found].first) < 1.0);
+            ++found;
+            Assert(e->geoDistance >= lastDistance);
+            lastDistance = e->geoDistance;
+        }
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        AssertEqual(found, 100u);
+    }
+
+
+    void testQueryOldFormatRows() {
+        createDocs(100);
+        createIndex();
+        stripGeoRowBoundingBoxes();
+
+        // The rows' bounding boxes are read from the special entries instead:
+        checkQueryBoundingBoxes();
+
+        C4Error error;
+        C4QueryEnumerator* e = c4view_geoNearestQuery(view, 25, 25, 1000, &error);
+        Assert(e);
+        unsigned found = 0;
+        while (c4queryenum_next(e, &error)) {
+            unsigned docIndex = atoi(std::string((const char*)e->docID.buf, e->docID.size).c_str());
+            Assert(docIndex < docAreas.size());
+            AssertEqual(e->geoBBox.xmin, docAreas[docIndex].xmin);
+            AssertEqual(e->geoBBox.ymax, docAreas[docIndex].ymax);
+            ++found;
+        }
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        AssertEqual(found, 100u);
+    }
+
+    void testDuplicateShapes() {
+        // Each shape spans several cells, so it has several rows. "a" emits the same shape
+        // twice, and "b" emits it once:
+        C4GeoArea area = {10, 10, 30, 30};
+        createRev(c4str("a"), kRevID, kBody);
+        createRev(c4str("b"), kRevID, kBody);
+        createIndexWithShapes({{"a", {area, area}}, {"b", {area}}});
+
+        // Every emitted shape is a separate result, found once:
+        C4GeoArea queryArea = {0, 0, 40, 40};
+        C4Error error;
+        C4QueryEnumerator* e = c4view_geoQuery(view, queryArea, &error);
+        Assert(e);
+        std::string found;
+        while (c4queryenum_next(e, &error))
+            found += std::string((const char*)e->docID.buf, e->docID.size);
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        std::sort(found.begin(), found.end());
+        AssertEqual(found, std::string("aab"));
+
+        e = c4view_geoNearestQuery(view, 20, 20, 10, &error);
+        Assert(e);
+        found.clear();
+        while (c4queryenum_next(e, &error)) {
+            found += std::string((const char*)e->docID.buf, e->docID.size);
+            AssertEqual(e->geoDistance, 0.0);
+        }
+        c4queryenum_free(e);
+        AssertEqual(error.code, 0);
+        std::sort(found.begin(), found.end());
+        AssertEqual(found, std::string("aab"));
+    }
+
 
     CPPUNIT_TEST_SUITE( C4GeoTest );
     CPPUNIT_TEST( testCreateIndex );
     CPPUNIT_TEST( testQuery );
+    CPPUNIT_TEST( testQueryBoundingBoxes );
+    CPPUNIT_TEST( testNearestQuery );
+    CPPUNIT_TEST( testReopenHilbertIndex );
+    CPPUNIT_TEST( testQueryOldFormatRows );
+    CPPUNIT_TEST( testDuplicateShapes );
     CPPUNIT_TEST_SUITE_END();
 };
 
@@ -9,15 +9,23 @@
 #include "c4Test.hh"
 #include "c4View.h"
 #include "c4DocEnumerator.h"
+#include "c4ExpiryEnumerator.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
 
 #ifdef _MSC_VER
 static const char *kViewIndexPath = "C:\\tmp\\forest_temp.view.index";
+static const char *kSharedIndexPath = "C:\\tmp\\forest_temp.views.index";
 #else
 static const char *kViewIndexPath = "/tmp/forest_temp.view.index";
+static const char *kSharedIndexPath = "/tmp/forest_temp.views.index";
 #endif
 
 
@@ -64,7 +72,7 @@ public:
         updateIndex();
     }
 
-    void updateIndex() {
+    void updateIndex(C4Slice value = c4str("1234")) {
         C4Error error;
         C4Indexer* ind = c4indexer_begin(db, &view, 1, &error);
         Assert(ind);
@@ -81,7 +89,7 @@ public:
             keys[1] = c4key_new();
             c4key_addString(keys[0], doc->docID);
             c4key_addNumber(keys[1], doc->sequence);
-            values[0] = values[1] = c4str("1234");
+            values[0] = values[1] = value;
             Assert(c4indexer_emit(ind, doc, 0, 2, keys, values, &error));
             c4key_free(keys[0]);
             c4key_free(keys[1]);
@@ -128,6 +136,623 @@ public:
         AssertEqual(i, 200);
     }
 
+    void testQueryProfile() {
+        createIndex();
+
+        // Keys 11...30 are in range; the first 5 are skipped, the next 10 returned, and one more
+        // is read before the limit stops the enumeration:
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.skip = 5;
+        options.limit = 10;
+        options.startKey = c4key_new();
+        c4key_addNumber(options.startKey, 11);
+        options.endKey = c4key_new();
+        c4key_addNumber(options.endKey, 30);
+
+        C4Error error;
+        auto e = c4view_query(view, &options, &error);
+        Assert(e);
+        int i = 0;
+        while (c4queryenum_next(e, &error))
+            ++i;
+        AssertEqual(error.code, 0);
+        AssertEqual(i, 10);
+
+        C4QueryProfile profile;
+        Assert(c4queryenum_getProfile(e, &profile));
+        AssertEqual(profile.rowsScanned, (uint64_t)16);
+        AssertEqual(profile.rowsReturned, (uint64_t)10);
+        AssertEqual(profile.rowsSkipped, (uint64_t)5);
+        AssertEqual(profile.rowsRejected, (uint64_t)0);
+        AssertEqual(profile.seeks, (uint64_t)1);
+        AssertEqual(profile.keyRanges, (uint64_t)1);
+        Assert(profile.bytesRead > 16 * 4);      // every row's value is "1234"
+        Assert(profile.elapsedNanos > 0);
+        c4queryenum_free(e);
+        c4key_free(options.startKey);
+        c4key_free(options.endKey);
+    }
+
+    void testQueryPaging() {
+        createIndex();
+
+        // Page through all 200 rows, 50 at a time, resuming after each page's last row:
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.limit = 50;
+        C4SliceResult token = {NULL, 0};
+        std::vector<std::string> keys;
+        C4Error error;
+        for (int page = 0; page < 5; ++page) {
+            options.resumeAfter = {token.buf, token.size};
+            auto e = c4view_query(view, &options, &error);
+            Assert(e);
+            int n = 0;
+            while (c4queryenum_next(e, &error)) {
+                keys.push_back(toJSON(e->key));
+                ++n;
+            }
+            AssertEqual(error.code, 0);
+            AssertEqual(n, (page < 4) ? 50 : 0);
+
+            C4QueryProfile profile;
+            Assert(c4queryenum_getProfile(e, &profile));
+            AssertEqual(profile.rowsSkipped, (uint64_t)0);
+            Assert(profile.rowsScanned <= 51);
+
+            c4slice_free({token.buf, token.size});
+            token = c4queryenum_getResumeToken(e);
+            Assert(token.buf != NULL || page == 4);
+            c4queryenum_free(e);
+        }
+        c4slice_free({token.buf, token.size});
+
+        // The pages together are the same as the whole query:
+        AssertEqual(keys.size(), (size_t)200);
+        AssertEqual(keys[0], std::string("1"));
+        AssertEqual(keys[49], std::string("50"));
+        AssertEqual(keys[50], std::string("51"));
+        AssertEqual(keys[100], std::string("\"doc-001\""));
+        AssertEqual(keys[199], std::string("\"doc-100\""));
+    }
+
+    void testQueryKeysOnly() {
+        createIndex();
+
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.keysOnly = true;
+        C4Error error;
+        auto e = c4view_query(view, &options, &error);
+        Assert(e);
+        int i = 0;
+        while (c4queryenum_next(e, &error)) {
+            ++i;
+            Assert(e->value.buf == NULL);
+            Assert(e->docID.size > 0);
+            Assert(e->docSequence > 0);
+        }
+        AssertEqual(error.code, 0);
+        AssertEqual(i, 200);
+
+        C4QueryProfile profile;
+        Assert(c4queryenum_getProfile(e, &profile));
+        c4queryenum_free(e);
+
+        // Compare with a regular query, which reads every row's 4-byte value:
+        e = c4view_query(view, NULL, &error);
+        Assert(e);
+        while (c4queryenum_next(e, &error))
+            ;
+        C4QueryProfile fullProfile;
+        Assert(c4queryenum_getProfile(e, &fullProfile));
+        AssertEqual(profile.bytesRead, fullProfile.bytesRead - 200 * 4);
+        c4queryenum_free(e);
+    }
+
+    // Queries the index for a list of keys, returning the rows' keys as comma-separated JSON.
+    std::string queryKeys(std::vector<C4Key*> keys, C4QueryProfile &profile) {
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.keys = (const C4Key**)keys.data();
+        options.keysCount = keys.size();
+        C4Error error;
+        auto e = c4view_query(view, &options, &error);
+        Assert(e);
+        std::string result;
+        while (c4queryenum_next(e, &error)) {
+            if (!result.empty())
+                result += ",";
+            result += toJSON(e->key);
+        }
+        AssertEqual(error.code, 0);
+        Assert(c4queryenum_getProfile(e, &profile));
+        c4queryenum_free(e);
+        for (auto key : keys)
+            c4key_free(key);
+        return result;
+    }
+
+    static C4Key* numberKey(double n) {
+        C4Key *key = c4key_new();
+        c4key_addNumber(key, n);
+        return key;
+    }
+
+    void testQueryMultipleKeys() {
+        createIndex();
+        C4QueryProfile profile;
+
+        // Keys in order: adjacent rows are read without seeking again.
+        auto rows = queryKeys({numberKey(10), numberKey(11), numberKey(12)}, profile);
+        AssertEqual(rows, std::string("10,11,12"));
+        AssertEqual(profile.seeks, (uint64_t)1);
+        AssertEqual(profile.rowsScanned, (uint64_t)4);
+
+        // Unsorted, repeated keys: read in one forward pass, returned in the caller's order.
+        C4Key *docKey = c4key_new();
+        c4key_addString(docKey, c4str("doc-005"));
+        rows = queryKeys({numberKey(50), numberKey(10), numberKey(10), docKey, numberKey(11)},
+                         profile);
+        AssertEqual(rows, std::string("50,10,10,\"doc-005\",11"));
+        AssertEqual(profile.rowsReturned, (uint64_t)5);
+        AssertEqual(profile.seeks, (uint64_t)4);            // 10 (twice), 11, 50, "doc-005"
+        AssertEqual(profile.rowsScanned, (uint64_t)8);
+    }
+
+    void testQueryPagingMultipleKeys() {
+        createIndex();
+
+        // Page through unsorted, repeated keys (which are buffered) a few rows at a time:
+        for (unsigned pageSize = 1; pageSize <= 3; ++pageSize) {
+            C4Key *docKey = c4key_new();
+            c4key_addString(docKey, c4str("doc-005"));
+            std::vector<C4Key*> keys = {numberKey(50), numberKey(10), numberKey(10), docKey,
+                                        numberKey(11)};
+            C4QueryOptions options = kC4DefaultQueryOptions;
+            options.keys = (const C4Key**)keys.data();
+            options.keysCount = keys.size();
+            options.limit = pageSize;
+            C4SliceResult token = {NULL, 0};
+            std::string rows;
+            C4Error error;
+            for (int page = 0; page < 10; ++page) {
+                options.resumeAfter = {token.buf, token.size};
+                auto e = c4view_query(view, &options, &error);
+                Assert(e);
+                unsigned n = 0;
+                while (c4queryenum_next(e, &error)) {
+                    if (!rows.empty())
+                        rows += ",";
+                    rows += toJSON(e->key);
+                    ++n;
+                }
+                AssertEqual(error.code, 0);
+                c4slice_free({token.buf, token.size});
+                token = c4queryenum_getResumeToken(e);
+                c4queryenum_free(e);
+                if (n < pageSize)
+                    break;
+            }
+            c4slice_free({token.buf, token.size});
+            for (auto key : keys)
+                c4key_free(key);
+            AssertEqual(rows, std::string("50,10,10,\"doc-005\",11"));
+        }
+    }
+
+    void testQueryPagingSortedKeys() {
+        createIndex();
+
+        // Page through sorted keys (which are read straight from the index) a few rows at a time:
+        for (unsigned pageSize = 1; pageSize <= 3; ++pageSize) {
+            std::vector<C4Key*> keys = {numberKey(10), numberKey(11), numberKey(12),
+                                        numberKey(13), numberKey(14)};
+            C4QueryOptions options = kC4DefaultQueryOptions;
+            options.keys = (const C4Key**)keys.data();
+            options.keysCount = keys.size();
+            options.limit = pageSize;
+            C4SliceResult token = {NULL, 0};
+            std::string rows;
+            C4Error error;
+            for (int page = 0; page < 10; ++page) {
+                options.resumeAfter = {token.buf, token.size};
+                auto e = c4view_query(view, &options, &error);
+                Assert(e);
+                unsigned n = 0;
+                while (c4queryenum_next(e, &error)) {
+                    if (!rows.empty())
+                        rows += ",";
+                    rows += toJSON(e->key);
+                    ++n;
+                }
+                AssertEqual(error.code, 0);
+                c4slice_free({token.buf, token.size});
+                token = c4queryenum_getResumeToken(e);
+                c4queryenum_free(e);
+                if (n < pageSize)
+                    break;
+                Assert(token.buf != NULL);
+            }
+            c4slice_free({token.buf, token.size});
+            for (auto key : keys)
+                c4key_free(key);
+            AssertEqual(rows, std::string("10,11,12,13,14"));
+        }
+    }
+
+    // Runs a query, returning its rows' keys, docIDs and sequences as a string.
+    std::string queryRows(const C4QueryOptions *options, C4QueryProfile &profile) {
+        C4Error error;
+        auto e = c4view_query(view, options, &error);
+        Assert(e);
+        std::string result;
+        while (c4queryenum_next(e, &error)) {
+            result += toJSON(e->key) + " " + std::string((const char*)e->docID.buf, e->docID.size)
+                    + " " + std::to_string(e->docSequence) + ",";
+            Assert(e->value == c4str("1234"));
+        }
+        AssertEqual(error.code, 0);
+        Assert(c4queryenum_getProfile(e, &profile));
+        c4queryenum_free(e);
+        return result;
+    }
+
+    void testQueryCache() {
+        createIndex();
+        c4view_setQueryCacheCapacity(view, 100000);
+        C4QueryProfile profile;
+
+        // The first query reads the index; repeating it doesn't:
+        std::string rows = queryRows(NULL, profile);
+        AssertEqual(profile.rowsScanned, (uint64_t)200);
+        AssertEqual(queryRows(NULL, profile), rows);
+        AssertEqual(profile.rowsScanned, (uint64_t)0);
+        AssertEqual(profile.rowsReturned, (uint64_t)200);
+
+        // Different options are a different query, but equivalent ones aren't:
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.limit = 10;
+        std::string limited = queryRows(&options, profile);
+        Assert(profile.rowsScanned > 0);
+        options.inclusiveStart = false;     // has no effect without a startKey
+        AssertEqual(queryRows(&options, profile), limited);
+        AssertEqual(profile.rowsScanned, (uint64_t)0);
+
+        // Resume tokens work on cached results:
+        C4Error error;
+        auto e = c4view_query(view, &options, &error);
+        Assert(e);
+        while (c4queryenum_next(e, &error))
+            ;
+        C4SliceResult token = c4queryenum_getResumeToken(e);
+        Assert(token.buf != NULL);
+        c4queryenum_free(e);
+        options.resumeAfter = {token.buf, token.size};
+        std::string page2 = queryRows(&options, profile);
+        AssertEqual(rows.substr(0, limited.size() + page2.size()), limited + page2);
+        c4slice_free({token.buf, token.size});
+
+        // Indexing a new doc changes the index, so the results are read again:
+        createRev(c4str("doc-new"), kRevID, kBody);
+        updateIndex();
+        std::string newRows = queryRows(NULL, profile);
+        AssertEqual(profile.rowsScanned, (uint64_t)202);
+        Assert(newRows != rows);
+        AssertEqual(queryRows(NULL, profile), newRows);
+        AssertEqual(profile.rowsScanned, (uint64_t)0);
+
+        // So does erasing it:
+        Assert(c4view_eraseIndex(view, &error));
+        AssertEqual(queryRows(NULL, profile), std::string());
+
+        // Disabling the cache:
+        updateIndex();
+        c4view_setQueryCacheCapacity(view, 0);
+        AssertEqual(queryRows(NULL, profile), newRows);
+        AssertEqual(queryRows(NULL, profile), newRows);
+        AssertEqual(profile.rowsScanned, (uint64_t)202);
+    }
+
+    void testQueryCacheWithOtherHandle() {
+        createIndex();
+        c4view_setQueryCacheCapacity(view, 100000);
+        C4QueryProfile profile;
+        std::string rows = queryRows(NULL, profile);
+        AssertEqual(profile.rowsScanned, (uint64_t)200);
+
+        // Another handle invalidates the index with a new map version, and rebuilds it up to the
+        // same sequence with different rows:
+        C4Error error;
+        C4View *view2 = c4view_open(db, c4str(kViewIndexPath), c4str("myview"), c4str("2"),
+                                    kC4DB_Create, encryptionKey(), &error);
+        Assert(view2);
+        std::swap(view, view2);
+        updateIndexWithKeys({"X"});
+        std::swap(view, view2);
+        AssertEqual(c4view_getLastSequenceChangedAt(view2), (C4SequenceNumber)100);
+        Assert(c4view_close(view2, &error));
+        c4view_free(view2);
+
+        // The first handle's cached rows are stale, so it reads the index again:
+        std::string newRows = queryRows(NULL, profile);
+        Assert(newRows != rows);
+        AssertEqual(profile.rowsReturned, (uint64_t)100);
+        Assert(profile.rowsScanned > 0);
+    }
+
+    struct ParallelQueryRows {
+        std::mutex mutex;
+        std::vector<std::string> keys;
+        std::vector<C4SequenceNumber> sequences;
+    };
+
+    static void collectRow(void *context, const C4QueryEnumerator *row) {
+        auto rows = (ParallelQueryRows*)context;
+        std::string key = toJSON(row->key);
+        Assert(row->value == c4str("1234"));
+        std::lock_guard<std::mutex> lock(rows->mutex);
+        rows->keys.push_back(key);
+        rows->sequences.push_back(row->docSequence);
+    }
+
+    void testParallelQuery() {
+        createIndex();
+        C4Error error;
+        C4QueryProfile profile;
+
+        // Ordered: the rows come back in key order, as from c4view_query:
+        ParallelQueryRows ordered;
+        Assert(c4view_parallelQuery(view, NULL, 4, true, collectRow, &ordered, &profile, &error));
+        AssertEqual(ordered.keys.size(), (size_t)200);
+        for (int i = 1; i <= 200; i++) {
+            char buf[20];
+            if (i <= 100)
+                sprintf(buf, "%d", i);
+            else
+                sprintf(buf, "\"doc-%03d\"", i - 100);
+            AssertEqual(ordered.keys[i-1], std::string(buf));
+            AssertEqual(ordered.sequences[i-1], (C4SequenceNumber)(i <= 100 ? i : i - 100));
+        }
+        AssertEqual(profile.rowsReturned, (uint64_t)200);
+        Assert(profile.keyRanges > 1);      // it was split into partitions
+
+        // Unordered: the same rows, in any order:
+        ParallelQueryRows unordered;
+        Assert(c4view_parallelQuery(view, NULL, 4, false, collectRow, &unordered, &profile,
+                                    &error));
+        std::sort(unordered.keys.begin(), unordered.keys.end());
+        std::vector<std::string> expected = ordered.keys;
+        std::sort(expected.begin(), expected.end());
+        Assert(unordered.keys == expected);
+        AssertEqual(profile.rowsReturned, (uint64_t)200);
+
+        // A key range, with a limit:
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.startKey = numberKey(20);
+        options.endKey = numberKey(80);
+        options.limit = 50;
+        ParallelQueryRows limited;
+        Assert(c4view_parallelQuery(view, &options, 4, true, collectRow, &limited, &profile,
+                                    &error));
+        AssertEqual(limited.keys.size(), (size_t)50);
+        AssertEqual(limited.keys.front(), std::string("20"));
+        AssertEqual(limited.keys.back(), std::string("69"));
+        AssertEqual(profile.rowsReturned, (uint64_t)50);
+        c4key_free(options.startKey);
+        c4key_free(options.endKey);
+
+        // Options it doesn't support:
+        options = kC4DefaultQueryOptions;
+        options.skip = 10;
+        Assert(!c4view_parallelQuery(view, &options, 4, true, collectRow, &limited, NULL,
+                                     &error));
+        AssertEqual(error.domain, HTTPDomain);
+        AssertEqual(error.code, (int)kC4HTTPBadRequest);
+    }
+
+    struct LiveQueryChanges {
+        unsigned notifications {0};
+        std::string changes;
+    };
+
+    static void liveQueryChanged(void *context, C4LiveQuery *query) {
+        ++((LiveQueryChanges*)context)->notifications;
+    }
+
+    static void collectChange(void *context, C4RowChangeType type, const C4QueryEnumerator *row) {
+        static const char* const kTypes[] = {"+", "-", "*"};
+        std::string value = row->value.buf ? std::string((const char*)row->value.buf,
+                                                         row->value.size)
+                                           : std::string("null");
+        *(std::string*)context += kTypes[type] + toJSON(row->key) + " "
+                                + std::string((const char*)row->docID.buf, row->docID.size)
+                                + " " + std::to_string(row->docSequence) + " " + value + ",";
+    }
+
+    // Gets a live query's changes as a string of "<type><key> <docID> <sequence> <value>,"
+    static std::string liveChanges(C4LiveQuery *query, bool &reset) {
+        C4Error error;
+        std::string changes;
+        Assert(c4livequery_getChanges(query, collectChange, &changes, &reset, &error));
+        return changes;
+    }
+
+    void testLiveQuery() {
+        createIndex();
+        C4Error error;
+        bool reset;
+
+        // Numeric keys 1 up to 10:
+        C4QueryOptions options = kC4DefaultQueryOptions;
+        options.startKey = numberKey(1);
+        options.endKey = numberKey(10);
+        options.inclusiveEnd = false;
+        LiveQueryChanges low;
+        C4LiveQuery *lowQuery = c4view_liveQuery(view, &options, liveQueryChanged, &low, &error);
+        Assert(lowQuery);
+        c4key_free(options.startKey);
+        c4key_free(options.endKey);
+
+        // Numeric keys 200 down to 100, without values:
+        options = kC4DefaultQueryOptions;
+        options.descending = true;
+        options.startKey = numberKey(200);
+        options.endKey = numberKey(100);
+        options.keysOnly = true;
+        LiveQueryChanges high;
+        C4LiveQuery *highQuery = c4view_liveQuery(view, &options, liveQueryChanged, &high,
+                                                  &error);
+        Assert(highQuery);
+        c4key_free(options.startKey);
+        c4key_free(options.endKey);
+
+        // Specific keys:
+        const C4Key *keys[2] = {c4key_new(), numberKey(50)};
+        c4key_addString((C4Key*)keys[0], c4str("doc-001"));
+        options = kC4DefaultQueryOptions;
+        options.keys = keys;
+        options.keysCount = 2;
+        LiveQueryChanges specific;
+        C4LiveQuery *keysQuery = c4view_liveQuery(view, &options, liveQueryChanged, &specific,
+                                                  &error);
+        Assert(keysQuery);
+        c4key_free((C4Key*)keys[0]);
+        c4key_free((C4Key*)keys[1]);
+
+        // Updating doc-001 rewrites its docID row with a new value, and moves its sequence row
+        // from 1 to 101:
+        createRev(c4str("doc-001"), kRev2ID, kBody);
+        updateIndex(c4str("5678"));
+        AssertEqual(low.notifications, 1u);
+        AssertEqual(high.notifications, 1u);
+        AssertEqual(specific.notifications, 1u);
+        AssertEqual(liveChanges(lowQuery, reset), std::string("-1 doc-001 101 null,"));
+        Assert(!reset);
+        AssertEqual(liveChanges(highQuery, reset), std::string("+101 doc-001 101 null,"));
+        AssertEqual(liveChanges(keysQuery, reset), std::string("*\"doc-001\" doc-001 101 5678,"));
+        AssertEqual(liveChanges(lowQuery, reset), std::string());
+
+        // Changes outside a query's range don't notify it; changes not yet gotten notify once:
+        createRev(c4str("doc-new"), kRevID, kBody);
+        updateIndex();
+        createRev(c4str("doc-newer"), kRevID, kBody);
+        updateIndex();
+        AssertEqual(low.notifications, 1u);
+        AssertEqual(specific.notifications, 1u);
+        AssertEqual(high.notifications, 2u);
+        AssertEqual(liveChanges(highQuery, reset),
+                    std::string("+102 doc-new 102 null,+103 doc-newer 103 null,"));
+        AssertEqual(liveChanges(lowQuery, reset), std::string());
+
+        // Erasing the index resets the queries:
+        Assert(c4view_eraseIndex(view, &error));
+        AssertEqual(low.notifications, 2u);
+        AssertEqual(liveChanges(lowQuery, reset), std::string());
+        Assert(reset);
+        updateIndex();
+        AssertEqual(high.notifications, 3u);       // once, since it hasn't gotten the reset
+        AssertEqual(liveChanges(highQuery, reset),
+                    std::string("+100 doc-100 100 null,+101 doc-001 101 null,"
+                                "+102 doc-new 102 null,+103 doc-newer 103 null,"));
+        Assert(reset);
+
+        c4livequery_free(lowQuery);
+        c4livequery_free(highQuery);
+        c4livequery_free(keysQuery);
+
+        // Options it doesn't support:
+        options = kC4DefaultQueryOptions;
+        options.limit = 10;
+        Assert(!c4view_liveQuery(view, &options, NULL, NULL, &error));
+        AssertEqual(error.domain, HTTPDomain);
+        AssertEqual(error.code, (int)kC4HTTPBadRequest);
+    }
+
+    void testLiveQueryWithOtherHandle() {
+        createIndex();
+        C4Error error;
+        bool reset;
+        LiveQueryChanges all;
+        C4LiveQuery *query = c4view_liveQuery(view, NULL, liveQueryChanged, &all, &error);
+        Assert(query);
+
+        // Indexing through another handle can't report which rows changed:
+        C4View *view2 = c4view_open(db, c4str(kViewIndexPath), c4str("myview"), c4str("1"),
+                                    kC4DB_Create, encryptionKey(), &error);
+        Assert(view2);
+        createRev(c4str("doc-new"), kRevID, kBody);
+        std::swap(view, view2);
+        updateIndex();
+        std::swap(view, view2);
+        AssertEqual(all.notifications, 0u);
+
+        // ...so once this handle reads the index's state, the live query is reset:
+        AssertEqual(c4view_getLastSequenceIndexed(view), (C4SequenceNumber)101);
+        AssertEqual(all.notifications, 1u);
+        AssertEqual(liveChanges(query, reset), std::string());
+        Assert(reset);
+
+        // Indexing through this handle reports the rows again:
+        createRev(c4str("doc-newer"), kRevID, kBody);
+        updateIndex();
+        AssertEqual(all.notifications, 2u);
+        AssertEqual(liveChanges(query, reset),
+                    std::string("+\"doc-newer\" doc-newer 102 1234,+102 doc-newer 102 1234,"));
+        Assert(!reset);
+
+        c4livequery_free(query);
+        Assert(c4view_close(view2, &error));
+        c4view_free(view2);
+    }
+
+    // Indexes the changed docs, emitting the given string keys for each.
+    void updateIndexWithKeys(std::vector<const char*> keyStrings) {
+        C4Error error;
+        C4Indexer* ind = c4indexer_begin(db, &view, 1, &error);
+        Assert(ind);
+        C4DocEnumerator* e = c4indexer_enumerateDocuments(ind, &error);
+        Assert(e);
+        C4Document *doc;
+        while (NULL != (doc = c4enum_nextDocument(e, &error))) {
+            std::vector<C4Key*> keys;
+            std::vector<C4Slice> values;
+            for (auto keyString : keyStrings) {
+                keys.push_back(c4key_new());
+                c4key_addString(keys.back(), c4str(keyString));
+                values.push_back(c4str("1234"));
+            }
+            Assert(c4indexer_emit(ind, doc, 0, (unsigned)keys.size(), keys.data(), values.data(),
+                                  &error));
+            for (auto key : keys)
+                c4key_free(key);
+            c4doc_free(doc);
+        }
+        AssertEqual(error.code, 0);
+        c4enum_free(e);
+        Assert(c4indexer_end(ind, true, &error));
+    }
+
+    void testReemitKeys() {
+        // Re-emitting keys [A,B] as [C,B] replaces row A with C, and keeps row B:
+        createRev(C4STR("doc"), kRevID, kBody);
+        updateIndexWithKeys({"A", "B"});
+        AssertEqual(c4view_getTotalRows(view), (C4SequenceNumber)2);
+        createRev(C4STR("doc"), kRev2ID, kBody);
+        updateIndexWithKeys({"C", "B"});
+        AssertEqual(c4view_getTotalRows(view), (C4SequenceNumber)2);
+
+        C4Error error;
+        auto e = c4view_query(view, NULL, &error);
+        Assert(e);
+        std::string rows;
+        while (c4queryenum_next(e, &error)) {
+            if (!rows.empty())
+                rows += ",";
+            rows += toJSON(e->key);
+        }
+        AssertEqual(error.code, 0);
+        c4queryenum_free(e);
+        AssertEqual(rows, std::string("\"B\",\"C\""));
+    }
+
     void testIndexVersion() {
         createIndex();
 
@@ -196,6 +821,106 @@ public:
         AssertEqual(i, 198); // 2 rows of doc-023 are gone
     }
 
+    static void onExpiry(void *context, unsigned purgedCount) {
+        *(std::atomic_uint*)context += purgedCount;
+    }
+
+    void testExpiryPurge() {
+        createIndex();
+
+        // Let the expiry purger purge an indexed doc:
+        std::atomic_uint purgedCount {0};
+        C4Error error;
+        Assert(c4db_startExpiryPurger(db, 10, onExpiry, &purgedCount, &error));
+        Assert(c4doc_setExpiration(db, c4str("doc-023"), time(NULL) - 1, &error));
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (purgedCount < 1 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        c4db_stopExpiryPurger(db);
+        AssertEqual((unsigned)purgedCount, 1u);
+
+        // Updating the view removes the purged doc's rows:
+        Assert(c4view_getLastSequenceIndexed(view) < c4db_getLastSequence(db));
+        updateIndex();
+        AssertEqual(c4view_getTotalRows(view), (C4SequenceNumber)198);
+        auto e = c4view_query(view, NULL, &error);
+        Assert(e);
+        int i = 0;
+        while (c4queryenum_next(e, &error)) {
+            Assert(!c4SliceEqual(e->docID, c4str("doc-023")));
+            ++i;
+        }
+        c4queryenum_free(e);
+        AssertEqual(i, 198);
+    }
+
+    C4View* openSharedView(const char *name) {
+        C4Error error;
+        C4View *v = c4view_open(db, c4str(kSharedIndexPath), c4str(name), c4str("1"),
+                                kC4DB_Create | kC4DB_SharedIndexFile, encryptionKey(), &error);
+        Assert(v);
+        return v;
+    }
+
+    void testSharedIndexFile() {
+        C4Error error;
+        c4view_deleteAtPath(c4str(kSharedIndexPath), kC4DB_Create, &error);
+        C4View* views[2] = {openSharedView("byID"), openSharedView("bySeq")};
+
+        char docID[20];
+        for (int i = 1; i <= 10; i++) {
+            sprintf(docID, "doc-%03d", i);
+            createRev(c4str(docID), kRevID, kBody);
+        }
+
+        // Index both views in one pass, which makes a single commit to the shared file:
+        C4Indexer* ind = c4indexer_begin(db, views, 2, &error);
+        Assert(ind);
+        C4DocEnumerator* e = c4indexer_enumerateDocuments(ind, &error);
+        Assert(e);
+        C4Document *doc;
+        while (NULL != (doc = c4enum_nextDocument(e, &error))) {
+            for (unsigned v = 0; v < 2; ++v) {
+                C4Key *key = c4key_new();
+                if (v == 0)
+                    c4key_addString(key, doc->docID);
+                else
+                    c4key_addNumber(key, doc->sequence);
+                C4Slice value = c4str("1234");
+                Assert(c4indexer_emit(ind, doc, v, 1, &key, &value, &error));
+                c4key_free(key);
+            }
+            c4doc_free(doc);
+        }
+        AssertEqual(error.code, 0);
+        c4enum_free(e);
+        Assert(c4indexer_end(ind, true, &error));
+
+        for (unsigned v = 0; v < 2; ++v) {
+            AssertEqual(c4view_getTotalRows(views[v]), (uint64_t)10);
+            AssertEqual(c4view_getLastSequenceIndexed(views[v]), (C4SequenceNumber)10);
+        }
+        auto q = c4view_query(views[1], NULL, &error);
+        Assert(q);
+        Assert(c4queryenum_next(q, &error));
+        AssertEqual(toJSON(q->key), std::string("1"));
+        c4queryenum_free(q);
+
+        // Deleting one view leaves the other's index intact:
+        Assert(c4view_delete(views[0], &error));
+        c4view_free(views[0]);
+        AssertEqual(c4view_getTotalRows(views[1]), (uint64_t)10);
+        views[0] = openSharedView("byID");
+        AssertEqual(c4view_getTotalRows(views[0]), (uint64_t)0);
+        AssertEqual(c4view_getLastSequenceIndexed(views[0]), (C4SequenceNumber)0);
+
+        for (unsigned v = 0; v < 2; ++v) {
+            Assert(c4view_delete(views[v], &error));
+            c4view_free(views[v]);
+        }
+        Assert(c4view_deleteAtPath(c4str(kSharedIndexPath), kC4DB_Create, &error));
+    }
+
     void createFullTextIndex(unsigned docCount) {
         char docID[20];
         for (unsigned i = 1; i <= docCount; i++) {
@@ -300,9 +1025,23 @@ public:
     CPPUNIT_TEST( testEmptyState );
     CPPUNIT_TEST( testCreateIndex );
     CPPUNIT_TEST( testQueryIndex );
+    CPPUNIT_TEST( testQueryProfile );
+    CPPUNIT_TEST( testQueryPaging );
+    CPPUNIT_TEST( testQueryKeysOnly );
+    CPPUNIT_TEST( testQueryMultipleKeys );
+    CPPUNIT_TEST( testQueryPagingMultipleKeys );
+    CPPUNIT_TEST( testQueryPagingSortedKeys );
+    CPPUNIT_TEST( testParallelQuery );
+    CPPUNIT_TEST( testQueryCache );
+    CPPUNIT_TEST( testQueryCacheWithOtherHandle );
+    CPPUNIT_TEST( testLiveQuery );
+    CPPUNIT_TEST( testLiveQueryWithOtherHandle );
+    CPPUNIT_TEST( testReemitKeys );
     CPPUNIT_TEST( testIndexVersion );
     CPPUNIT_TEST( testDocPurge );
     CPPUNIT_TEST( testDocPurgeWithCompact );
+    CPPUNIT_TEST( testExpiryPurge );
+    CPPUNIT_TEST( testSharedIndexFile );
     CPPUNIT_TEST( testCreateFullTextIndex );
     CPPUNIT_TEST( testQueryFullTextIndex );
     CPPUNIT_TEST_SUITE_END();
@@ -168,4 +168,54 @@ static void verify_neighbors(
     AssertEqualCStrings(hashes[1].first().string, "s3");  XCTAssertEqual(hashes[1].count, 5u);
 }
 
+- (void) testHilbertCells {
+    // Encoding then decoding a coord gives a cell containing it:
+    geohash::coord points[] = {{45.37, -121.7}, {35.6894875, 139.6917064},
+                               {-33.8671390, 151.2071140}, {51.5001524, -0.1262362}};
+    for (auto p : points) {
+        geohash::hilbertCell cell(p, 16);
+        XCTAssertEqual(cell.depth(), 16u);
+        geohash::area a = cell.decode();
+        XCTAssert(a.latitude.min <= p.latitude && p.latitude <= a.latitude.max);
+        XCTAssert(a.longitude.min <= p.longitude && p.longitude <= a.longitude.max);
+        // A cell's path is a prefix of its descendants' paths:
+        geohash::hilbertCell parent(p, 8);
+        XCTAssert(strncmp(cell.path, parent.path, 8) == 0);
+    }
+
+    // Consecutive cells along the curve are adjacent:
+    geohash::hilbertCell cell("00000");
+    unsigned steps = 0;
+    for (geohash::hilbertCell nextCell = cell.next(); !nextCell.isEmpty();
+                                                      nextCell = nextCell.next()) {
+        geohash::area a = cell.decode(), b = nextCell.decode();
+        double dLat = fabs(a.mid().latitude - b.mid().latitude);
+        double dLon = fabs(a.mid().longitude - b.mid().longitude);
+        XCTAssert((dLat < 1e-6) != (dLon < 1e-6), @"%s, %s not adjacent", cell.path, nextCell.path);
+        XCTAssert(cell < nextCell);
+        cell = nextCell;
+        ++steps;
+    }
+    XCTAssertEqual(steps, 1023u);
+    AssertEqualCStrings(cell.path, "33333");
+}
+
+- (void) testHilbertCovering {
+    geohash::area box(geohash::coord(10, 10), geohash::coord(40, 40));
+    auto ranges = box.coveringHilbertRanges(50);
+    XCTAssert(ranges.size() > 0 && ranges.size() <= 50);
+    for (auto r = ranges.begin(); r != ranges.end(); ++r) {
+        XCTAssertEqual(r->first.depth(), r->last.depth());
+        XCTAssert(!(r->last < r->first));
+        for (geohash::hilbertCell c = r->first; ; c = c.next()) {
+            XCTAssert(c.decode().intersects(box), @"Cell %s is outside the box", c.path);
+            if (c == r->last)
+                break;
+        }
+    }
+
+    auto cells = box.coveringHilbertCells();
+    XCTAssert(cells.size() >= 1 && cells.size() <= 4);
+}
+
 @end
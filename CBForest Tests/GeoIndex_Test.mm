@@ -134,4 +134,56 @@ static double randomLon()   {return random() / (double)INT_MAX * 360.0 - 180.0;}
     NSLog(@"Found %u points in the query area", found);
 }
 
+// Adds n docs with random shapes: mostly small boxes, plus some long thin ones
+- (void) addShapes: (unsigned)n {
+    srandom(42);
+    Transaction t(db);
+    for (unsigned i = 0; i < n; ++i) {
+        char docID[20];
+        sprintf(docID, "%u", i);
+        double lat0 = randomLat(), lon0 = randomLon();
+        double height = 0.5, width = 0.5;
+        if (i % 10 == 0)
+            width = 20.0;
+        else if (i % 10 == 1)
+            height = 20.0;
+        double lat1 = std::min(lat0 + height, 90.0), lon1 = std::min(lon0 + width, 180.0);
+        CollatableBuilder body;
+        body << lon0 << lat0 << lon1 << lat1;
+        t.set(slice(docID), body);
+    }
+    t.commit();
+}
+
+// Compares how many index rows each geo key scheme has to scan per query hit.
+- (void) testGeoKeySchemes {
+    LogLevel = kWarning;
+    [self addShapes: 20000];
+    area queries[] = {
+        area(coord(10, 10), coord(40, 40)),             // large square
+        area(coord(-5, -100), coord(5, 100)),           // wide
+        area(coord(-80, 30), coord(80, 35)),            // tall
+        area(coord(47.5, -122.5), coord(47.7, -122.3)), // small
+    };
+    const char* schemeNames[] = {"geohash", "hilbert"};
+    for (int scheme = MapReduceIndex::kGeohashKeys; scheme <= MapReduceIndex::kHilbertKeys;
+                                                    ++scheme) {
+        index->setup(0, "1");
+        index->setGeoKeyScheme((MapReduceIndex::GeoKeyScheme)scheme);
+        updateIndex(db, index);
+        unsigned totalHits = 0, totalScanned = 0;
+        for (const area &queryArea : queries) {
+            GeoIndexEnumerator e(index, queryArea);
+            while (e.next())
+                XCTAssert(e.keyBoundingBox().intersects(queryArea));
+            totalHits += e.hits();
+            totalScanned += e.hits() + e.misses() + e.dups();
+        }
+        NSLog(@"%s keys: %u index rows, %u hits, %u rows scanned (%.2f rows per hit)",
+              schemeNames[scheme], index->rowCount(), totalHits, totalScanned,
+              totalScanned / (double)totalHits);
+        XCTAssert(totalHits > 0);
+    }
+}
+
 @end
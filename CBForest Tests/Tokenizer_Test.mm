@@ -33,8 +33,8 @@ using namespace cbforest;
 - (NSArray*) tokenize: (NSString*)string unique: (BOOL)unique {
     NSMutableArray* tokens = [NSMutableArray array];
     for (TokenIterator i(*tokenizer, nsstring_slice(string), unique); i; ++i) {
-        std::string tok = i.token();
-        NSString* token = [[NSString alloc] initWithBytes: tok.c_str() length: tok.size() encoding: NSUTF8StringEncoding];
+        slice tok = i.token();
+        NSString* token = [[NSString alloc] initWithBytes: tok.buf length: tok.size encoding: NSUTF8StringEncoding];
         XCTAssert(i.wordLength() > 0 && i.wordLength() < 20);
         XCTAssert(i.wordOffset() < string.length);
         [tokens addObject: token];
@@ -75,5 +75,29 @@ using namespace cbforest;
                           (@[@"seven", @"nine"]));
 }
 
+- (void)testTokenizerPerformance {
+    // Build a ~1MB body of text:
+    NSString* paragraph = @"It was the best of times, it was the worst of times, it was the age of "
+        "wisdom, it was the age of foolishness, it was the epoch of belief, it was the epoch of "
+        "incredulity, it was the season of Light, it was the season of Darkness, it was the spring "
+        "of hope, it was the winter of despair. ";
+    NSMutableString* text = [NSMutableString string];
+    while (text.length < 1000000)
+        [text appendString: paragraph];
+    NSData* data = [text dataUsingEncoding: NSUTF8StringEncoding];
+    slice textSlice(data.bytes, data.length);
+
+    tokenizer = new Tokenizer("english", true);
+    [self measureBlock:^{
+        size_t count = 0, bytes = 0;
+        for (TokenIterator i(*tokenizer, textSlice, false); i; ++i) {
+            ++count;
+            bytes += i.token().size;
+        }
+        XCTAssert(count > 50000);
+        XCTAssert(bytes > 0);
+    }];
+}
+
 
 @end
@@ -0,0 +1,115 @@
+//
+//  BloomFilter.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "BloomFilter.hh"
+#include "DocEnumerator.hh"
+#include "LogInternal.hh"
+#include <math.h>
+#include <algorithm>
+
+
+namespace cbforest {
+
+    // 64-bit FNV-1a, followed by MurmurHash3's finalizer to spread the bits.
+    static uint64_t hash64(slice s, uint64_t seed) {
+        uint64_t h = 14695981039346656037ull ^ seed;
+        for (size_t i = 0; i < s.size; ++i) {
+            h ^= ((const uint8_t*)s.buf)[i];
+            h *= 1099511628211ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+
+    BloomFilter::BloomFilter(size_t capacity, double falsePositiveRate)
+    :_capacity(std::max(capacity, (size_t)1))
+    {
+        // Optimal sizing: m = -n ln(p) / ln(2)^2 bits, and k = (m/n) ln(2) hash functions.
+        double bitsPerItem = -log(falsePositiveRate) / (M_LN2 * M_LN2);
+        _numWords = (size_t)ceil(_capacity * bitsPerItem / 64.0);
+        _numBits = _numWords * 64;
+        _numHashes = std::max(1u, (unsigned)lround(bitsPerItem * M_LN2));
+        _words.reset(new std::atomic<uint64_t>[_numWords]);
+        for (size_t i = 0; i < _numWords; ++i)
+            _words[i].store(0, std::memory_order_relaxed);
+    }
+
+    // The k bit positions are derived from two hashes, as h1 + i*h2 (Kirsch & Mitzenmacher.)
+    void BloomFilter::add(slice item) {
+        uint64_t h1 = hash64(item, 0), h2 = hash64(item, h1) | 1;
+        for (unsigned i = 0; i < _numHashes; ++i) {
+            uint64_t bit = (h1 + i * h2) % _numBits;
+            _words[bit / 64].fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
+        }
+        _count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool BloomFilter::mayContain(slice item) const {
+        uint64_t h1 = hash64(item, 0), h2 = hash64(item, h1) | 1;
+        for (unsigned i = 0; i < _numHashes; ++i) {
+            uint64_t bit = (h1 + i * h2) % _numBits;
+            if (!(_words[bit / 64].load(std::memory_order_relaxed) & (1ull << (bit % 64))))
+                return false;
+        }
+        return true;
+    }
+
+
+    const double KeyFilter::kFalsePositiveRate = 0.01;
+    const size_t KeyFilter::kMinCapacity = 10000;
+
+    bool KeyFilter::mayContain(slice key) const {
+        auto bloom = std::atomic_load(&_bloom);
+        return !bloom || bloom->mayContain(key);
+    }
+
+    size_t KeyFilter::sizeInBytes() const {
+        auto bloom = std::atomic_load(&_bloom);
+        return bloom ? bloom->sizeInBytes() : 0;
+    }
+
+    void KeyFilter::add(slice key) {
+        auto bloom = std::atomic_load(&_bloom);
+        if (bloom) {
+            bloom->add(key);
+            if (bloom->count() > bloom->capacity())
+                _needsRebuild = true;      // it's getting too many false positives
+        }
+    }
+
+    void KeyFilter::rebuild(KeyStore &store) {
+        // Deleted docs are included, since a meta-only read finds their tombstones:
+        DocEnumerator::Options options = DocEnumerator::Options::kDefault;
+        options.includeDeleted = true;
+        options.contentOptions = KeyStore::kMetaOnly;
+        std::vector<alloc_slice> keys;
+        for (DocEnumerator e(store, slice::null, slice::null, options); e.next(); )
+            keys.push_back(alloc_slice(e.doc().key()));
+
+        // Leave room to double before it needs rebuilding again:
+        auto bloom = std::make_shared<BloomFilter>(std::max(2 * keys.size(), kMinCapacity),
+                                                   kFalsePositiveRate);
+        for (auto &key : keys)
+            bloom->add(key);
+        std::atomic_store(&_bloom, bloom);
+        _needsRebuild = false;
+        Log("KeyFilter: rebuilt with %zu keys, %zu bytes", keys.size(), bloom->sizeInBytes());
+    }
+
+}
@@ -0,0 +1,93 @@
+//
+//  BloomFilter.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__BloomFilter__
+#define __CBForest__BloomFilter__
+#include "slice.hh"
+#include <atomic>
+#include <memory>
+
+
+namespace cbforest {
+
+    class KeyStore;
+
+
+    /** A fixed-size Bloom filter of byte strings. Items can be added and tested concurrently
+        from any number of threads without locking. */
+    class BloomFilter {
+    public:
+        /** Sizes the filter so that it has the given false-positive rate once `capacity` items
+            have been added. */
+        BloomFilter(size_t capacity, double falsePositiveRate);
+
+        void add(slice item);
+        bool mayContain(slice item) const;
+
+        size_t count() const                {return _count.load(std::memory_order_relaxed);}
+        size_t capacity() const             {return _capacity;}
+        size_t sizeInBytes() const          {return _numWords * sizeof(uint64_t);}
+
+    private:
+        BloomFilter(const BloomFilter&) = delete;
+
+        std::unique_ptr<std::atomic<uint64_t>[]> _words;
+        size_t _numWords;
+        uint64_t _numBits;
+        unsigned _numHashes;
+        size_t _capacity;
+        std::atomic<size_t> _count {0};
+    };
+
+
+    /** An optional Bloom filter of all the keys in a KeyStore, which lets a lookup of a key
+        that was never stored skip the B-tree. It's shared by all Database instances on a file.
+        Keys are added as they're written (or deleted, since that leaves a tombstone) but can't be
+        removed, so the filter is rebuilt from a scan of the KeyStore when it overflows or
+        after compaction purges deleted docs. Rebuilding must be done while holding the file's
+        Transaction, since the scan wouldn't see another handle's uncommitted keys. */
+    class KeyFilter {
+    public:
+        /** Is a filter installed? If not, mayContain always returns true. */
+        bool enabled() const                {return std::atomic_load(&_bloom) != nullptr;}
+
+        /** False only if the key has definitely never been written. */
+        bool mayContain(slice key) const;
+
+        void add(slice key);
+
+        /** Scans the store and installs a new filter sized for its current keys.
+            No other thread may be writing to the store. */
+        void rebuild(KeyStore&);
+
+        void disable()                      {std::atomic_store(&_bloom, std::shared_ptr<BloomFilter>());}
+
+        /** Memory used by the installed filter, or 0 if none. */
+        size_t sizeInBytes() const;
+
+        /** Marks the filter as needing a rebuild, e.g. after compaction. */
+        void setNeedsRebuild()              {_needsRebuild = true;}
+        bool needsRebuild() const           {return _needsRebuild && enabled();}
+
+        static const double kFalsePositiveRate;
+        static const size_t kMinCapacity;
+
+    private:
+        std::shared_ptr<BloomFilter> _bloom;
+        std::atomic<bool> _needsRebuild {false};
+    };
+
+}
+
+#endif /* defined(__CBForest__BloomFilter__) */
@@ -116,6 +116,9 @@ namespace cbforest {
         size_t size() const                         {return _buf.size - _available.size;}
         bool empty() const                          {return size() == 0;}
 
+        /** Clears the contents, keeping the allocated buffer so it can be reused. */
+        void reset()                                {_available = _buf;}
+
         std::string toJSON() const;
 
         slice data() const                          {return slice(_buf.buf, size());}
@@ -0,0 +1,270 @@
+//
+//  CompactionScheduler.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "CompactionScheduler.hh"
+#include "LogInternal.hh"
+
+
+namespace cbforest {
+
+    CompactionScheduler& CompactionScheduler::shared() {
+        // Never destroyed, since Databases may be closed (and unregistered) during process exit.
+        static CompactionScheduler* sScheduler = new CompactionScheduler;
+        return *sScheduler;
+    }
+
+
+    void CompactionScheduler::addFile(const std::string &path, const Database::config &config) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry &entry = _files[path];
+        if (entry.refCount++ == 0) {
+            entry.config = config;
+            entry.config.flags &= ~FDB_OPEN_FLAG_CREATE;
+        }
+    }
+
+    void CompactionScheduler::setConfig(const std::string &path, const Database::config &config) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i != _files.end()) {
+            i->second.config = config;
+            i->second.config.flags &= ~FDB_OPEN_FLAG_CREATE;
+        }
+    }
+
+    void CompactionScheduler::removeFile(const std::string &path) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i == _files.end() || --i->second.refCount > 0)
+            return;
+        if (i->second.inUse) {
+            // Wait till the scheduler's handle is closed, so the caller can delete the file:
+            if (i->second.compactingDB) {
+                Log("CompactionScheduler: Waiting for compaction of %s to finish", path.c_str());
+                i->second.compactingDB->setCompactionRateLimit(0);
+            }
+            _doneCond.wait(lock, [&]{
+                i = _files.find(path);
+                return i == _files.end() || !i->second.inUse;
+            });
+            if (i == _files.end() || i->second.refCount > 0)
+                return;     // re-registered while waiting
+        }
+        _files.erase(i);
+    }
+
+
+    void CompactionScheduler::start(const Options &options) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _options = options;
+        if (_running) {
+            _wake = true;
+            _cond.notify_one();
+            return;
+        }
+        _stopping = false;
+        _running = true;
+        _thread = std::thread([this]{run();});
+    }
+
+    void CompactionScheduler::stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_running)
+                return;
+            _stopping = true;
+            // Don't make the caller wait out a throttled compaction:
+            for (auto &i : _files)
+                if (i.second.compactingDB)
+                    i.second.compactingDB->setCompactionRateLimit(0);
+        }
+        _cond.notify_one();
+        _thread.join();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+
+    bool CompactionScheduler::running() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _running;
+    }
+
+    void CompactionScheduler::wake() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _wake = true;
+        }
+        _cond.notify_one();
+    }
+
+
+    bool CompactionScheduler::getStatus(const std::string &path, FileStatus &outStatus) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i == _files.end())
+            return false;
+        Entry &entry = i->second;
+        outStatus.path = path;
+        outStatus.fileSize = entry.fileSize;
+        outStatus.spaceUsed = entry.spaceUsed;
+        outStatus.compacting = (entry.compactingDB != nullptr);
+        outStatus.progress = entry.compactingDB ? entry.compactingDB->compactionProgress() : 0.0;
+        return true;
+    }
+
+
+#pragma mark - BACKGROUND THREAD:
+
+
+    void CompactionScheduler::run() {
+        Log("CompactionScheduler: Started");
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopping) {
+            _wake = false;
+            std::vector<std::string> paths;
+            for (auto &i : _files)
+                if (isEligible(i.second))
+                    paths.push_back(i.first);
+            lock.unlock();
+
+            // Measure every file, then compact the one that would free the most space. Each
+            // file is compacted at most once per pass, in case compaction doesn't get it below
+            // the threshold (e.g. because it's being written to heavily.)
+            for (auto &path : paths)
+                measure(path);
+            for (;;) {
+                lock.lock();
+                std::string path = _stopping ? std::string() : pickFile();
+                lock.unlock();
+                if (path.empty())
+                    break;
+                compactFile(path);
+                lock.lock();
+                auto i = _files.find(path);
+                if (i != _files.end())
+                    i->second.fileSize = i->second.spaceUsed = 0;   // until the next pass
+                lock.unlock();
+            }
+
+            lock.lock();
+            if (_stopping)
+                break;
+            _cond.wait_for(lock, std::chrono::seconds(_options.intervalSecs),
+                           [this]{return _stopping || _wake;});
+        }
+        Log("CompactionScheduler: Stopped");
+    }
+
+
+    bool CompactionScheduler::isEligible(const Entry &entry) const {
+        return entry.config.compaction_mode == FDB_COMPACTION_MANUAL
+            && !(entry.config.flags & FDB_OPEN_FLAG_RDONLY);
+    }
+
+
+    // Marks a file as in use by the scheduler, so removeFile will wait until it's done, and
+    // returns a copy of its config. Returns false if it's no longer registered.
+    bool CompactionScheduler::claim(const std::string &path, Database::config &outConfig) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i == _files.end() || i->second.refCount == 0)
+            return false;
+        i->second.inUse = true;
+        outConfig = i->second.config;
+        return true;
+    }
+
+    void CompactionScheduler::unclaim(const std::string &path) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i != _files.end()) {
+            i->second.inUse = false;
+            i->second.compactingDB = nullptr;
+        }
+        _doneCond.notify_all();
+    }
+
+
+    // Updates a file's size and space used, using a temporary handle.
+    void CompactionScheduler::measure(const std::string &path) {
+        Database::config config;
+        if (!claim(path, config))
+            return;
+        try {
+            Database db(path, config);
+            auto info = db.getInfo();
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto i = _files.find(path);
+            if (i != _files.end()) {
+                i->second.fileSize = info.file_size;
+                i->second.spaceUsed = info.space_used;
+            }
+        } catch (const std::exception &x) {
+            Warn("CompactionScheduler: Couldn't get info of %s: %s", path.c_str(), x.what());
+        }
+        unclaim(path);
+    }
+
+
+    // Returns the eligible file that would free the most space. Caller must lock _mutex.
+    std::string CompactionScheduler::pickFile() {
+        std::string best;
+        uint64_t bestReclaimable = 0;
+        for (auto &i : _files) {
+            const Entry &entry = i.second;
+            if (!isEligible(entry) || entry.fileSize == 0 || entry.spaceUsed > entry.fileSize)
+                continue;
+            uint64_t reclaimable = entry.fileSize - entry.spaceUsed;
+            if (reclaimable >= _options.minReclaimableBytes
+                    && reclaimable >= _options.minFragmentation * entry.fileSize
+                    && reclaimable > bestReclaimable) {
+                best = i.first;
+                bestReclaimable = reclaimable;
+            }
+        }
+        return best;
+    }
+
+
+    void CompactionScheduler::compactFile(const std::string &path) {
+        Database::config config;
+        if (!claim(path, config))
+            return;
+        try {
+            Database db(path, config);
+            uint64_t fileSize, spaceUsed;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                db.setCompactionRateLimit(_stopping ? 0 : _options.maxBytesPerSec);
+                Entry &entry = _files[path];
+                entry.compactingDB = &db;
+                fileSize = entry.fileSize;
+                spaceUsed = entry.spaceUsed;
+            }
+            Log("CompactionScheduler: Compacting %s (%llu of %llu bytes unused)", path.c_str(),
+                (unsigned long long)(fileSize - spaceUsed), (unsigned long long)fileSize);
+            try {
+                db.compact();
+            } catch (const std::exception &x) {
+                Warn("CompactionScheduler: Compacting %s failed: %s", path.c_str(), x.what());
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _files[path].compactingDB = nullptr;    // before `db` is destructed
+        } catch (const std::exception &x) {
+            Warn("CompactionScheduler: Couldn't open %s: %s", path.c_str(), x.what());
+        }
+        unclaim(path);
+    }
+
+}
@@ -0,0 +1,105 @@
+//
+//  CompactionScheduler.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__CompactionScheduler__
+#define __CBForest__CompactionScheduler__
+#include "Database.hh"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace cbforest {
+
+    /** A process-wide background thread that compacts database files once enough of them is
+        garbage. Open files are registered with addFile (the C API registers every database
+        and view index it opens.) Periodically the scheduler checks each file's fragmentation,
+        then compacts the one with the most reclaimable space, throttling the compaction's I/O
+        so foreground operations aren't starved; then it checks again.
+        The scheduler uses its own Database handle on each file. Files opened in ForestDB's
+        auto-compaction mode, or read-only, are left alone. */
+    class CompactionScheduler {
+    public:
+        struct Options {
+            double minFragmentation {0.5};      // min fraction of the file that's unused
+            uint64_t minReclaimableBytes {1024*1024};   // min bytes compaction would free
+            uint64_t maxBytesPerSec {0};        // I/O rate limit while compacting; 0 = none
+            unsigned intervalSecs {60};         // how often to check the files
+        };
+
+        struct FileStatus {
+            std::string path;
+            uint64_t fileSize;                  // as of the last check
+            uint64_t spaceUsed;                 // as of the last check
+            bool compacting;
+            double progress;                    // fraction of the file compacted so far
+        };
+
+        static CompactionScheduler& shared();
+
+        /** Registers an open file. Calls are counted, so every call must be balanced by a call
+            to removeFile. The config of the first registration is the one used. */
+        void addFile(const std::string &path, const Database::config&);
+
+        /** Unregisters a file. If this was the last registration and the scheduler has the file
+            open, waits for it to finish (lifting the rate limit if it's compacting), so the file
+            can then be deleted. */
+        void removeFile(const std::string &path);
+
+        /** Updates the config used to open a registered file, e.g. after it's been rekeyed. */
+        void setConfig(const std::string &path, const Database::config&);
+
+        void start(const Options&);
+        void stop();
+        bool running();
+
+        /** Makes the scheduler check the files now instead of at its next interval. */
+        void wake();
+
+        /** The status of a registered file. Returns false if it's not registered. */
+        bool getStatus(const std::string &path, FileStatus &outStatus);
+
+    private:
+        struct Entry {
+            Database::config config;
+            unsigned refCount {0};
+            uint64_t fileSize {0}, spaceUsed {0};
+            bool inUse {false};                 // does the scheduler have it open?
+            Database *compactingDB {nullptr};   // the handle compacting it, if any
+        };
+
+        CompactionScheduler() { }
+        void run();
+        bool isEligible(const Entry&) const;
+        bool claim(const std::string &path, Database::config&);
+        void unclaim(const std::string &path);
+        void measure(const std::string &path);
+        std::string pickFile();
+        void compactFile(const std::string &path);
+
+        std::mutex _mutex;                      // guards everything below
+        std::condition_variable _cond;          // wakes the thread
+        std::condition_variable _doneCond;      // signaled when a file is unclaimed
+        std::unordered_map<std::string, Entry> _files;
+        Options _options;
+        std::thread _thread;
+        bool _running {false};
+        bool _stopping {false};
+        bool _wake {false};
+    };
+
+}
+
+#endif /* defined(__CBForest__CompactionScheduler__) */
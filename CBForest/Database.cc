@@ -14,19 +14,25 @@
 //  and limitations under the License.
 
 #include "Database.hh"
+#include "BloomFilter.hh"
 #include "Document.hh"
+#include "DocCache.hh"
+#include "FileSyncer.hh"
+#include "MemoryBudget.hh"
 #include "LogInternal.hh"
+#include "LogQueue.hh"
 #include "atomic.h"           // forestdb internal
 #include "time_utils.h"       // forestdb internal
 #include <errno.h>
 #include <stdarg.h>           // va_start, va_end
 #include <stdio.h>
+#include <stdlib.h>
 #include <mutex>              // std::mutex, std::unique_lock
 #include <condition_variable> // std::condition_variable
 #include <unordered_map>
-#ifdef _MSC_VER
-#include "asprintf.h"
-#elif __ANDROID__
+#include <algorithm>
+#include <thread>
+#ifdef __ANDROID__
 #include <android/log.h>
 #endif
 
@@ -47,13 +53,32 @@ namespace cbforest {
     void (*LogCallback)(logLevel, const char *message) = &defaultLogCallback;
 
     void _Log(logLevel level, const char *message, ...) noexcept {
-        if (LogLevel <= level && LogCallback != NULL) {
+        auto callback = LogCallback;
+        if (LogLevel <= level && callback != NULL) {
             va_list args;
             va_start(args, message);
-            char *formatted = NULL;
-            vasprintf(&formatted, message, args);
+            LogQueue &queue = LogQueue::shared();
+            if (queue.running()) {
+                queue.post(level, message, args);
+            } else {
+                // Format into a stack buffer, falling back to the heap for long messages:
+                va_list args2;
+                va_copy(args2, args);
+                char buffer[256];
+                int len = vsnprintf(buffer, sizeof(buffer), message, args);
+                if (len < (int)sizeof(buffer)) {
+                    callback(level, buffer);
+                } else if (len > 0) {
+                    char *formatted = (char*)malloc(len + 1);
+                    if (formatted) {
+                        vsnprintf(formatted, len + 1, message, args2);
+                        callback(level, formatted);
+                        free(formatted);
+                    }
+                }
+                va_end(args2);
+            }
             va_end(args);
-            LogCallback(level, formatted);
         }
     }
 
@@ -68,6 +93,15 @@ namespace cbforest {
         std::mutex _transactionMutex;
         std::condition_variable _transactionCond;
         Transaction* _transaction {NULL};
+        DatabaseStats _stats;
+        DocCache _docCache {_stats};
+        std::atomic<unsigned> _syncIntervalMs {0};    // for kDurabilityPeriodicSync
+
+        KeyFilter* keyFilter(const std::string &storeName);
+        std::vector<std::pair<std::string, KeyFilter*>> keyFilters();
+        size_t keyFilterBytes();
+        std::unordered_map<std::string, std::unique_ptr<KeyFilter>> _keyFilters; // "" is default
+        std::mutex _keyFiltersMutex;
 
         static std::unordered_map<std::string, File*> sFileMap;
         static std::mutex sMutex;
@@ -86,6 +120,32 @@ namespace cbforest {
         return file;
     }
 
+    // Key filters are never removed, since KeyStores point to them.
+    KeyFilter* Database::File::keyFilter(const std::string &storeName) {
+        std::lock_guard<std::mutex> lock(_keyFiltersMutex);
+        auto &filter = _keyFilters[storeName];
+        if (!filter)
+            filter.reset(new KeyFilter);
+        return filter.get();
+    }
+
+    std::vector<std::pair<std::string, KeyFilter*>> Database::File::keyFilters() {
+        std::lock_guard<std::mutex> lock(_keyFiltersMutex);
+        std::vector<std::pair<std::string, KeyFilter*>> result;
+        for (auto &i : _keyFilters)
+            result.push_back({i.first, i.second.get()});
+        return result;
+    }
+
+
+    size_t Database::File::keyFilterBytes() {
+        std::lock_guard<std::mutex> lock(_keyFiltersMutex);
+        size_t total = 0;
+        for (auto &i : _keyFilters)
+            total += i.second->sizeInBytes();
+        return total;
+    }
+
 
 #pragma mark - DATABASE:
 
@@ -103,22 +163,37 @@ namespace cbforest {
             // the ForestDB header says.) A value of >0 makes them stick around until the next
             // compaction.
             sDefaultConfig.purging_interval = 1;
-            sDefaultConfig.compaction_cb_mask = FDB_CS_BEGIN | FDB_CS_COMPLETE;
+            sDefaultConfig.compaction_cb_mask = FDB_CS_BEGIN | FDB_CS_BATCH_MOVE
+                                              | FDB_CS_FLUSH_WAL | FDB_CS_COMPLETE;
             sDefaultConfigInitialized = true;
         }
         return sDefaultConfig;
     }
 
+    void Database::setDurability(config &cfg, Durability durability) {
+        if (durability == kDurabilityFull) {
+            cfg.durability_opt = FDB_DRB_NONE;      // "none" meaning no special treatment
+        } else {
+            // Commits write their WAL entries and header without fsync, leaving the WAL to be
+            // flushed to the main index when it reaches its threshold:
+            cfg.durability_opt = FDB_DRB_ASYNC;
+            cfg.wal_flush_before_commit = false;
+        }
+    }
+
     void Database::setDefaultConfig(const Database::config &cfg) {
         check(fdb_init((fdb_config*)&cfg));
         sDefaultConfig = cfg;
     }
 
     Database::Database(std::string path, const config& cfg)
-    :KeyStore(NULL),
+    :KeyStore(NULL, NULL),
      _file(File::forPath(path)),
      _config(cfg)
     {
+        _stats = &_file->_stats;
+        _docCache = &_file->_docCache;
+        _keyFilter = _file->keyFilter("");
         _config.compaction_cb = compactionCallback;
         _config.compaction_cb_ctx = this;
         reopen();
@@ -128,8 +203,10 @@ namespace cbforest {
         Debug("Database: deleting (~Database)");
         CBFAssert(!_inTransaction);
         if (_fileHandle) {
+            syncIfPending();
             ::fdb_close(_fileHandle);
             // FYI: fdb_close will automatically close _handle as well.
+            MemoryBudget::shared().removeFile(_file->_path);
         }
     }
 
@@ -164,7 +241,9 @@ namespace cbforest {
                 i->second->_handle = handle;
                 return *i->second;
             } else {
-                auto store = new KeyStore(handle);
+                auto store = new KeyStore(handle, _stats);
+                store->_docCache = _docCache;
+                store->_keyFilter = _file->keyFilter(name);
                 const_cast<Database*>(this)->_keyStores[name].reset(store);
                 store->enableErrorLogs(true);
                 return *store;
@@ -237,8 +316,11 @@ namespace cbforest {
 
 
     void Database::close() {
-        if (_fileHandle)
+        if (_fileHandle) {
+            syncIfPending();
             check(::fdb_close(_fileHandle));
+            MemoryBudget::shared().removeFile(_file->_path);
+        }
         _fileHandle = NULL;
         // fdb_close implicitly closes all the kv handles, so null them out:
         _handle = NULL;
@@ -253,6 +335,9 @@ namespace cbforest {
         check(::fdb_open(&_fileHandle, cpath, &_config));
         check(::fdb_kvs_open_default(_fileHandle, &_handle, NULL));
         enableErrorLogs(true);
+        File *file = _file;
+        MemoryBudget::shared().addFile(file->_path, _config, file->_stats, file->_docCache,
+                                       [file]{return file->keyFilterBytes();});
     }
 
     void Database::deleteDatabase() {
@@ -267,11 +352,16 @@ namespace cbforest {
 
     /*static*/ void Database::deleteDatabase(std::string path, const config &cfg) {
         check(fdb_destroy(path.c_str(), (config*)&cfg));
+        File *file = File::forPath(path);
+        file->_docCache.clear();
+        for (auto &i : file->keyFilters())
+            i.second->disable();
     }
 
     void Database::rekey(const fdb_encryption_key &encryptionKey) {
         check(fdb_rekey(_fileHandle, encryptionKey));
         _config.encryption_key = encryptionKey;
+        _file->_docCache.clear();           // rekeying rewrites the file, changing doc offsets
     }
 
 
@@ -281,8 +371,11 @@ namespace cbforest {
         if (!isOpen())
             error::_throw(FDB_RESULT_INVALID_HANDLE);
         std::unique_lock<std::mutex> lock(_file->_transactionMutex);
-        while (_file->_transaction != NULL)
-            _file->_transactionCond.wait(lock);
+        if (_file->_transaction != NULL) {
+            LatencyTimer waitTimer(_stats->transactionWait);
+            while (_file->_transaction != NULL)
+                _file->_transactionCond.wait(lock);
+        }
 
         _file->_transaction = t;
         _inTransaction = true;
@@ -296,7 +389,31 @@ namespace cbforest {
     void Database::commitTransaction(Transaction* t) {
         Log("Database: commit transaction");
         CBFAssert(_file->_transaction == t);
+        LatencyTimer commitTimer(_stats->commit);
         check(fdb_end_transaction(_fileHandle, FDB_COMMIT_NORMAL));
+        if (_config.durability_opt & FDB_DRB_ASYNC) {
+            unsigned syncInterval = _file->_syncIntervalMs;
+            if (syncInterval > 0)
+                FileSyncer::shared().schedule(getInfo().filename, syncInterval, *_stats);
+        }
+    }
+
+    void Database::setSyncInterval(unsigned ms) {
+        _file->_syncIntervalMs = ms;
+    }
+
+    unsigned Database::syncInterval() const {
+        return _file->_syncIntervalMs;
+    }
+
+    // Before closing, performs any sync the FileSyncer has scheduled, rather than leave it
+    // for later. Doesn't throw.
+    void Database::syncIfPending() {
+        if (_config.durability_opt & FDB_DRB_ASYNC) {
+            fdb_file_info info;
+            if (fdb_get_file_info(_fileHandle, &info) == FDB_RESULT_SUCCESS)
+                FileSyncer::shared().syncNow(info.filename);
+        }
     }
 
     void Database::abortTransaction(Transaction* t) {
@@ -306,6 +423,7 @@ namespace cbforest {
     }
 
     void Database::endTransaction(Transaction* t) {
+        rebuildKeyFilters();      // while other writers are still locked out
         std::unique_lock<std::mutex> lock(_file->_transactionMutex);
         CBFAssert(_file->_transaction == t);
         _file->_transaction = NULL;
@@ -314,6 +432,34 @@ namespace cbforest {
     }
 
 
+    void Database::setKeyFilterEnabled(std::string storeName, bool enabled) {
+        KeyFilter *filter = _file->keyFilter(storeName);
+        if (enabled) {
+            Transaction t(this, false);  // fake transaction -- keeps others from writing keys
+            filter->rebuild(getKeyStore(storeName));
+        } else {
+            filter->disable();
+        }
+    }
+
+    // Rebuilds the key filters that need it. Must be called while this Database holds the
+    // file's transaction, so that no keys can be written during the scan.
+    void Database::rebuildKeyFilters() {
+        for (auto &i : _file->keyFilters()) {
+            KeyFilter *filter = i.second;
+            if (filter->needsRebuild()) {
+                try {
+                    filter->rebuild(getKeyStore(i.first));
+                } catch (const std::exception &x) {
+                    Warn("Database: couldn't rebuild key filter of '%s' (%s); disabling it",
+                         i.first.c_str(), x.what());
+                    filter->disable();
+                }
+            }
+        }
+    }
+
+
     Transaction::Transaction(Database* db)
     :Transaction(db, true)
     { }
@@ -363,7 +509,9 @@ namespace cbforest {
     static atomic_uint32_t sCompactCount;
 
     void Database::compact() {
+        _compactionFileSize = getInfo().file_size;     // for compactionProgress()
         auto status = fdb_compact(_fileHandle, NULL);
+        _compactionFileSize = 0;
         if (status == FDB_RESULT_FILE_IS_BUSY) {
             // This result means there is already a background auto-compact in progress.
             while (isCompacting())
@@ -397,16 +545,28 @@ namespace cbforest {
     {
         switch (status) {
             case FDB_CS_BEGIN:
+                _compactionOffset = 0;
+                _compactionStart = std::chrono::steady_clock::now();
                 _isCompacting = true;
                 atomic_incr_uint32_t(&sCompactCount);
                 Log("Database %p COMPACTING...", this);
                 break;
             case FDB_CS_COMPLETE:
                 updatePurgeCount();
+                _file->_docCache.clear();   // cached entries refer to offsets in the old file
+                for (auto &i : _file->keyFilters())
+                    i.second->setNeedsRebuild();    // to drop the keys of purged docs
+                DatabaseStats::add(_stats->compactions);
                 _isCompacting = false;
                 atomic_decr_uint32_t(&sCompactCount);
                 Log("Database %p END COMPACTING", this);
                 break;
+            case FDB_CS_BATCH_MOVE:
+            case FDB_CS_FLUSH_WAL:
+                if (last_oldfile_offset > _compactionOffset)
+                    _compactionOffset = last_oldfile_offset;
+                throttleCompaction();
+                return true;
             default:
                 return true; // skip the onCompactCallback
         }
@@ -415,6 +575,31 @@ namespace cbforest {
         return true;
     }
 
+    // Sleeps until the compaction's average read rate is back under _compactionRateLimit.
+    // Sleeps in short intervals so that lifting the limit takes effect quickly.
+    void Database::throttleCompaction() {
+        static const auto kMaxSleep = std::chrono::milliseconds(100);
+        for (;;) {
+            uint64_t limit = _compactionRateLimit;
+            if (limit == 0)
+                return;
+            auto due = _compactionStart + std::chrono::microseconds(
+                                        (uint64_t)(_compactionOffset * 1.0e6 / limit));
+            auto now = std::chrono::steady_clock::now();
+            if (due <= now)
+                return;
+            std::this_thread::sleep_for(std::min(std::chrono::steady_clock::duration(due - now),
+                                                 std::chrono::steady_clock::duration(kMaxSleep)));
+        }
+    }
+
+    double Database::compactionProgress() const {
+        uint64_t fileSize = _compactionFileSize;
+        if (!_isCompacting || fileSize == 0)
+            return 0.0;
+        return std::min(1.0, (double)_compactionOffset / fileSize);
+    }
+
     bool Database::isAnyCompacting() {
         return atomic_get_uint32_t(&sCompactCount) > 0;
     }
@@ -19,6 +19,7 @@
 #include <vector>
 #include <unordered_map>
 #include <atomic> // for std::atomic_uint
+#include <chrono>
 #ifdef check
 #undef check
 #endif
@@ -50,6 +51,18 @@ namespace cbforest {
         static config defaultConfig();
         static void setDefaultConfig(const config&);
 
+        /** How durable a commit is when it returns. */
+        enum Durability {
+            kDurabilityFull,            // Commits are fsync'ed (the default)
+            kDurabilityPeriodicSync,    // Commits aren't fsync'ed, but a FileSyncer syncs the
+                                        //   file within its sync interval after a commit
+            kDurabilityNoSync,          // Commits aren't fsync'ed; the OS writes them eventually
+        };
+
+        /** Configures a config for a durability level. (kDurabilityPeriodicSync and
+            kDurabilityNoSync configure it the same; the difference is the sync interval.) */
+        static void setDurability(config&, Durability);
+
         Database(std::string path, const config&);
         Database(Database* original, sequence snapshotSequence);
         virtual ~Database();
@@ -83,6 +96,15 @@ namespace cbforest {
         static bool isAnyCompacting();
         void setCompactionMode(fdb_compaction_mode_t);
 
+        /** Limits the rate at which this handle's compactions read the old file, by sleeping
+            between batches of moved documents. 0 (the default) means unlimited. Can be called
+            from another thread while compacting, e.g. to lift the limit. */
+        void setCompactionRateLimit(uint64_t bytesPerSec)   {_compactionRateLimit = bytesPerSec;}
+
+        /** Approximate fraction [0..1] of the old file that this handle's current compaction has
+            copied, or 0 if it isn't compacting. Only known for compactions started by compact(). */
+        double compactionProgress() const;
+
         typedef void (*OnCompactCallback)(void *context, bool compacting);
 
         void setOnCompact(OnCompactCallback callback, void *context) {
@@ -92,6 +114,19 @@ namespace cbforest {
 
         void rekey(const fdb_encryption_key&);
 
+        /** With kDurabilityPeriodicSync, sets how long after a commit the file is synced.
+            0 (the default) means never, i.e. kDurabilityNoSync. Applies to all Database
+            instances on the file. Has no effect with kDurabilityFull. */
+        void setSyncInterval(unsigned ms);
+        unsigned syncInterval() const;
+        static const unsigned kDefaultSyncInterval = 1000;
+
+        /** Enables or disables the Bloom filter of a KeyStore's keys (see KeyFilter), which
+            makes lookups of nonexistent keys cheaper. It's shared by all Database instances on
+            the file. Enabling it scans the KeyStore's keys, blocking transactions meanwhile.
+            The store name "" is the default KeyStore. Must not be called in a transaction. */
+        void setKeyFilterEnabled(std::string storeName, bool enabled);
+
         /** The Database's default key-value store. (You can also just use the Database
             instance directly as a KeyStore since it inherits from it.) */
         const KeyStore& defaultKeyStore() const {return *this;}
@@ -113,6 +148,8 @@ namespace cbforest {
         void commitTransaction(Transaction*);
         void abortTransaction(Transaction*);
         void endTransaction(Transaction*);
+        void rebuildKeyFilters();
+        void syncIfPending();
 
         Database(const Database&) = delete;
         Database& operator=(const Database&) = delete;
@@ -131,6 +168,7 @@ namespace cbforest {
                        fdb_doc *doc,
                        uint64_t lastOldFileOffset,
                        uint64_t lastNewFileOffset);
+        void throttleCompaction();
 
         File* _file;
         config _config;
@@ -138,6 +176,10 @@ namespace cbforest {
         std::unordered_map<std::string, std::unique_ptr<KeyStore> > _keyStores;
         bool _inTransaction {false};
         bool _isCompacting {false};
+        std::atomic<uint64_t> _compactionRateLimit {0};     // bytes/sec, or 0
+        std::atomic<uint64_t> _compactionFileSize {0};      // old file's size, if known
+        std::atomic<uint64_t> _compactionOffset {0};        // last_oldfile_offset reported
+        std::chrono::steady_clock::time_point _compactionStart;
         OnCompactCallback _onCompactCallback {nullptr};
         void  *_onCompactContext {nullptr};
     };
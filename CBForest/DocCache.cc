@@ -0,0 +1,174 @@
+//
+//  DocCache.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "DocCache.hh"
+#include <string.h>
+
+
+namespace cbforest {
+
+    // Approximate memory used by an Item, its list node and its hash table entry, besides the
+    // key and the Entry's data:
+    static const size_t kItemOverhead = 128;
+
+    static const char kRevTreeTag = 't', kOldBodyTag = 'b';
+
+
+    static std::string revTreeKey(slice docID) {
+        std::string key(1, kRevTreeTag);
+        key.append((const char*)docID.buf, docID.size);
+        return key;
+    }
+
+    static std::string oldBodyKey(uint64_t offset, cbforest::sequence seq, slice revID) {
+        std::string key(1, kOldBodyTag);
+        key.append((const char*)&offset, sizeof(offset));
+        key.append((const char*)&seq, sizeof(seq));
+        key.append((const char*)revID.buf, revID.size);
+        return key;
+    }
+
+
+    void DocCache::setCapacity(size_t bytes) {
+        _capacity.store(bytes, std::memory_order_relaxed);
+        for (auto &shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            trim(shard, bytes / kShards);
+        }
+    }
+
+    size_t DocCache::size() const {
+        size_t total = 0;
+        for (auto &shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.size;
+        }
+        return total;
+    }
+
+    void DocCache::trimTo(size_t bytes) {
+        for (auto &shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            trim(shard, bytes / kShards);
+        }
+    }
+
+    DocCache::Shard& DocCache::shardFor(const std::string &key) {
+        return _shards[std::hash<std::string>()(key) % kShards];
+    }
+
+
+    DocCache::EntryRef DocCache::get(const std::string &key,
+                                     cbforest::sequence seq, uint64_t offset)
+    {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto i = shard.index.find(key);
+        if (i == shard.index.end() || i->second->entry->sequence != seq
+                                   || i->second->entry->offset != offset) {
+            DatabaseStats::add(_stats.docCacheMisses);
+            return EntryRef();
+        }
+        shard.items.splice(shard.items.begin(), shard.items, i->second);   // move to front
+        DatabaseStats::add(_stats.docCacheHits);
+        return i->second->entry;
+    }
+
+    void DocCache::put(std::string &&key, EntryRef entry) {
+        size_t maxSize = capacity() / kShards;
+        size_t cost = kItemOverhead + 2 * key.size() + entry->body.size
+                        + entry->revs.size() * sizeof(Revision);
+        if (cost > maxSize)
+            return;
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto i = shard.index.find(key);
+        if (i != shard.index.end()) {
+            shard.size -= i->second->cost;
+            shard.items.erase(i->second);
+            shard.index.erase(i);
+        }
+        shard.items.push_front({key, entry, cost});
+        shard.index[std::move(key)] = shard.items.begin();
+        shard.size += cost;
+        trim(shard, maxSize);
+    }
+
+    void DocCache::remove(const std::string &key) {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto i = shard.index.find(key);
+        if (i != shard.index.end()) {
+            shard.size -= i->second->cost;
+            shard.items.erase(i->second);
+            shard.index.erase(i);
+        }
+    }
+
+    // Evicts least recently used items until the shard fits in maxSize. Caller must lock it.
+    void DocCache::trim(Shard &shard, size_t maxSize) {
+        while (shard.size > maxSize) {
+            Item &item = shard.items.back();
+            shard.size -= item.cost;
+            shard.index.erase(item.key);
+            shard.items.pop_back();
+        }
+    }
+
+    void DocCache::clear() {
+        for (auto &shard : _shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.items.clear();
+            shard.index.clear();
+            shard.size = 0;
+        }
+    }
+
+
+    DocCache::EntryRef DocCache::getRevTree(slice docID, cbforest::sequence seq, uint64_t offset) {
+        if (!enabled())
+            return EntryRef();
+        return get(revTreeKey(docID), seq, offset);
+    }
+
+    void DocCache::putRevTree(slice docID, EntryRef entry) {
+        if (enabled())
+            put(revTreeKey(docID), entry);
+    }
+
+    void DocCache::removeRevTree(slice docID) {
+        if (enabled())
+            remove(revTreeKey(docID));
+    }
+
+    alloc_slice DocCache::getOldBody(uint64_t offset, cbforest::sequence seq, slice revID) {
+        if (!enabled())
+            return alloc_slice();
+        EntryRef entry = get(oldBodyKey(offset, seq, revID), seq, offset);
+        return entry ? entry->body : alloc_slice();
+    }
+
+    void DocCache::putOldBody(uint64_t offset, cbforest::sequence seq, slice revID,
+                              alloc_slice body)
+    {
+        if (!enabled())
+            return;
+        auto entry = std::make_shared<Entry>();
+        entry->body = body;
+        entry->sequence = seq;
+        entry->offset = offset;
+        put(oldBodyKey(offset, seq, revID), entry);
+    }
+
+}
@@ -0,0 +1,108 @@
+//
+//  DocCache.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__DocCache__
+#define __CBForest__DocCache__
+#include "RevTree.hh"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace cbforest {
+
+    /** A size-bounded LRU cache of decoded revision trees, and of old revision bodies, for one
+        database file. It's shared by all Database instances (and threads) using the file, and
+        is split into independently locked shards so they don't contend.
+        Entries are tagged with the sequence and file offset of the document they came from, and
+        a lookup only succeeds if those match, so a stale entry can never be returned; entries
+        are removed when a document is saved only to free the space sooner.
+        The capacity starts at 0, which disables the cache. */
+    class DocCache {
+    public:
+        /** A cached item: a decoded rev tree, or a single revision body. */
+        struct Entry {
+            alloc_slice body;               // encoded rev tree (which `revs` point into), or a body
+            std::vector<Revision> revs;     // decoded revisions, with NULL owners; empty for a body
+            cbforest::sequence sequence;    // sequence of the document it was read from
+            uint64_t offset;                // file offset of the document it was read from
+        };
+        typedef std::shared_ptr<const Entry> EntryRef;
+
+        explicit DocCache(DatabaseStats &stats)     :_stats(stats) { }
+
+        /** Sets the maximum number of bytes the cache may use. 0 disables it, and empties it. */
+        void setCapacity(size_t bytes);
+        size_t capacity() const             {return _capacity.load(std::memory_order_relaxed);}
+        bool enabled() const                {return capacity() > 0;}
+
+        /** Records that documents are read through the cache (whether or not it's enabled.)
+            Returns true the first time it's called. Files that only hold indexes never call it,
+            and don't get a share of a MemoryBudget. */
+        bool noteUsed()                     {return !_used.exchange(true);}
+        bool used() const                   {return _used.load(std::memory_order_relaxed);}
+
+        /** The number of bytes currently used, including bookkeeping overhead. */
+        size_t size() const;
+
+        /** Evicts least recently used entries until at most `bytes` are used, without changing
+            the capacity. */
+        void trimTo(size_t bytes);
+
+        /** Returns the rev tree of a document, if cached from the same sequence and offset. */
+        EntryRef getRevTree(slice docID, cbforest::sequence, uint64_t offset);
+        void putRevTree(slice docID, EntryRef);
+        void removeRevTree(slice docID);
+
+        /** Returns the body of a non-current revision, as stored in the document at `offset`. */
+        alloc_slice getOldBody(uint64_t offset, cbforest::sequence, slice revID);
+        void putOldBody(uint64_t offset, cbforest::sequence, slice revID, alloc_slice body);
+
+        /** Removes everything. Called when the file's offsets become invalid, i.e. after it's
+            compacted or deleted. */
+        void clear();
+
+        static const unsigned kShards = 16;
+
+    private:
+        struct Item {
+            std::string key;
+            EntryRef entry;
+            size_t cost;
+        };
+        struct Shard {
+            mutable std::mutex mutex;
+            std::list<Item> items;          // most recently used first
+            std::unordered_map<std::string, std::list<Item>::iterator> index;
+            size_t size {0};
+        };
+
+        Shard& shardFor(const std::string &key);
+        EntryRef get(const std::string &key, cbforest::sequence, uint64_t offset);
+        void put(std::string &&key, EntryRef);
+        void remove(const std::string &key);
+        static void trim(Shard&, size_t maxSize);
+
+        DatabaseStats &_stats;
+        std::atomic<size_t> _capacity {0};
+        std::atomic<bool> _used {false};
+        Shard _shards[kShards];
+    };
+
+}
+
+#endif /* defined(__CBForest__DocCache__) */
@@ -222,6 +222,7 @@ namespace cbforest {
         if (status != FDB_RESULT_KEY_NOT_FOUND)
             check(status);
         Debug("enum:     fdb_get --> [%s]", _doc.key().hexCString());
+        countStep();
         return true;
     }
 
@@ -242,6 +243,25 @@ namespace cbforest {
         }
     }
 
+    void DocEnumerator::seekPast(slice key) {
+        seek(key);
+        if (!_iterator)
+            return;
+        // If the seek landed on the key itself, step over it:
+        Document checkDoc;
+        fdb_doc* docP = (fdb_doc*)checkDoc;
+        if (fdb_iterator_get_metaonly(_iterator, &docP) == FDB_RESULT_SUCCESS
+                && checkDoc.key() == key) {
+            fdb_status status = _options.descending ? fdb_iterator_prev(_iterator)
+                                                    : fdb_iterator_next(_iterator);
+            if (status == FDB_RESULT_ITERATOR_FAIL) {
+                close();
+            } else {
+                check(status);
+            }
+        }
+    }
+
     bool DocEnumerator::getDoc() {
         freeDoc();
         fdb_status status;
@@ -284,10 +304,17 @@ namespace cbforest {
             }
         }
 #endif
-        
+
+        countStep();
         return true;
     }
 
+    void DocEnumerator::countStep() {
+        DatabaseStats &stats = _store->stats();
+        DatabaseStats::add(stats.iteratorSteps);
+        DatabaseStats::add(stats.bytesRead, _doc.meta().size + _doc.body().size);
+    }
+
     void DocEnumerator::freeDoc() {
         _doc.clearMetaAndBody();
         _doc.setKey(slice::null);
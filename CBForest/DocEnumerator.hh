@@ -71,6 +71,11 @@ namespace cbforest {
             You must call next() before accessing the document! */
         void seek(slice key);
 
+        /** Repositions the enumerator just after a specific key, whether or not it exists, so
+            an enumeration can be resumed after the last key it returned.
+            You must call next() before accessing the document! */
+        void seekPast(slice key);
+
         void close();
 
         const Document& doc() const         {return _doc;}
@@ -78,6 +83,10 @@ namespace cbforest {
         /** Rvalue reference to document, allowing it to be moved (which will clear this copy) */
         Document&& moveDoc()                {return std::move(_doc);}
 
+        /** Exchanges the current document with `doc`, without copying. The enumerator frees
+            whatever it's given back when it moves to the next document. */
+        void swapDoc(Document &doc)         {_doc.swap(doc);}
+
         // Can treat an enumerator as a document pointer:
         operator const Document*() const    {return _doc.key().buf ? &_doc : NULL;}
         const Document* operator->() const  {return _doc.key().buf ? &_doc : NULL;}
@@ -106,6 +115,7 @@ namespace cbforest {
         void initialPosition();
         bool nextFromArray();
         bool getDoc();
+        void countStep();
     };
 
 }
@@ -43,6 +43,9 @@ namespace cbforest {
 
         void clearMetaAndBody();
 
+        /** Exchanges contents with another Document, without copying. */
+        void swap(Document &other)          {std::swap(_doc, other._doc);}
+
         cbforest::sequence sequence() const {return _doc.seqnum;}
         uint64_t offset() const     {return _doc.offset;}
         size_t sizeOnDisk() const   {return _doc.size_ondisk;}
@@ -0,0 +1,153 @@
+//
+//  FileSyncer.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "FileSyncer.hh"
+#include "Error.hh"
+#include "LogInternal.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace cbforest {
+
+    FileSyncer& FileSyncer::shared() {
+        // Never destroyed, since Databases may still be committing during process exit;
+        // instead an atexit handler performs whatever syncs are pending.
+        static FileSyncer* sSyncer = [] {
+            auto syncer = new FileSyncer;
+            atexit([] {FileSyncer::shared().stop();});
+            return syncer;
+        }();
+        return *sSyncer;
+    }
+
+
+    void FileSyncer::schedule(const std::string &path, unsigned delayMs, DatabaseStats &stats) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.find(path) != _pending.end())
+            return;
+        _pending[path] = {clock::now() + std::chrono::milliseconds(delayMs), &stats};
+        if (!_running && !_stopping) {
+            _running = true;
+            _thread = std::thread([this]{run();});
+        }
+        _cond.notify_one();
+    }
+
+
+    void FileSyncer::syncNow(const std::string &path) {
+        DatabaseStats *stats;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto i = _pending.find(path);
+            if (i == _pending.end())
+                return;
+            stats = i->second.stats;
+            _pending.erase(i);
+        }
+        perform(path, stats);
+    }
+
+
+    void FileSyncer::stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+            _cond.notify_one();
+        }
+        if (_thread.joinable())
+            _thread.join();
+        // Perform anything scheduled after the thread exited:
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_pending.empty()) {
+            auto i = _pending.begin();
+            std::string path = i->first;
+            DatabaseStats *stats = i->second.stats;
+            _pending.erase(i);
+            lock.unlock();
+            perform(path, stats);
+            lock.lock();
+        }
+        _running = false;
+        _stopping = false;
+    }
+
+
+    void FileSyncer::run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopping) {
+            // Find the next sync that's due:
+            auto next = _pending.end();
+            for (auto i = _pending.begin(); i != _pending.end(); ++i)
+                if (next == _pending.end() || i->second.due < next->second.due)
+                    next = i;
+            if (next == _pending.end()) {
+                _cond.wait(lock);
+            } else if (next->second.due > clock::now()) {
+                _cond.wait_until(lock, next->second.due);
+            } else {
+                std::string path = next->first;
+                DatabaseStats *stats = next->second.stats;
+                _pending.erase(next);
+                lock.unlock();
+                perform(path, stats);
+                lock.lock();
+            }
+        }
+    }
+
+
+    void FileSyncer::perform(const std::string &path, DatabaseStats *stats) {
+        try {
+            LatencyTimer timer(stats->fileSync);
+            syncFile(path);
+        } catch (const std::exception &x) {
+            // The file may have been deleted, or replaced by compaction, since the commit:
+            Warn("FileSyncer: Couldn't sync %s: %s", path.c_str(), x.what());
+        }
+    }
+
+
+    /*static*/ void FileSyncer::syncFile(const std::string &path) {
+#ifdef _MSC_VER
+        int fd = ::_open(path.c_str(), _O_RDWR | _O_BINARY);
+        if (fd < 0)
+            error::_throw(FDB_RESULT_OPEN_FAIL);
+        int result = ::_commit(fd);
+        ::_close(fd);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            error::_throw(errno == ENOENT ? FDB_RESULT_NO_SUCH_FILE : FDB_RESULT_OPEN_FAIL);
+#ifdef F_FULLFSYNC
+        // On Apple platforms fsync doesn't flush the drive's cache; this does:
+        int result = ::fcntl(fd, F_FULLFSYNC);
+        if (result < 0)
+            result = ::fsync(fd);
+#else
+        int result = ::fsync(fd);
+#endif
+        ::close(fd);
+#endif
+        if (result < 0)
+            error::_throw(FDB_RESULT_FSYNC_FAIL);
+    }
+
+}
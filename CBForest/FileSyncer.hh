@@ -0,0 +1,72 @@
+//
+//  FileSyncer.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__FileSyncer__
+#define __CBForest__FileSyncer__
+#include "Stats.hh"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+namespace cbforest {
+
+    /** A background thread that fsyncs database files some time after they're committed to.
+        Used for databases opened with kDurabilityPeriodicSync, whose commits don't sync: a
+        commit schedules a sync of the file, unless one is already scheduled, so a committed
+        transaction reaches the disk within the file's sync interval (plus the time the sync
+        itself takes.) */
+    class FileSyncer {
+    public:
+        /** The process-wide syncer. Pending syncs are performed at exit. */
+        static FileSyncer& shared();
+
+        /** Schedules a sync of the file `delayMs` from now, if one isn't scheduled already. */
+        void schedule(const std::string &path, unsigned delayMs, DatabaseStats&);
+
+        /** Syncs the file now, if a sync is scheduled. */
+        void syncNow(const std::string &path);
+
+        /** Performs all scheduled syncs, and stops the thread. The thread is started again by
+            the next schedule() call. */
+        void stop();
+
+        /** Flushes a file's data to the storage device. Throws on failure. */
+        static void syncFile(const std::string &path);
+
+    private:
+        typedef std::chrono::steady_clock clock;
+        struct Pending {
+            clock::time_point due;
+            DatabaseStats *stats;
+        };
+
+        FileSyncer() { }
+        void run();
+        void perform(const std::string &path, DatabaseStats*);
+
+        std::mutex _mutex;                      // guards everything below
+        std::condition_variable _cond;
+        std::map<std::string, Pending> _pending;
+        std::thread _thread;
+        bool _running {false};
+        bool _stopping {false};
+    };
+
+}
+
+#endif /* defined(__CBForest__FileSyncer__) */
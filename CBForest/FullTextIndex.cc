@@ -30,7 +30,7 @@ namespace cbforest {
 
         std::vector<KeyRange> collatableKeys;
         for (TokenIterator i(tokenizer, queryString, true); i; ++i) {
-            tokens.push_back(i.token());
+            tokens.push_back((std::string)i.token());
             collatableKeys.push_back(Collatable(CollatableBuilder(i.token())));
         }
         return collatableKeys;
@@ -56,7 +56,9 @@ namespace cbforest {
         std::vector<unsigned> termTotalCounts(_tokens.size());      // used for ranking
         typedef std::pair<cbforest::sequence, unsigned> RowID;
         std::map<RowID, FullTextMatch*> rows;
-        
+        auto start = QueryProfile::clock::now();
+        uint64_t setupNanos = _e.profile().elapsedNanos;
+
         while (_e.next()) {
             unsigned fullTextID;
             std::vector<size_t> matches = _e.getTextTokenInfo(fullTextID);
@@ -108,6 +110,14 @@ namespace cbforest {
                 return a->_rank > b->_rank;  // sort by _descending_ rank
             });
         }
+
+        // Index rows that didn't make it into a result count as rejected:
+        _profile = _e.profile();
+        _profile.rowsRejected += _profile.rowsReturned - std::min((uint64_t)_results.size(),
+                                                                  _profile.rowsReturned);
+        _profile.rowsReturned = _results.size();
+        _profile.elapsedNanos = setupNanos;
+        _profile.addTimeSince(start);
     }
 
 
@@ -71,6 +71,9 @@ namespace cbforest {
 
         const std::vector<FullTextMatch*>& allMatches()     {return _results;}
 
+        /** The work done by the search, which happens entirely in the constructor. */
+        const QueryProfile& profile() const                 {return _profile;}
+
     private:
         void search();
 
@@ -79,6 +82,7 @@ namespace cbforest {
         bool _ranked;
         std::vector<FullTextMatch*> _results;
         int _curResultIndex;
+        QueryProfile _profile;
 };
 
 }
@@ -16,14 +16,17 @@
 #include "GeoIndex.hh"
 #include "LogInternal.hh"
 #include <math.h>
-#include <set>
 #include <algorithm>
+#include <set>
 
 
 namespace cbforest {
 
     static const unsigned kMaxKeyRanges = 50;
 
+    // Max number of rows GeoNearestEnumerator reads from a cell before subdividing it instead
+    static const unsigned kMaxRowsPerCell = 50;
+
     CollatableBuilder& operator<< (CollatableBuilder &coll, const geohash::area &a) {
         coll << a.longitude.min << a.latitude.min << a.longitude.max << a.latitude.max;
         return coll;
@@ -39,7 +42,7 @@ namespace cbforest {
     }
 
     /** Given a geo area, returns a list of key (geohash) ranges that cover that area. */
-    static std::vector<KeyRange> keyRangesFor(geohash::area a) {
+    static std::vector<KeyRange> geohashKeyRangesFor(geohash::area a) {
         auto hashes = a.coveringHashRanges(kMaxKeyRanges);
         std::vector<KeyRange> ranges;
         for (auto h = hashes.begin(); h != hashes.end(); ++h) {
@@ -66,35 +69,95 @@ namespace cbforest {
         return ranges;
     }
 
+    /** Given a geo area, returns a list of key (Hilbert cell) ranges that cover that area. */
+    static std::vector<KeyRange> hilbertKeyRangesFor(geohash::area a) {
+        auto cellRanges = a.coveringHilbertRanges(kMaxKeyRanges);
+        std::vector<KeyRange> ranges;
+        std::set<std::string> parents;
+        for (auto r = cellRanges.begin(); r != cellRanges.end(); ++r) {
+            Log("GeoIndexEnumerator: query add '%s' ... '%s'",
+                (const char*)r->first, (const char*)r->last);
+            std::string lastPath = std::string(r->last) + "Z"; // include everything inside last
+            ranges.push_back(KeyRange(CollatableBuilder(slice((const char*)r->first)),
+                                      CollatableBuilder(slice(lastPath))));
+
+            // Unlike a geohash range, the cells in a Hilbert range don't necessarily share a
+            // parent, so look for the exact ancestor keys of every cell in the range:
+            for (geohash::hilbertCell c = r->first; !c.isEmpty(); c = c.next()) {
+                std::string parent(c);
+                while (parent.size() > 1) {
+                    parent.resize(parent.size() - 1);
+                    if (!parents.insert(parent).second)
+                        break;      // already added this one, so its ancestors were too
+                }
+                if (c == r->last)
+                    break;
+            }
+        }
+        for (auto p = parents.begin(); p != parents.end(); ++p) {
+            ranges.push_back(KeyRange(CollatableBuilder(slice(*p))));
+            Log("GeoIndexEnumerator: query add '%s'", p->c_str());
+        }
+        return ranges;
+    }
+
+    static std::vector<KeyRange> keyRangesFor(Index *index, geohash::area a) {
+        if (((MapReduceIndex*)index)->geoKeyScheme() == MapReduceIndex::kHilbertKeys)
+            return hilbertKeyRangesFor(a);
+        else
+            return geohashKeyRangesFor(a);
+    }
+
 
     GeoIndexEnumerator::GeoIndexEnumerator(Index *index,
                                            geohash::area searchArea)
     :IndexEnumerator(index,
-                     keyRangesFor(searchArea),
-                     DocEnumerator::Options::kDefault),
+                     keyRangesFor(index, searchArea),
+                     DocEnumerator::Options::kDefault,
+                     false),    // approve() sets the current row's bbox & geoJSON; can't buffer
      _searchArea(searchArea)
     { }
 
 
+    // Identifies an emitted shape, for de-duplication: the docID followed by the geoID. (The
+    // geoID's size is fixed, so no two different pairs have the same ID.)
+    static std::string itemID(slice docID, unsigned geoID) {
+        std::string id((const char*)docID.buf, docID.size);
+        id.append((const char*)&geoID, sizeof(geoID));
+        return id;
+    }
+
+
     bool GeoIndexEnumerator::approve(slice key) {
         // Have we seen this result before?
-        unsigned geoID = (unsigned)CollatableReader(value()).readInt();
-        ItemID item((std::string)docID(), geoID);
-        if (_alreadySeen.find(item) != _alreadySeen.end()) {
+        CollatableReader reader(value());
+        unsigned geoID = (unsigned)reader.readInt();
+        if (!_alreadySeen.insert(itemID(docID(), geoID)).second) {
             _dups++;
             return false;
         }
-        _alreadySeen.insert(item);
 
-        // Read the actual rect and see if it truly intersects the query:
-        ((MapReduceIndex*)index())->readGeoArea(item.first, sequence(), geoID,
-                                                _keyBBox, _geoKey, _geoValue);
+        // Check whether the actual rect intersects the query. Rows written by older versions
+        // don't have the bbox inline, so it has to be read from the special entry:
+        bool loaded = false;
+        if (reader.peekTag() != CollatableReader::kEndSequence) {
+            _keyBBox = ::cbforest::readGeoArea(reader);
+        } else {
+            ((MapReduceIndex*)index())->readGeoArea(docID(), sequence(), geoID,
+                                                    _keyBBox, _geoKey, _geoValue);
+            loaded = true;
+        }
         if (!_keyBBox.intersects(_searchArea)) {
             _misses++;
             return false;
         }
 
-        // OK, it's for reals.
+        // OK, it's for reals. Now load the geoJSON and value:
+        if (!loaded) {
+            geohash::area bbox;
+            ((MapReduceIndex*)index())->readGeoArea(docID(), sequence(), geoID,
+                                                    bbox, _geoKey, _geoValue);
+        }
         setValue(_geoValue);
         _hits++;
         return true;
@@ -107,4 +170,196 @@ namespace cbforest {
     }
 #endif
 
-}
\ No newline at end of file
+
+
+#pragma mark - NEAREST:
+
+
+    // Distance in km from a point to the nearest point of an area. If the point's longitude is
+    // within the area's, that's on the same meridian. Otherwise it's on one of the area's
+    // meridian edges (along a parallel, the nearest point is always at an edge), but not
+    // necessarily at the point's latitude, since great circles bulge toward the poles: it's
+    // where the edge's great circle is nearest the point, if the edge reaches that, else one of
+    // the edge's ends. It has to be exact, since a cell's distance must not exceed that of
+    // anything in it.
+    static double distanceToArea(geohash::coord c, const geohash::area &a) {
+        const double lat0 = a.latitude.min, lat1 = a.latitude.max;
+        if (c.longitude >= a.longitude.min && c.longitude <= a.longitude.max) {
+            double lat = std::min(std::max(c.latitude, lat0), lat1);
+            return c.distanceTo(geohash::coord(lat, c.longitude));
+        }
+        double latRad = c.latitude * M_PI / 180.0;
+        double distance = INFINITY;
+        for (double lon : {a.longitude.min, a.longitude.max}) {
+            double cosDLon = cos((lon - c.longitude) * M_PI / 180.0);
+            double nearestLat = atan2(sin(latRad), cos(latRad) * cosDLon) * 180.0 / M_PI;
+            if (nearestLat > lat0 && nearestLat < lat1)
+                distance = std::min(distance, c.distanceTo(geohash::coord(nearestLat, lon)));
+            distance = std::min(distance, c.distanceTo(geohash::coord(lat0, lon)));
+            distance = std::min(distance, c.distanceTo(geohash::coord(lat1, lon)));
+        }
+        return distance;
+    }
+
+
+    GeoNearestEnumerator::GeoNearestEnumerator(Index *index,
+                                               geohash::coord center,
+                                               unsigned maxResults)
+    :_index((MapReduceIndex*)index),
+     _hilbert(_index->geoKeyScheme() == MapReduceIndex::kHilbertKeys),
+     _center(center),
+     _maxResults(maxResults)
+    {
+        _index->addUser();
+        // Start with a single cell (the empty path) covering the whole world:
+        addCell(std::string());
+    }
+
+    GeoNearestEnumerator::~GeoNearestEnumerator() {
+        close();
+    }
+
+    void GeoNearestEnumerator::close() {
+        if (_index) {
+            Log("GeoNearestEnumerator: %u results, %u cells scanned, %llu rows scanned",
+                _count, _cellsScanned, (unsigned long long)_profile.rowsScanned);
+            _index->removeUser();
+            _index = NULL;
+        }
+    }
+
+
+    bool GeoNearestEnumerator::next() {
+        if (!_index)
+            return false;
+        QueryProfile::Timer timer(_profile);
+        if (_count >= _maxResults) {
+            close();
+            return false;
+        }
+        for (;;) {
+            // The nearest candidate is a result if no unscanned cell could hold anything nearer:
+            if (!_candidates.empty() && (_cells.empty()
+                                         || _candidates.top().distance <= _cells.top().distance)) {
+                _current = _candidates.top();
+                _candidates.pop();
+                geohash::area bbox;
+                _index->readGeoArea(_current.docID, _current.sequence, _current.geoID,
+                                    bbox, _geoKey, _geoValue);
+                ++_count;
+                ++_profile.rowsReturned;
+                return true;
+            }
+            if (_cells.empty()) {
+                close();
+                return false;
+            }
+            cell c = _cells.top();
+            _cells.pop();
+            scanCell(c);
+        }
+    }
+
+
+    void GeoNearestEnumerator::addCell(const std::string &path) {
+        geohash::area a;
+        if (path.empty())
+            a = geohash::area(geohash::range(-90, 90), geohash::range(-180, 180));
+        else if (_hilbert)
+            a = geohash::hilbertCell(path.c_str()).decode();
+        else
+            a = geohash::hash(path.c_str()).decode();
+        _cells.push({path, distanceToArea(_center, a)});
+    }
+
+
+    // The index key of a cell, as emitted by MapReduceIndex for the index's geo key scheme.
+    CollatableBuilder GeoNearestEnumerator::cellKey(const std::string &path) const {
+        if (_hilbert)
+            return CollatableBuilder(slice(path));
+        else
+            return CollatableBuilder(geohash::hash(path.c_str()));
+    }
+
+
+    // Reads the rows whose keys are equal to, or inside, a cell. If there are too many,
+    // keeps only the rows exactly matching the cell, and queues its child cells to be scanned.
+    void GeoNearestEnumerator::scanCell(const cell &c) {
+        ++_cellsScanned;
+        size_t maxDepth = _hilbert ? geohash::hilbertCell::kMaxDepth : geohash::hash::kMaxLength;
+        bool canSubdivide = (c.path.size() < maxDepth);
+
+        CollatableBuilder key = cellKey(c.path);
+        std::vector<KeyRange> ranges;
+        // Append "Z" so the string range includes everything inside the cell:
+        ranges.push_back(KeyRange(key, cellKey(c.path + "Z")));
+
+        // Collect the rows first, since adding candidates may have to read from the index:
+        struct row {
+            alloc_slice docID;
+            cbforest::sequence sequence;
+            alloc_slice value;
+        };
+        std::vector<row> rows;
+        bool subdivide = false;
+        IndexEnumerator e(_index, ranges, DocEnumerator::Options::kDefault);
+        while (e.next()) {
+            if (canSubdivide && rows.size() >= kMaxRowsPerCell) {
+                subdivide = true;
+                break;
+            }
+            rows.push_back({alloc_slice(e.docID()), e.sequence(), alloc_slice(e.value())});
+        }
+        e.close();
+        addScanProfile(e);
+
+        if (subdivide) {
+            // Too many rows; keep only the ones whose key is this exact cell, which sort first:
+            std::vector<KeyRange> exactRange;
+            exactRange.push_back(KeyRange(key));
+            IndexEnumerator exact(_index, exactRange, DocEnumerator::Options::kDefault);
+            rows.clear();
+            while (exact.next()) {
+                rows.push_back({alloc_slice(exact.docID()), exact.sequence(),
+                                alloc_slice(exact.value())});
+            }
+            addScanProfile(exact);
+
+            static const char kBase32Chars[33] = "0123456789bcdefghjkmnpqrstuvwxyz";
+            const char *childChars = _hilbert ? "0123" : kBase32Chars;
+            for (const char *ch = childChars; *ch; ++ch)
+                addCell(c.path + *ch);
+        }
+
+        for (auto r = rows.begin(); r != rows.end(); ++r)
+            addCandidate(r->docID, r->sequence, r->value);
+    }
+
+
+    // Adds a cell scan's counts to the profile. Its rows aren't results yet, and its time is
+    // already being counted by next().
+    void GeoNearestEnumerator::addScanProfile(const IndexEnumerator &e) {
+        QueryProfile p = e.profile();
+        p.rowsReturned = 0;
+        p.elapsedNanos = 0;
+        _profile += p;
+    }
+
+
+    void GeoNearestEnumerator::addCandidate(slice docID, cbforest::sequence seq, slice value) {
+        CollatableReader reader(value);
+        unsigned geoID = (unsigned)reader.readInt();
+        if (!_alreadySeen.insert(itemID(docID, geoID)).second)
+            return;
+        geohash::area bbox;
+        if (reader.peekTag() != CollatableReader::kEndSequence) {
+            bbox = ::cbforest::readGeoArea(reader);
+        } else {
+            // Row from an older index that doesn't have the bbox inline:
+            alloc_slice geoJSON, geoValue;
+            _index->readGeoArea(docID, seq, geoID, bbox, geoJSON, geoValue);
+        }
+        _candidates.push({distanceToArea(_center, bbox), alloc_slice(docID), seq, geoID, bbox});
+    }
+
+}
@@ -18,7 +18,9 @@
 #include "MapReduceIndex.hh"
 #include "Geohash.hh"
 #include "KeyStore.hh"
-#include <set>
+#include <queue>
+#include <string>
+#include <unordered_set>
 
 
 namespace cbforest {
@@ -42,15 +44,83 @@ namespace cbforest {
         virtual bool approve(slice key); // override
 
     private:
-        typedef std::pair<std::string, cbforest::sequence> ItemID;
-
         const geohash::area _searchArea;
         geohash::area _keyBBox;
         alloc_slice _geoKey;
         alloc_slice _geoValue;
-        std::set<ItemID> _alreadySeen;
+        std::unordered_set<std::string> _alreadySeen;   // IDs of (docID, geoID) already seen
 
         unsigned _hits {0}, _misses {0}, _dups {0};   // Only used for test/profiling purposes
+
+    public:
+        // Row counts so far, for profiling the index's efficiency:
+        unsigned hits() const                   {return _hits;}
+        unsigned misses() const                 {return _misses;}
+        unsigned dups() const                   {return _dups;}
+    };
+
+
+    /** Finds the shapes in a geo index that are nearest to a point, in order of increasing
+        distance (from the point to each shape's bounding box.)
+        This is a best-first search over geohash (or Hilbert) cells, starting with the whole
+        world: the nearest unscanned cell is scanned next, and if it contains too many rows it's
+        subdivided into its 32 (or 4) child cells instead. A shape is returned once no unscanned cell could
+        contain anything closer to the point. */
+    class GeoNearestEnumerator {
+    public:
+        GeoNearestEnumerator(Index*, geohash::coord center, unsigned maxResults);
+        ~GeoNearestEnumerator();
+
+        bool next();
+
+        slice docID() const                     {return _current.docID;}
+        cbforest::sequence sequence() const     {return _current.sequence;}
+        slice value() const                     {return _geoValue;}
+        geohash::area keyBoundingBox() const    {return _current.bbox;}
+        slice keyGeoJSON() const                {return _geoKey;}
+        /** The distance in km from the center point to the current shape's bounding box. */
+        double distance() const                 {return _current.distance;}
+
+        void close();
+
+        /** The work done so far, summed over the index scans of all the cells visited. */
+        const QueryProfile& profile() const     {return _profile;}
+
+    private:
+        struct cell {
+            std::string path;       // geohash string or Hilbert cell path, depending on scheme
+            double distance;
+            bool operator< (const cell &c) const        {return distance > c.distance;}
+        };
+        struct candidate {
+            double distance;
+            alloc_slice docID;
+            cbforest::sequence sequence;
+            unsigned geoID;
+            geohash::area bbox;
+            bool operator< (const candidate &c) const   {return distance > c.distance;}
+        };
+
+        void scanCell(const cell&);
+        void addCell(const std::string &path);
+        CollatableBuilder cellKey(const std::string &path) const;
+        void addCandidate(slice docID, cbforest::sequence, slice value);
+        void addScanProfile(const IndexEnumerator&);
+
+        MapReduceIndex* _index;
+        const bool _hilbert;
+        const geohash::coord _center;
+        const unsigned _maxResults;
+        unsigned _count {0};
+        std::priority_queue<cell> _cells;               // unscanned cells, nearest first
+        std::priority_queue<candidate> _candidates;     // rows found, nearest first
+        std::unordered_set<std::string> _alreadySeen;   // IDs of (docID, geoID) already seen
+        candidate _current;
+        alloc_slice _geoKey;
+        alloc_slice _geoValue;
+
+        unsigned _cellsScanned {0};                     // Only used for test/profiling purposes
+        QueryProfile _profile;
     };
 
 }
@@ -513,6 +513,142 @@ hash hash::adjacent(direction dir) const {
 }
 
 
+#pragma mark - HILBERT CELLS:
+
+
+// Coordinates of a cell at kMaxDepth, along each axis, range from 0 to kGridSize-1
+static const uint32_t kGridSize = 1u << hilbertCell::kMaxDepth;
+
+static uint32_t gridX(double longitude) {
+    double x = floor((longitude + 180.0) / 360.0 * kGridSize);
+    return (uint32_t)std::min(std::max(x, 0.0), (double)(kGridSize - 1));
+}
+
+static uint32_t gridY(double latitude) {
+    double y = floor((latitude + 90.0) / 180.0 * kGridSize);
+    return (uint32_t)std::min(std::max(y, 0.0), (double)(kGridSize - 1));
+}
+
+// Rotates/flips a quadrant appropriately (see https://en.wikipedia.org/wiki/Hilbert_curve)
+static inline void hilbertRotate(uint32_t n, uint32_t &x, uint32_t &y, uint32_t rx, uint32_t ry) {
+    if (ry == 0) {
+        if (rx == 1) {
+            x = n-1 - x;
+            y = n-1 - y;
+        }
+        std::swap(x, y);
+    }
+}
+
+hilbertCell::hilbertCell(uint32_t cellX, uint32_t cellY, unsigned depth) {
+    CBFAssert(depth <= kMaxDepth);
+    // Scale up to the full grid, then compute the curve position digit by digit:
+    uint32_t x = cellX << (kMaxDepth - depth), y = cellY << (kMaxDepth - depth);
+    unsigned i = 0;
+    for (uint32_t s = kGridSize / 2; i < depth; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        path[i++] = (char)('0' + ((3 * rx) ^ ry));
+        hilbertRotate(kGridSize, x, y, rx, ry);
+    }
+    path[i] = '\0';
+}
+
+hilbertCell::hilbertCell(coord c, unsigned depth)
+:hilbertCell(gridX(c.longitude) >> (kMaxDepth - depth),
+             gridY(c.latitude)  >> (kMaxDepth - depth),
+             depth)
+{ }
+
+hilbertCell::hilbertCell(const char *str) {
+    size_t n = std::min(strlen(str), sizeof(path) - 1);
+    memcpy(path, str, n);
+    path[n] = '\0';
+}
+
+area hilbertCell::decode() const {
+    // Convert the path (padded to full depth) back to grid coordinates:
+    unsigned depth = this->depth();
+    uint32_t x = 0, y = 0;
+    for (uint32_t s = 1, i = kMaxDepth; s < kGridSize; s *= 2) {
+        --i;
+        uint32_t t = (i < depth) ? (uint32_t)(path[i] - '0') : 0;
+        uint32_t rx = 1 & (t / 2);
+        uint32_t ry = 1 & (t ^ rx);
+        hilbertRotate(s, x, y, rx, ry);
+        x += s * rx;
+        y += s * ry;
+    }
+    // Then expand the grid square to the cell's size:
+    uint32_t cellSize = 1u << (kMaxDepth - depth);
+    x &= ~(cellSize - 1);
+    y &= ~(cellSize - 1);
+    return area(range(y * 180.0 / kGridSize - 90.0, (y + cellSize) * 180.0 / kGridSize - 90.0),
+                range(x * 360.0 / kGridSize - 180.0, (x + cellSize) * 360.0 / kGridSize - 180.0));
+}
+
+hilbertCell hilbertCell::next() const {
+    hilbertCell result = *this;
+    for (int i = (int)depth() - 1; i >= 0; --i) {
+        if (result.path[i] < '3') {
+            ++result.path[i];
+            return result;
+        }
+        result.path[i] = '0';
+    }
+    return hilbertCell();   // wrapped around; there is no next cell
+}
+
+
+std::vector<hilbertCell> area::coveringHilbertCells() const {
+    static const unsigned kMaxCount = 4;
+    for (unsigned depth = hilbertCell::kMaxDepth; depth > 0; --depth) {
+        auto cells = coveringHilbertCellsOfDepth(depth, kMaxCount);
+        if (!cells.empty())
+            return cells;
+    }
+    return coveringHilbertCellsOfDepth(0, 1);
+}
+
+std::vector<hilbertCell> area::coveringHilbertCellsOfDepth(unsigned depth,
+                                                           unsigned maxCount) const
+{
+    std::vector<hilbertCell> covering;
+    unsigned shift = hilbertCell::kMaxDepth - depth;
+    uint32_t x0 = gridX(longitude.min) >> shift, x1 = gridX(longitude.max) >> shift;
+    uint32_t y0 = gridY(latitude.min)  >> shift, y1 = gridY(latitude.max)  >> shift;
+    if ((uint64_t)(x1 - x0 + 1) * (y1 - y0 + 1) > maxCount)
+        return covering;
+    for (uint32_t y = y0; y <= y1; ++y)
+        for (uint32_t x = x0; x <= x1; ++x)
+            covering.push_back(hilbertCell(x, y, depth));
+    std::sort(covering.begin(), covering.end());
+    return covering;
+}
+
+std::vector<hilbertRange> area::coveringHilbertRanges(unsigned maxCount) const {
+    static const unsigned kMaxCells = 4096;     // Bounds the work done at deep levels
+    std::vector<hilbertRange> result;
+    for (unsigned depth = 0; depth <= hilbertCell::kMaxDepth; ++depth) {
+        auto cells = coveringHilbertCellsOfDepth(depth, kMaxCells);
+        if (cells.empty())
+            break;
+        // Coalesce consecutive cells into ranges:
+        std::vector<hilbertRange> ranges;
+        for (auto c = cells.begin(); c != cells.end(); ++c) {
+            if (!ranges.empty() && ranges.back().last.next() == *c)
+                ranges.back().last = *c;
+            else
+                ranges.push_back(hilbertRange(*c, *c));
+        }
+        if (ranges.size() > maxCount)
+            break;
+        result = ranges;
+    }
+    return result;
+}
+
+
 std::string area::dump() const {
     std::stringstream out;
     out << "(" << latitude.min << ", " << longitude.min << ")...("
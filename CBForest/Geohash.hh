@@ -25,6 +25,8 @@ namespace geohash {
 
     struct hash;
     struct hashRange;
+    struct hilbertCell;
+    struct hilbertRange;
 
     /** A 2D geographic coordinate: (latitude, longitude). */
     struct coord {
@@ -103,6 +105,18 @@ namespace geohash {
                 it may take a lot more to cover the area. */
         std::vector<hashRange> coveringHashRangesOfLength(unsigned nChars) const;
 
+        /** Returns a vector of (up to 4) hilbertCells that completely cover this area. */
+        std::vector<hilbertCell> coveringHilbertCells() const;
+
+        /** Returns a sorted vector of the hilbertCells of the given depth that intersect this
+            area, or an empty vector if there would be more than maxCount. */
+        std::vector<hilbertCell> coveringHilbertCellsOfDepth(unsigned depth,
+                                                             unsigned maxCount) const;
+
+        /** Returns a sorted vector of hilbertRanges that completely cover this area, using the
+            deepest cells possible without exceeding maxCount ranges. */
+        std::vector<hilbertRange> coveringHilbertRanges(unsigned maxCount) const;
+
         std::string dump() const;
 
         unsigned maxCharsToEnclose() const;
@@ -162,6 +176,45 @@ namespace geohash {
     };
 
 
+    /** A cell of a quadtree over the globe, identified by the path of quadrant digits ('0'-'3')
+        that leads to it from the root. The quadrants are numbered in Hilbert-curve order, so
+        sorting cells by path orders them along the curve, and cells of the same depth with
+        consecutive paths are always adjacent. Like a geohash, a cell's path is a prefix of all
+        of its descendants' paths. */
+    struct hilbertCell {
+        static const unsigned kMaxDepth = 24;
+
+        char path[kMaxDepth+1];
+
+        hilbertCell()                       {path[0] = '\0';}
+        explicit hilbertCell(const char *str);
+        hilbertCell(coord, unsigned depth); /**< The cell of the given depth containing coord */
+
+        operator const char*() const        {return path;}
+        unsigned depth() const              {return (unsigned)strlen(path);}
+        bool isEmpty() const                {return path[0] == '\0';}
+
+        area decode() const;
+
+        /** The following cell of the same depth along the curve, or an empty cell if none. */
+        hilbertCell next() const;
+
+        bool operator< (const hilbertCell &c) const   {return strcmp(path, c.path) < 0;}
+        bool operator== (const hilbertCell &c) const  {return strcmp(path, c.path) == 0;}
+
+        // internal:
+        hilbertCell(uint32_t x, uint32_t y, unsigned depth);    // x, y are cell coordinates
+    };
+
+    /** A range of consecutive hilbertCells of the same depth. */
+    struct hilbertRange {
+        hilbertCell first;
+        hilbertCell last;
+
+        hilbertRange(const hilbertCell &f, const hilbertCell &l)   :first(f), last(l) { }
+    };
+
+
     // Inline method bodies:
 
     inline bool range::intersects(geohash::range r) const {
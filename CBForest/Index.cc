@@ -17,6 +17,8 @@
 #include "Collatable.hh"
 #include "varint.hh"
 #include "LogInternal.hh"
+#include <algorithm>
+#include <thread>
 
 
 namespace cbforest {
@@ -37,18 +39,61 @@ namespace cbforest {
         if (isBusy()) Warn("Index %p being destructed during enumeration", this);
     }
 
+    void Index::removeObserver(Observer *observer) {
+        auto i = std::find(_observers.begin(), _observers.end(), observer);
+        if (i != _observers.end())
+            _observers.erase(i);
+    }
+
+    void Index::erased() {
+        _erasedUnnotified = true;
+        if (_writerCount == 0)
+            notifyErased();
+    }
+
+    void Index::notifyErased() {
+        if (!_erasedUnnotified)
+            return;
+        _erasedUnnotified = false;
+        for (auto observer : _observers)
+            observer->indexErased();
+    }
+
+    KeyStore& Index::storeIn(Transaction &t) const {
+        Database *db = t.database();
+        if (db == _indexDB || db->contains(_store))
+            return _store;
+        CBFAssert(db->filename() == _indexDB->filename());
+        return db->getKeyStore(name());
+    }
+
     IndexWriter::IndexWriter(Index* index, Transaction& t)
-    :KeyStoreWriter(index->_store, t),
+    :KeyStoreWriter(index->storeIn(t), t),
      _index(index)
     {
-        CBFDebugAssert(t.database()->contains(index->_store));
         index->addUser();
+        ++index->_writerCount;
     }
 
     IndexWriter::~IndexWriter() {
+        --_index->_writerCount;
         _index->removeUser();
     }
 
+    void IndexWriter::recordChange(IndexChange::Type type, slice rowKey, slice value,
+                                   sequence seq)
+    {
+        _changes.push_back({type, {alloc_slice(rowKey), alloc_slice(value), seq}});
+    }
+
+    void IndexWriter::notifyObservers() {
+        if (_changes.empty())
+            return;
+        for (auto observer : _index->_observers)
+            observer->indexChanged(_changes);
+        _changes.clear();
+    }
+
 
     // djb2 hash function:
     static const uint32_t kInitialHash = 5381;
@@ -158,13 +203,24 @@ namespace cbforest {
             set(realKey, meta, *value);
             newStoredKeys.push_back(*key);
             ++rowsAdded;
+            if (_index->hasObservers()) {
+                bool overwrote = emitIndex < oldStoredKeys.size()
+                                    && oldStoredKeys[emitIndex] == *key;
+                recordChange((overwrote ? IndexChange::kChanged : IndexChange::kAdded),
+                             realKey, *value, docSequence);
+            }
         }
 
         // If there are any old keys that weren't emitted this time, we need to delete those rows:
         for (; oldKey != oldStoredKeys.end(); ++oldKey) {
+            auto oldEmitIndex = oldKey - oldStoredKeys.begin();
+            ++rowsRemoved;
+            keysChanged = true;
+            if ((size_t)oldEmitIndex < keys.size() && keys[oldEmitIndex] == *oldKey
+                    && values[oldEmitIndex].size <= Document::kMaxBodyLength)
+                continue;   // same key at the same position: the row was just overwritten above
             CollatableBuilder realKey;
             realKey.beginArray() << *oldKey << collatableDocID;
-            auto oldEmitIndex = oldKey - oldStoredKeys.begin();
             if (oldEmitIndex > 0)
                 realKey << oldEmitIndex;
             realKey.endArray();
@@ -172,8 +228,8 @@ namespace cbforest {
             if (!deleted) {
                 Warn("Failed to delete old emitted k/v pair");
             }
-            ++rowsRemoved;
-            keysChanged = true;
+            if (_index->hasObservers())
+                recordChange(IndexChange::kRemoved, realKey, slice::null, docSequence);
         }
 
         // Store the keys that were emitted for this doc, and the hash of the values:
@@ -183,6 +239,8 @@ namespace cbforest {
         if (rowsRemoved==0 && rowsAdded==0)
             return false;
 
+        DatabaseStats::add(_stats->indexRowsAdded, rowsAdded);
+        DatabaseStats::add(_stats->indexRowsRemoved, rowsRemoved);
         rowCount += rowsAdded - rowsRemoved;
         return true;
     }
@@ -235,10 +293,18 @@ namespace cbforest {
         options.limit = DocEnumerator::Options::kDefault.limit;
         options.skip = DocEnumerator::Options::kDefault.skip;
         options.includeDeleted = false;
-        options.contentOptions = KeyStore::kDefaultContent; // read() method needs the doc bodies
+        // read() needs the doc bodies, which hold the values, unless only keys are wanted:
+        options.contentOptions = (KeyStore::contentOptions)(options.contentOptions
+                                                            & KeyStore::kMetaOnly);
         return options;
     }
 
+    // A row's value, or null if its body wasn't read (a meta-only read leaves the body pointer
+    // null but still reports its length.)
+    static inline slice rowValue(const Document &doc) {
+        return doc.body().buf ? doc.body() : slice::null;
+    }
+
     IndexEnumerator::IndexEnumerator(Index* index,
                                      Collatable startKey, slice startKeyDocID,
                                      Collatable endKey,   slice endKeyDocID,
@@ -258,11 +324,14 @@ namespace cbforest {
             _startKey = (slice)startKey;
         if (!_inclusiveEnd)
             _endKey = (slice)endKey;
+        _profile.seeks = _profile.keyRanges = 1;
+        _profile.addTimeSince(_created);
     }
 
     IndexEnumerator::IndexEnumerator(Index* index,
                                      std::vector<KeyRange> keyRanges,
-                                     const DocEnumerator::Options& options)
+                                     const DocEnumerator::Options& options,
+                                     bool bufferRanges)
     :_index(index),
      _options(options),
      _inclusiveStart(true),
@@ -274,7 +343,19 @@ namespace cbforest {
         index->addUser();
         for (auto i = _keyRanges.begin(); i != _keyRanges.end(); ++i)
             Debug("    key range: %s -- %s (%d)", i->start.toJSON().c_str(), i->end.toJSON().c_str(), i->inclusiveEnd);
-        nextKeyRange();
+        if (bufferRanges && !options.descending) {
+            // Unless each range starts past the end of the previous one, read them all in one
+            // pass (on the first call to next()) instead of seeking backwards:
+            for (size_t i = 1; i < _keyRanges.size(); ++i) {
+                if (!_keyRanges[i-1].isKeyPastEnd(_keyRanges[i].start)) {
+                    _buffered = true;
+                    break;
+                }
+            }
+        }
+        if (!_buffered)
+            nextKeyRange();
+        _profile.addTimeSince(_created);
     }
 
     bool IndexEnumerator::read() {
@@ -292,6 +373,8 @@ namespace cbforest {
             }
             
             const Document& doc = _dbEnum.doc();
+            ++_profile.rowsScanned;
+            _profile.bytesRead += doc.key().size + doc.meta().size + rowValue(doc).size;
 
             // Decode the key from collatable form:
             CollatableReader keyReader(doc.key());
@@ -299,28 +382,39 @@ namespace cbforest {
             _key = keyReader.read();
 
             if (!_inclusiveEnd && _key == _endKey) {
+                ++_profile.rowsOutOfRange;
                 _dbEnum.close();
                 return false;
             } else if (!_inclusiveStart && _key == _startKey) {
+                ++_profile.rowsOutOfRange;
                 _dbEnum.next();
                 continue;
             }
 
             if (_currentKeyIndex >= 0 && _keyRanges[_currentKeyIndex].isKeyPastEnd(_key)) {
-                // While enumerating through _keys, advance to the next key:
-                nextKeyRange();
-                if (_dbEnum.next())
-                    continue;
+                // While enumerating through _keys, advance to the next key. Ascending ranges
+                // are in order, so the row may already be in the next one, saving a seek:
+                bool inRange = false;
+                if (_options.descending)
+                    nextKeyRange();
                 else
-                    return false;
+                    inRange = advanceKeyRange();
+                if (!inRange) {
+                    ++_profile.rowsOutOfRange;
+                    if (_dbEnum.next())
+                        continue;
+                    else
+                        return false;
+                }
             }
 
             _docID = keyReader.readString();
             GetUVarInt(doc.meta(), &_sequence);
-            _value = doc.body();
+            _value = rowValue(doc);
 
             // Subclasses can ignore rows:
             if (!this->approve(_key)) {
+                ++_profile.rowsRejected;
                 _dbEnum.next();
                 continue;
             }
@@ -328,6 +422,7 @@ namespace cbforest {
             // OK, this is a candidate. First honor the skip and limit:
             if (_options.skip > 0) {
                 --_options.skip;
+                ++_profile.rowsSkipped;
                 _dbEnum.next();
                 continue;
             }
@@ -335,6 +430,7 @@ namespace cbforest {
                 _dbEnum.close();
                 return false;
             }
+            ++_profile.rowsReturned;
 
             // Return it as the next row:
             Debug("IndexEnumerator: found key=%s",
@@ -360,17 +456,485 @@ namespace cbforest {
             _dbEnum.close();
             return;
         }
+        ++_profile.keyRanges;
+        seekToKeyRange();
+    }
 
+    void IndexEnumerator::seekToKeyRange() {
         Collatable& startKey = _keyRanges[_currentKeyIndex].start;
         Debug("IndexEnumerator: Advance to key '%s'", startKey.toJSON().c_str());
         if (!_dbEnum)
             _dbEnum = DocEnumerator(_index->_store, slice::null, slice::null, docOptions(_options));
         _dbEnum.seek(makeRealKey(startKey, slice::null, false, _options.descending));
+        ++_profile.seeks;
+    }
+
+    // Advances to the first following (ascending) key range that the current row isn't past the
+    // end of. Returns true if the row is in that range; else seeks to its start (or closes the
+    // enumerator if there are no more ranges) and returns false.
+    bool IndexEnumerator::advanceKeyRange() {
+        while (++_currentKeyIndex < (int)_keyRanges.size()) {
+            ++_profile.keyRanges;
+            auto &range = _keyRanges[_currentKeyIndex];
+            if (range.isKeyPastEnd(_key))
+                continue;
+            if (!(_key < (slice)range.start))
+                return true;
+            seekToKeyRange();
+            return false;
+        }
+        _dbEnum.close();
+        return false;
+    }
+
+
+    // Reads the rows of all the key ranges in one forward pass, buffering each range's rows so
+    // they can be returned in the order of the ranges. Ranges are sorted by start key, and ones
+    // that overlap or touch are scanned together, so no row is read twice.
+    void IndexEnumerator::scanKeyRanges() {
+        std::vector<unsigned> order(_keyRanges.size());
+        for (unsigned i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](unsigned a, unsigned b) {
+            return (slice)_keyRanges[a].start < (slice)_keyRanges[b].start;
+        });
+
+        _rowsInRange.resize(_keyRanges.size());
+        for (size_t first = 0; first < order.size(); ) {
+            // Extend the group while the next range starts before the group's end:
+            const KeyRange *groupEnd = &_keyRanges[order[first]];
+            size_t end;
+            for (end = first + 1; end < order.size(); ++end) {
+                const KeyRange &range = _keyRanges[order[end]];
+                if ((slice)groupEnd->end < (slice)range.start)
+                    break;
+                if ((slice)groupEnd->end < (slice)range.end
+                        || (groupEnd->end == range.end && range.inclusiveEnd))
+                    groupEnd = &range;
+            }
+            scanKeyRangeGroup(order, first, end, *groupEnd);
+            first = end;
+        }
+        _dbEnum.close();
+        if (_currentKeyIndex < 0)
+            _currentKeyIndex = 0;
+        _scanned = true;
+    }
+
+    void IndexEnumerator::scanKeyRangeGroup(const std::vector<unsigned> &order,
+                                            size_t first, size_t end,
+                                            const KeyRange &groupEnd)
+    {
+        Collatable& startKey = _keyRanges[order[first]].start;
+        Debug("IndexEnumerator: Scan from key '%s'", startKey.toJSON().c_str());
+        if (!_dbEnum)
+            _dbEnum = DocEnumerator(_index->_store, slice::null, slice::null, docOptions(_options));
+        _dbEnum.seek(makeRealKey(startKey, slice::null, false, false));
+        ++_profile.seeks;
+        ++_profile.keyRanges;
+
+        while (_dbEnum.next()) {
+            const Document& doc = _dbEnum.doc();
+            ++_profile.rowsScanned;
+            _profile.bytesRead += doc.key().size + doc.meta().size + rowValue(doc).size;
+
+            CollatableReader keyReader(doc.key());
+            keyReader.beginArray();
+            _key = keyReader.read();
+            if (groupEnd.isKeyPastEnd(_key)) {
+                ++_profile.rowsOutOfRange;
+                break;
+            }
+            _docID = keyReader.readString();
+            GetUVarInt(doc.meta(), &_sequence);
+            _value = rowValue(doc);
+
+            // Add the row to every range it's in:
+            bool inRange = false, buffered = false;
+            for (size_t i = first; i < end; ++i) {
+                unsigned r = order[i];
+                if (_key < (slice)_keyRanges[r].start || _keyRanges[r].isKeyPastEnd(_key))
+                    continue;
+                inRange = true;
+                if (!this->approve(_key)) {
+                    ++_profile.rowsRejected;
+                    continue;
+                }
+                if (!buffered) {
+                    _rows.push_back({alloc_slice(doc.key()), alloc_slice(_value), _sequence});
+                    buffered = true;
+                }
+                _rowsInRange[r].push_back(_rows.size() - 1);
+            }
+            if (!inRange)
+                ++_profile.rowsOutOfRange;
+        }
+    }
+
+    // Returns the next buffered row, honoring skip, limit and resumeAfter.
+    bool IndexEnumerator::readBuffered() {
+        if (!_scanned)
+            scanKeyRanges();
+        while (_currentKeyIndex < (int)_rowsInRange.size()) {
+            auto &rows = _rowsInRange[_currentKeyIndex];
+            if (_bufferedRow >= rows.size()) {
+                ++_currentKeyIndex;
+                _bufferedRow = 0;
+                _resumeToken = alloc_slice();   // only applies to the range it was in
+                continue;
+            }
+            IndexRow &row = _rows[rows[_bufferedRow++]];
+            if (_resumeToken.buf) {
+                if (!(_resumeToken < row.rowKey))
+                    continue;
+                _resumeToken = alloc_slice();
+            }
+            if (_options.skip > 0) {
+                --_options.skip;
+                ++_profile.rowsSkipped;
+                continue;
+            }
+            if (_options.limit-- == 0) {
+                close();
+                return false;
+            }
+            ++_profile.rowsReturned;
+
+            CollatableReader keyReader(row.rowKey);
+            keyReader.beginArray();
+            _key = keyReader.read();
+            _docID = keyReader.readString();
+            _value = row.value;
+            _sequence = row.sequence;
+            _rowKey = row.rowKey;
+            _rowKeyRange = _currentKeyIndex;
+            return true;
+        }
+        return false;
+    }
+
+    void IndexEnumerator::close() {
+        leaveRow();
+        _dbEnum.close();
+        if (_buffered) {
+            _rows.clear();
+            _rowsInRange.clear();
+            _scanned = true;
+        }
+    }
+
+    alloc_slice IndexEnumerator::resumeToken() const {
+        if (!_buffered) {
+            // The row's key is only copied here, not as each row is read:
+            slice key = _onRow ? _dbEnum.doc().key() : _lastRow.key();
+            return key.buf ? alloc_slice(key) : alloc_slice();
+        }
+        if (!_rowKey.buf)
+            return _rowKey;
+        // Buffered ranges can be out of order or repeated, so the row key alone doesn't say
+        // which range the row was returned in; append the range's index:
+        alloc_slice token(_rowKey.size + SizeOfVarInt(_rowKeyRange));
+        memcpy((void*)token.buf, _rowKey.buf, _rowKey.size);
+        PutUVarInt((uint8_t*)token.buf + _rowKey.size, _rowKeyRange);
+        return token;
+    }
+
+    void IndexEnumerator::resumeAfter(slice token) {
+        if (_buffered) {
+            // Split the token into the row key and its key range index (see resumeToken()):
+            CollatableReader reader(token);
+            slice rowKey = reader.read();
+            uint64_t range;
+            size_t n = GetUVarInt(reader.data(), &range);
+            if (n == 0 || n != reader.data().size)
+                error::_throw(FDB_RESULT_INVALID_ARGS);
+            Debug("IndexEnumerator: Resume after '%s' in key range %u",
+                  CollatableReader(rowKey).toJSON().c_str(), (unsigned)range);
+            // Rows up to the token's will be skipped as they're returned; see readBuffered()
+            _currentKeyIndex = (int)std::min(range, (uint64_t)_keyRanges.size());
+            _resumeToken = rowKey;
+            return;
+        }
+        if (!_keyRanges.empty()) {
+            // Find the key range that the token's row is in (the first one it's not past):
+            CollatableReader reader(token);
+            reader.beginArray();
+            slice key = reader.read();
+            int i;
+            for (i = 0; i < (int)_keyRanges.size(); ++i)
+                if (!_keyRanges[i].isKeyPastEnd(key))
+                    break;
+            if (i >= (int)_keyRanges.size()) {
+                _currentKeyIndex = i;
+                close();
+                return;
+            }
+            _currentKeyIndex = i;
+            if (!_dbEnum)
+                _dbEnum = DocEnumerator(_index->_store, slice::null, slice::null, docOptions(_options));
+        }
+        Debug("IndexEnumerator: Resume after '%s'", CollatableReader(token).toJSON().c_str());
+        _dbEnum.seekPast(token);
+        ++_profile.seeks;
     }
 
     bool IndexEnumerator::next() {
+        QueryProfile::Timer timer(_profile);
+        if (_buffered)
+            return readBuffered();
+        leaveRow();
         _dbEnum.next();
-        return read();
+        return _onRow = read();
+    }
+
+    // Before moving past the row last returned, keeps its document for resumeToken(). (This
+    // doesn't copy anything; the enumerator frees the previous one instead.)
+    void IndexEnumerator::leaveRow() {
+        if (_onRow) {
+            _dbEnum.swapDoc(_lastRow);
+            _onRow = false;
+        }
+    }
+
+
+#pragma mark - PARALLEL SCAN:
+
+
+    ParallelIndexScan::ParallelIndexScan(Index* index,
+                                         Collatable startKey, slice startKeyDocID,
+                                         Collatable endKey,   slice endKeyDocID,
+                                         const DocEnumerator::Options& options)
+    :_index(index),
+     _startKey(startKey),
+     _endKey(endKey),
+     _startKeyDocID(startKeyDocID),
+     _endKeyDocID(endKeyDocID),
+     _options(options),
+     _limit(options.limit)
+    {
+        CBFAssert(!options.descending && options.skip == 0);
+        _options.limit = DocEnumerator::Options::kDefault.limit;   // enforced by deliver()
+        index->addUser();
+    }
+
+    // Returns a key about `fraction` of the way from `a` to `b` (which sorts after it), found by
+    // interpolating the 8 bytes after their common prefix as big-endian numbers.
+    static alloc_slice interpolateKey(slice a, slice b, double fraction) {
+        size_t prefix = 0;
+        while (prefix < a.size && prefix < b.size && a[prefix] == b[prefix])
+            ++prefix;
+        auto number = [=](slice s) {
+            uint64_t n = 0;
+            for (size_t i = prefix; i < prefix + 8; ++i)
+                n = (n << 8) | (i < s.size ? s[i] : 0);
+            return n;
+        };
+        uint64_t na = number(a), nb = number(b);
+        uint64_t n = na + (uint64_t)((double)(nb - na) * fraction);
+        std::string key((const char*)a.buf, prefix);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            key.push_back((char)(n >> shift));
+        return alloc_slice(key);
+    }
+
+    // Picks up to `partitions`-1 split points, each the raw key of the last row of a partition,
+    // by seeking backwards from keys spaced evenly between the first and last rows of the range.
+    void ParallelIndexScan::sampleSplits(unsigned partitions) {
+        _splits.clear();
+        if (partitions < 2)
+            return;
+        DocEnumerator::Options options = _options;
+        options.contentOptions = KeyStore::kMetaOnly;
+        alloc_slice first, last;
+        {
+            IndexEnumerator e(_index, _startKey, _startKeyDocID, _endKey, _endKeyDocID, options);
+            if (e.next())
+                first = e.resumeToken();
+        }
+        {
+            options.descending = true;
+            options.inclusiveStart = _options.inclusiveEnd;
+            options.inclusiveEnd = _options.inclusiveStart;
+            IndexEnumerator e(_index, _endKey, _endKeyDocID, _startKey, _startKeyDocID, options);
+            if (e.next())
+                last = e.resumeToken();
+        }
+        _profile.seeks += 2;
+        if (!first.buf || !last.buf || !(first < last))
+            return;
+
+        DocEnumerator::Options probeOptions = DocEnumerator::Options::kDefault;
+        probeOptions.descending = true;
+        probeOptions.contentOptions = KeyStore::kMetaOnly;
+        DocEnumerator probe(_index->_store, last, first, probeOptions);
+        for (unsigned i = 1; i < partitions; ++i) {
+            probe.seek(interpolateKey(first, last, (double)i / partitions));
+            ++_profile.seeks;
+            if (!probe.next())
+                break;
+            slice key = probe->key();
+            if (key < last && (_splits.empty() ? !(key < first) : key > _splits.back()))
+                _splits.push_back(alloc_slice(key));
+        }
+        Debug("ParallelIndexScan: %zu partitions", partitionCount());
+    }
+
+    // Reads the rows of a partition through `index`, passing each to `handler` until it
+    // returns false.
+    void ParallelIndexScan::scanPartition(Index *index, size_t partition, QueryProfile &profile,
+                                          const RowHandler &handler)
+    {
+        IndexEnumerator e(index, _startKey, _startKeyDocID, _endKey, _endKeyDocID, _options);
+        if (partition > 0)
+            e.resumeAfter(_splits[partition-1]);
+        slice end = (partition < _splits.size()) ? (slice)_splits[partition] : slice::null;
+        bool overshot = false;
+        while (!_stop && e.next()) {
+            alloc_slice rowKey = e.resumeToken();
+            if (end.buf && rowKey > end) {
+                overshot = true;    // the split row is gone; this one's in the next partition
+                break;
+            }
+            if (!handler(e) || rowKey == end)
+                break;
+        }
+        profile += e.profile();
+        if (overshot) {
+            --profile.rowsReturned;
+            ++profile.rowsOutOfRange;
+        }
+    }
+
+    // Body of a scanning thread: scans partitions until there are none left. If `callback` is
+    // non-null rows are passed to it, otherwise they're buffered in _partitions.
+    void ParallelIndexScan::scanThread(const std::string &path, const Database::config &config,
+                                       const RowCallback *callback)
+    {
+        try {
+            Database db(path, config);
+            Index index(&db, _index->name());
+            QueryProfile profile;
+            size_t p;
+            while (!_stop && (p = _nextPartition++) < partitionCount()) {
+                if (callback) {
+                    scanPartition(&index, p, profile, [&](const IndexEnumerator &e) {
+                        return deliver(e.resumeToken(), e.value(), e.sequence(), *callback);
+                    });
+                } else {
+                    auto &rows = _partitions[p].rows;
+                    scanPartition(&index, p, profile, [&](const IndexEnumerator &e) {
+                        rows.push_back({e.resumeToken(), alloc_slice(e.value()), e.sequence()});
+                        return true;
+                    });
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _partitions[p].done = true;
+                    _cond.notify_all();
+                }
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _profile += profile;
+        } catch (...) {
+            failed();
+        }
+    }
+
+    // Records the current exception (if it's the first) and stops the scan.
+    void ParallelIndexScan::failed() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_exception)
+            _exception = std::current_exception();
+        _stop = true;
+        _cond.notify_all();
+    }
+
+    // Passes a row to the callback, unless the limit's been reached.
+    bool ParallelIndexScan::deliver(slice rowKey, slice value, ::cbforest::sequence seq,
+                                    const RowCallback &callback)
+    {
+        if (_delivered++ >= _limit) {
+            _stop = true;
+            return false;
+        }
+        CollatableReader reader(rowKey);
+        reader.beginArray();
+        slice key = reader.read();
+        alloc_slice docID = reader.readString();
+        callback(key, docID, value, seq);
+        return true;
+    }
+
+    // Delivers the buffered partitions in order, each as soon as it's been scanned.
+    void ParallelIndexScan::deliverInOrder(const RowCallback &callback) {
+        for (size_t p = 0; p < _partitions.size(); ++p) {
+            std::vector<IndexRow> rows;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [&]{return _partitions[p].done || _stop;});
+                if (!_partitions[p].done)
+                    return;
+                rows.swap(_partitions[p].rows);
+            }
+            for (auto &row : rows)
+                if (!deliver(row.rowKey, row.value, row.sequence, callback))
+                    return;
+        }
+    }
+
+    void ParallelIndexScan::run(unsigned threads, bool ordered, const RowCallback &callback) {
+        auto start = QueryProfile::clock::now();
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        sampleSplits(threads > 1 ? threads * kPartitionsPerThread : 1);
+        threads = (unsigned)std::min((size_t)threads, partitionCount());
+
+        if (threads <= 1) {
+            // Just one partition; scan it on this thread:
+            QueryProfile profile;
+            scanPartition(_index, 0, profile, [&](const IndexEnumerator &e) {
+                return deliver(e.resumeToken(), e.value(), e.sequence(), callback);
+            });
+            _profile += profile;
+        } else {
+            // Scanning threads need their own Database instances, since ForestDB handles can't
+            // be used on multiple threads at once:
+            std::string path = _index->database()->filename();
+            Database::config config = _index->database()->getConfig();
+            if (ordered)
+                _partitions.resize(partitionCount());
+            std::vector<std::thread> workers;
+            for (unsigned i = 0; i < threads; ++i)
+                workers.emplace_back([&]{scanThread(path, config, ordered ? nullptr : &callback);});
+            if (ordered) {
+                try {
+                    deliverInOrder(callback);
+                } catch (...) {
+                    failed();
+                }
+                _stop = true;   // in case delivery ended early
+            }
+            for (auto &worker : workers)
+                worker.join();
+            _partitions.clear();
+            if (_exception)
+                std::rethrow_exception(_exception);
+        }
+        _profile.rowsReturned = std::min(_delivered.load(), _limit);
+        _profile.elapsedNanos = 0;
+        _profile.addTimeSince(start);
+    }
+
+
+    QueryProfile& QueryProfile::operator+= (const QueryProfile &p) {
+        rowsScanned += p.rowsScanned;
+        rowsReturned += p.rowsReturned;
+        rowsSkipped += p.rowsSkipped;
+        rowsRejected += p.rowsRejected;
+        rowsOutOfRange += p.rowsOutOfRange;
+        seeks += p.seeks;
+        keyRanges += p.keyRanges;
+        bytesRead += p.bytesRead;
+        elapsedNanos += p.elapsedNanos;
+        return *this;
     }
 
 }
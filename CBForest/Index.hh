@@ -16,9 +16,16 @@
 #ifndef __CBForest__Index__
 #define __CBForest__Index__
 
+#include "Database.hh"
 #include "DocEnumerator.hh"
 #include "Collatable.hh"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 namespace cbforest {
     
@@ -39,7 +46,62 @@ namespace cbforest {
         bool operator== (const KeyRange &r)     {return start==r.start && end==r.end;}
     };
 
+
+    /** Counts of the work done by an index query, for finding out why a query is slow. */
+    struct QueryProfile {
+        uint64_t rowsScanned {0};       // index rows read
+        uint64_t rowsReturned {0};
+        uint64_t rowsSkipped {0};       // passed over because of options.skip
+        uint64_t rowsRejected {0};      // filtered out by the enumerator, e.g. outside a geo area
+        uint64_t rowsOutOfRange {0};    // read past the end of a key range, or at an exclusive end
+        uint64_t seeks {0};             // index iterator positionings
+        uint64_t keyRanges {0};         // key ranges visited
+        uint64_t bytesRead {0};         // key + meta + body bytes of the rows scanned
+        uint64_t elapsedNanos {0};      // time spent in the enumerator, not in its caller
+
+        QueryProfile& operator+= (const QueryProfile&);
+
+        typedef std::chrono::steady_clock clock;
+
+        /** Adds the time from its construction to its destruction to a profile's elapsedNanos. */
+        class Timer {
+        public:
+            explicit Timer(QueryProfile &p)     :_profile(p), _start(clock::now()) { }
+            ~Timer()                            {_profile.addTimeSince(_start);}
+        private:
+            QueryProfile &_profile;
+            clock::time_point _start;
+        };
+
+        void addTimeSince(clock::time_point start) {
+            elapsedNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                                clock::now() - start).count();
+        }
+    };
+
     
+    /** A copy of an index row: its raw key (the emitted key and docID, in collatable form,
+        as returned by IndexEnumerator::resumeToken), value and document sequence. */
+    struct IndexRow {
+        alloc_slice rowKey;
+        alloc_slice value;
+        ::cbforest::sequence sequence;
+    };
+
+
+    /** A row added to, removed from, or rewritten in an index by an IndexWriter. A removed row
+        has a null value, and the sequence of the document revision that removed it. */
+    struct IndexChange {
+        enum Type : uint8_t {
+            kAdded,
+            kRemoved,
+            kChanged,       // same key; the value and/or document sequence changed
+        };
+        Type type;
+        IndexRow row;
+    };
+
+
     /** A key-value store used as an index. */
     class Index {
     public:
@@ -51,24 +113,61 @@ namespace cbforest {
                              unsigned emitIndex) const;
 
         Database* database() const              {return _indexDB;}
+        std::string name() const                {return _store.name();}
         bool isBusy() const                     {return _userCount > 0;}
 
+        /** The last sequence number of the index's own KeyStore. It changes whenever the index
+            is written to, and is cheap to get. */
+        sequence storeSequence() const          {return _store.lastSequence();}
+
+        /** The index's KeyStore as accessed by a Transaction. The Transaction's Database may be
+            a different instance than the index's, as long as it's on the same file. */
+        KeyStore& storeIn(Transaction&) const;
+
         /** Used as a placeholder for an index value that's stored out of line, i.e. that
             represents the entire document being indexed. */
         static const slice kSpecialValue;
 
+        /** Is told about the rows changed by IndexWriters, once their transactions commit.
+            It's called on the committing thread. Observers mustn't be added or removed while
+            the index is being updated. */
+        class Observer {
+        public:
+            virtual ~Observer() =default;
+            virtual void indexChanged(const std::vector<IndexChange>&) =0;
+            /** All the rows were removed at once, as by erasing the index. */
+            virtual void indexErased() =0;
+        };
+
+        void addObserver(Observer *o)           {_observers.push_back(o);}
+        void removeObserver(Observer*);
+        bool hasObservers() const               {return !_observers.empty();}
+
     protected:
+        /** Notes that all the rows were removed. Observers are told right away, unless an
+            IndexWriter is open on the index; then notifyErased() tells them, once the writer's
+            transaction has ended, so they don't see the erasure before it's committed. */
+        void erased();
+
+        /** Tells the observers about an erasure noted by erased(), if they haven't been told. */
+        void notifyErased();
+
         KeyStore &_store;
 
     private:
         friend class IndexWriter;
         friend class IndexEnumerator;
+        friend class GeoNearestEnumerator;
+        friend class ParallelIndexScan;
 
         void addUser()                          {++_userCount;}
         void removeUser()                       {--_userCount;}
 
         Database* const _indexDB;
         std::atomic_uint _userCount {0};
+        unsigned _writerCount {0};              // number of open IndexWriters
+        std::vector<Observer*> _observers;
+        bool _erasedUnnotified {false};         // erased() since the observers were told
     };
 
 
@@ -87,18 +186,30 @@ namespace cbforest {
                     const std::vector<alloc_slice> &values,
                     uint64_t &rowCount);
 
+        /** Passes the rows changed by update() to the index's Observers, if it has any.
+            Call after the transaction has been committed. */
+        void notifyObservers();
+
     private:
         void getKeysForDoc(slice docID, std::vector<Collatable> &outKeys, uint32_t &outHash);
         void setKeysForDoc(slice docID, const std::vector<Collatable> &keys, uint32_t hash);
+        void recordChange(IndexChange::Type, slice rowKey, slice value, sequence);
 
         friend class Index;
         friend class MapReduceIndex;
 
         Index *_index;
+        std::vector<IndexChange> _changes;      // only recorded while the index has Observers
     };
 
 
-    /** Index query enumerator. */
+    /** Index query enumerator.
+        If the options' contentOptions include kMetaOnly, row values aren't read from disk and
+        value() returns a null slice; keys, docIDs and sequences are still available.
+        Rows of multiple key ranges are returned in the order of the ranges. If (ascending)
+        ranges are out of order, or overlap or repeat, they're all read in one forward pass and
+        buffered in memory, instead of seeking backwards and re-reading rows. (Subclasses whose
+        approve() method keeps state about the current row can turn buffering off.) */
     class IndexEnumerator {
     public:
         IndexEnumerator(Index*,
@@ -108,7 +219,8 @@ namespace cbforest {
 
         IndexEnumerator(Index*,
                         std::vector<KeyRange> keyRanges,
-                        const DocEnumerator::Options&);
+                        const DocEnumerator::Options&,
+                        bool bufferRanges =true);
 
         virtual ~IndexEnumerator()              {_index->removeUser();}
 
@@ -128,9 +240,22 @@ namespace cbforest {
 
         int currentKeyRangeIndex()              {return _currentKeyIndex;}
 
+        /** An opaque token identifying the last row returned (it's still valid after next()
+            returns false.) Passing it to resumeAfter, on an enumerator created with the same
+            parameters, continues the enumeration after that row. (It starts with the row's raw
+            key; when rows are buffered, the index of the row's key range follows that.) */
+        alloc_slice resumeToken() const;
+
+        /** Skips to just after the row identified by a resumeToken, in constant time. Call
+            before the first call to next(). */
+        void resumeAfter(slice token);
+
         bool next();
 
-        void close()                            {_dbEnum.close();}
+        /** The work done so far by this enumerator. */
+        const QueryProfile& profile() const     {return _profile;}
+
+        void close();
 
     protected:
         virtual void nextKeyRange();
@@ -141,6 +266,14 @@ namespace cbforest {
     private:
         friend class Index;
 
+        void leaveRow();
+        void seekToKeyRange();
+        bool advanceKeyRange();
+        void scanKeyRanges();
+        void scanKeyRangeGroup(const std::vector<unsigned> &order, size_t first, size_t end,
+                               const KeyRange &groupEnd);
+        bool readBuffered();
+
         Index* _index;
         DocEnumerator::Options _options;
         alloc_slice _startKey;
@@ -149,12 +282,93 @@ namespace cbforest {
         bool _inclusiveEnd;
         std::vector<KeyRange> _keyRanges;
         int _currentKeyIndex {-1};
+        QueryProfile _profile;
+        QueryProfile::clock::time_point _created {QueryProfile::clock::now()};  // before _dbEnum
 
         DocEnumerator _dbEnum;
         slice _key;
         slice _value;
         alloc_slice _docID;
+        Document _lastRow;                      // the last row returned, once _dbEnum leaves it
+        bool _onRow {false};                    // is _dbEnum still on the last row returned?
         ::cbforest::sequence _sequence;
+
+        // Used when key ranges are read in one pass and buffered:
+        bool _buffered {false};
+        bool _scanned {false};
+        std::vector<IndexRow> _rows;
+        std::vector<std::vector<size_t>> _rowsInRange; // indexes into _rows, per key range
+        size_t _bufferedRow {0};                // index into _rowsInRange[_currentKeyIndex]
+        alloc_slice _rowKey;                    // raw index key of the last row returned
+        int _rowKeyRange {-1};                  // key range of the last row returned
+        alloc_slice _resumeToken;               // skip rows up to this key in _currentKeyIndex
+    };
+
+
+    /** Scans one key range of an index on several threads at once.
+        The range is split into partitions at rows found by seeking to keys spaced evenly
+        between its first and last rows. That divides the key space, not necessarily the rows,
+        evenly, so there are several partitions per thread, and each thread takes the next
+        unscanned partition when it finishes one. Each thread reads through its own handle on
+        the index's database file, so it only sees committed rows.
+        Skip and descending order aren't supported. */
+    class ParallelIndexScan {
+    public:
+        /** Receives a row's key (in collatable form), docID, value and sequence. The slices are
+            only valid during the call. */
+        typedef std::function<void(slice key, slice docID, slice value, sequence)> RowCallback;
+
+        ParallelIndexScan(Index*,
+                          Collatable startKey, slice startKeyDocID,
+                          Collatable endKey, slice endKeyDocID,
+                          const DocEnumerator::Options&);
+        ~ParallelIndexScan()                    {_index->removeUser();}
+
+        /** Scans the range with up to `threads` threads (0 means one per CPU core), and returns
+            when it's done. If `ordered`, rows are passed to the callback on the calling thread in
+            key order, and partitions that finish ahead of their turn are buffered in memory.
+            Otherwise the callback is called on the scanning threads as rows are read, in no
+            particular order and concurrently, so it must be thread-safe.
+            An exception thrown on a scanning thread stops the scan and is rethrown. */
+        void run(unsigned threads, bool ordered, const RowCallback&);
+
+        /** The number of partitions the range was split into by run(). */
+        size_t partitionCount() const           {return _splits.size() + 1;}
+
+        /** The work done by all the threads. elapsedNanos is the wall time of run(). */
+        const QueryProfile& profile() const     {return _profile;}
+
+        static const unsigned kPartitionsPerThread = 4;
+
+    private:
+        struct Partition {
+            std::vector<IndexRow> rows;
+            bool done {false};
+        };
+        typedef std::function<bool(const IndexEnumerator&)> RowHandler;
+
+        void sampleSplits(unsigned partitions);
+        void scanPartition(Index*, size_t partition, QueryProfile&, const RowHandler&);
+        void scanThread(const std::string &path, const Database::config&,
+                        const RowCallback *callback);
+        bool deliver(slice rowKey, slice value, ::cbforest::sequence, const RowCallback&);
+        void deliverInOrder(const RowCallback&);
+        void failed();
+
+        Index* const _index;
+        Collatable _startKey, _endKey;
+        alloc_slice _startKeyDocID, _endKeyDocID;
+        DocEnumerator::Options _options;
+        uint64_t _limit;
+        std::vector<alloc_slice> _splits;       // raw key of the last row of each partition but the last
+        std::vector<Partition> _partitions;     // buffered rows, when ordered
+        std::atomic<size_t> _nextPartition {0};
+        std::atomic<uint64_t> _delivered {0};
+        std::atomic<bool> _stop {false};
+        std::mutex _mutex;                      // guards the below, and _partitions' done flags
+        std::condition_variable _cond;
+        std::exception_ptr _exception;
+        QueryProfile _profile;
     };
 
 }
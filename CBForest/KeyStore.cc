@@ -14,6 +14,7 @@
 //  and limitations under the License.
 
 #include "KeyStore.hh"
+#include "BloomFilter.hh"
 #include "Document.hh"
 #include "LogInternal.hh"
 
@@ -62,6 +63,12 @@ namespace cbforest {
         return doc;
     }
 
+    // Updates the stats after reading a document
+    static inline void countRead(DatabaseStats *stats, const Document &doc) {
+        DatabaseStats::add(stats->gets);
+        DatabaseStats::add(stats->bytesRead, doc.meta().size + doc.body().size);
+    }
+
     Document KeyStore::get(sequence seq, contentOptions options) const {
         Document doc;
         doc._doc.seqnum = seq;
@@ -69,15 +76,26 @@ namespace cbforest {
             check(fdb_get_metaonly_byseq(_handle, &doc._doc));
         else
             check(fdb_get_byseq(_handle, doc));
+        countRead(_stats, doc);
         return doc;
     }
 
     bool KeyStore::read(Document& doc, contentOptions options) const {
         doc.clearMetaAndBody();
+        bool filtered = (_keyFilter && _keyFilter->enabled());
+        if (filtered && !_keyFilter->mayContain(doc.key())) {
+            DatabaseStats::add(_stats->keyFilterSkips);
+            return false;
+        }
+        bool found;
         if (options & kMetaOnly)
-            return checkGet(fdb_get_metaonly(_handle, doc));
+            found = checkGet(fdb_get_metaonly(_handle, doc));
         else
-            return checkGet(fdb_get(_handle, doc));
+            found = checkGet(fdb_get(_handle, doc));
+        countRead(_stats, doc);
+        if (filtered && !found)
+            DatabaseStats::add(_stats->keyFilterFalsePositives);
+        return found;
     }
 
     Document KeyStore::getByOffset(uint64_t offset, sequence seq) const {
@@ -85,6 +103,7 @@ namespace cbforest {
         doc._doc.offset = offset;
         doc._doc.seqnum = seq;
         checkGet(fdb_get_byoffset(_handle, doc));
+        countRead(_stats, doc);
         return doc;
     }
 
@@ -124,8 +143,17 @@ namespace cbforest {
         check(fdb_rollback(&_handle, seq));
     }
 
+    void KeyStoreWriter::addToKeyFilter(slice key) {
+        if (_keyFilter)
+            _keyFilter->add(key);
+    }
+
     void KeyStoreWriter::write(Document &doc) {
+        addToKeyFilter(doc.key());
         check(fdb_set(_handle, doc));
+        DatabaseStats::add(_stats->sets);
+        DatabaseStats::add(_stats->bytesWritten,
+                           doc.key().size + doc.meta().size + doc.body().size);
     }
 
     sequence KeyStoreWriter::set(slice key, slice meta, slice body) {
@@ -143,13 +171,20 @@ namespace cbforest {
         doc.body = (void*)body.buf;
         doc.bodylen = body.size;
 
+        addToKeyFilter(key);
         check(fdb_set(_handle, &doc));
+        DatabaseStats::add(_stats->sets);
+        DatabaseStats::add(_stats->bytesWritten, key.size + meta.size + body.size);
         Log("DB %p: added %s --> %s (meta %s) (seq %llu)\n",
             _handle, key.hexCString(), body.hexCString(), meta.hexCString(), doc.seqnum);
         return doc.seqnum;
     }
 
+    // Deleted keys are added to the key filter too, since deletion leaves a tombstone that a
+    // meta-only read can find.
     bool KeyStoreWriter::del(cbforest::Document &doc) {
+        addToKeyFilter(doc.key());
+        DatabaseStats::add(_stats->deletes);
         return checkGet(fdb_del(_handle, doc));
     }
 
@@ -164,6 +199,8 @@ namespace cbforest {
         doc.key = (void*)key.buf;
         doc.keylen = key.size;
 
+        addToKeyFilter(key);
+        DatabaseStats::add(_stats->deletes);
         return checkGet(fdb_del(_handle, &doc));
     }
 
@@ -12,11 +12,14 @@
 #include "Error.hh"
 #include "forestdb.h"
 #include "slice.hh"
+#include "Stats.hh"
 
 namespace cbforest {
 
     class Database;
+    class DocCache;
     class Document;
+    class KeyFilter;
     class KeyStoreWriter;
     class Transaction;
 
@@ -36,6 +39,17 @@ namespace cbforest {
 
         bool isOpen()                                       {return _handle != NULL;}
 
+        /** Activity counters of the database file this KeyStore belongs to. */
+        DatabaseStats& stats() const                        {return *_stats;}
+
+        /** The cache of decoded documents of the database file, or NULL if there isn't one
+            (as for KeyStoreWriters.) It may be disabled; check its enabled() method. */
+        DocCache* docCache() const                          {return _docCache;}
+
+        /** The Bloom filter of this store's keys. Lookups of keys it rules out don't touch the
+            database. It's disabled unless Database::setKeyFilterEnabled has been called. */
+        KeyFilter* keyFilter() const                        {return _keyFilter;}
+
         // Keys/values:
 
         enum contentOptions {
@@ -55,10 +69,14 @@ namespace cbforest {
         void erase();
 
     protected:
-        KeyStore(fdb_kvs_handle* handle)                    :_handle(handle) { }
+        KeyStore(fdb_kvs_handle* handle, DatabaseStats *stats)
+        :_handle(handle), _stats(stats) { }
         fdb_kvs_handle* handle() const                      {return _handle;}
 
         fdb_kvs_handle* _handle;
+        DatabaseStats* _stats;
+        DocCache* _docCache {nullptr};
+        KeyFilter* _keyFilter {nullptr};
 
     private:
         KeyStore(const KeyStore&) = delete;
@@ -73,7 +91,8 @@ namespace cbforest {
     /** Adds write access to a KeyStore. */
     class KeyStoreWriter : public KeyStore {
     public:
-        KeyStoreWriter(const KeyStore &store, Transaction&) :KeyStore(store._handle) { }
+        KeyStoreWriter(const KeyStore &store, Transaction&)
+        :KeyStore(store._handle, store._stats)      {_keyFilter = store._keyFilter;}
 
         sequence set(slice key, slice meta, slice value);
         sequence set(slice key, slice value)                {return set(key, slice::null, value);}
@@ -87,11 +106,19 @@ namespace cbforest {
 
         friend class KeyStore;
 
-        KeyStoreWriter(const KeyStoreWriter& k)            :KeyStore(k._handle) { }
-        KeyStoreWriter& operator=(const KeyStoreWriter &k) {_handle = k._handle; return *this;}
+        KeyStoreWriter(const KeyStoreWriter& k)
+        :KeyStore(k._handle, k._stats)                      {_keyFilter = k._keyFilter;}
+        KeyStoreWriter& operator=(const KeyStoreWriter &k) {
+            _handle = k._handle;
+            _stats = k._stats;
+            _keyFilter = k._keyFilter;
+            return *this;
+        }
 
     private:
-        KeyStoreWriter(KeyStore& store)                      :KeyStore(store._handle) { }
+        KeyStoreWriter(KeyStore& store)
+        :KeyStore(store._handle, store._stats)              {_keyFilter = store._keyFilter;}
+        void addToKeyFilter(slice key);
         friend class Transaction;
         friend class Database;
     };
@@ -0,0 +1,152 @@
+//
+//  LiveQuery.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "LiveQuery.hh"
+#include "LogInternal.hh"
+#include <algorithm>
+
+
+namespace cbforest {
+
+    static alloc_slice collatableDocID(slice docID) {
+        if (!docID.buf)
+            return alloc_slice();
+        CollatableBuilder c;
+        c << docID;
+        return alloc_slice(c.data());
+    }
+
+    LiveQuery::LiveQuery(Index *index,
+                         Collatable startKey, slice startKeyDocID,
+                         Collatable endKey, slice endKeyDocID,
+                         const DocEnumerator::Options &options,
+                         Callback callback)
+    :_index(index),
+     _min {startKey, collatableDocID(startKeyDocID), options.inclusiveStart},
+     _max {endKey,   collatableDocID(endKeyDocID),   options.inclusiveEnd},
+     _metaOnly((options.contentOptions & KeyStore::kMetaOnly) != 0),
+     _callback(callback)
+    {
+        if (options.descending)
+            std::swap(_min, _max);
+        _index->addObserver(this);
+    }
+
+    LiveQuery::LiveQuery(Index *index,
+                         std::vector<KeyRange> keyRanges,
+                         const DocEnumerator::Options &options,
+                         Callback callback)
+    :_index(index),
+     _min(),
+     _max(),
+     _keyRanges(keyRanges),
+     _metaOnly((options.contentOptions & KeyStore::kMetaOnly) != 0),
+     _callback(callback)
+    {
+        _index->addObserver(this);
+    }
+
+    LiveQuery::~LiveQuery() {
+        _index->removeObserver(this);
+    }
+
+
+    // Is a row's key (and docID) on the inner side of one end of the range?
+    static bool within(slice key, slice docID, const Collatable &boundKey, slice boundDocID,
+                       bool inclusive, bool isMax)
+    {
+        if (boundKey.empty())
+            return true;
+        int cmp = key.compare(boundKey);
+        if (isMax)
+            cmp = -cmp;
+        if (cmp != 0)
+            return cmp > 0;
+        if (!inclusive)
+            return false;
+        if (!boundDocID.buf)
+            return true;
+        cmp = docID.compare(boundDocID);
+        return isMax ? cmp <= 0 : cmp >= 0;
+    }
+
+    bool LiveQuery::matches(slice rowKey) const {
+        // Raw row keys are [key, docID] or [key, docID, emitIndex]; see IndexWriter::update.
+        CollatableReader reader(rowKey);
+        reader.beginArray();
+        slice key = reader.read();
+        if (_keyRanges.empty()) {
+            slice docID = reader.read();
+            return within(key, docID, _min.key, _min.docID, _min.inclusive, false)
+                && within(key, docID, _max.key, _max.docID, _max.inclusive, true);
+        }
+        for (auto &range : _keyRanges) {
+            if (!(key < (slice)range.start) && !range.isKeyPastEnd(key))
+                return true;
+        }
+        return false;
+    }
+
+
+    // The callback is only called once until the changes are taken. Caller must lock _mutex.
+    bool LiveQuery::shouldNotify() {
+        if (_notified)
+            return false;
+        _notified = true;
+        return true;
+    }
+
+    void LiveQuery::indexChanged(const std::vector<IndexChange> &changes) {
+        bool notify = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            size_t count = _changes.size();
+            for (auto &change : changes) {
+                if (matches(change.row.rowKey)) {
+                    _changes.push_back(change);
+                    if (_metaOnly)
+                        _changes.back().row.value = alloc_slice();
+                }
+            }
+            if (_changes.size() > count)
+                notify = shouldNotify();
+        }
+        if (notify && _callback)
+            _callback();
+    }
+
+    void LiveQuery::indexErased() {
+        bool notify;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Debug("LiveQuery: Index '%s' erased", _index->name().c_str());
+            _changes.clear();
+            _reset = true;
+            notify = shouldNotify();
+        }
+        if (notify && _callback)
+            _callback();
+    }
+
+    std::vector<IndexChange> LiveQuery::changes(bool &reset) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<IndexChange> result;
+        result.swap(_changes);
+        reset = _reset;
+        _reset = false;
+        _notified = false;
+        return result;
+    }
+
+}
@@ -0,0 +1,85 @@
+//
+//  LiveQuery.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__LiveQuery__
+#define __CBForest__LiveQuery__
+#include "Index.hh"
+#include <functional>
+#include <mutex>
+#include <vector>
+
+
+namespace cbforest {
+
+    /** Follows the changes to an Index's rows within a query's key range, or key ranges, so
+        that the query's results can be kept up to date without running it again. The rows
+        added, removed or rewritten by each committed IndexWriter are collected (in order) until
+        taken by changes(). The range is given as to an IndexEnumerator; skip and limit are
+        ignored, since the changes to a window of rows can't be known without reading the
+        rows around them.
+        It must be created and destroyed by the owner of the Index, while it isn't being
+        updated; changes() can be called on any thread. */
+    class LiveQuery : Index::Observer {
+    public:
+        /** Called, on the thread that commits index changes, when changes become available
+            after changes() last returned. It may call changes(), but not use the Index. */
+        typedef std::function<void()> Callback;
+
+        LiveQuery(Index*,
+                  Collatable startKey, slice startKeyDocID,
+                  Collatable endKey, slice endKeyDocID,
+                  const DocEnumerator::Options&,
+                  Callback);
+
+        LiveQuery(Index*,
+                  std::vector<KeyRange> keyRanges,
+                  const DocEnumerator::Options&,
+                  Callback);
+
+        ~LiveQuery();
+
+        /** Returns and forgets the changes collected so far. `reset` is set to true if all the
+            rows were removed (i.e. the index was erased) before these changes. */
+        std::vector<IndexChange> changes(bool &reset);
+
+        /** Does a row, identified by its raw key, fall within the query? */
+        bool matches(slice rowKey) const;
+
+    private:
+        // One end of a key range; the docID is in collatable form, or null for none.
+        struct Bound {
+            Collatable key;
+            alloc_slice docID;
+            bool inclusive;
+        };
+
+        virtual void indexChanged(const std::vector<IndexChange>&) override;
+        virtual void indexErased() override;
+        bool shouldNotify();
+
+        Index* const _index;
+        Bound _min, _max;
+        std::vector<KeyRange> _keyRanges;
+        const bool _metaOnly;
+        const Callback _callback;
+
+        std::mutex _mutex;                  // guards the following
+        std::vector<IndexChange> _changes;
+        bool _reset {false};
+        bool _notified {false};             // callback called since changes() was last called
+    };
+
+}
+
+#endif /* defined(__CBForest__LiveQuery__) */
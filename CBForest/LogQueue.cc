@@ -0,0 +1,177 @@
+//
+//  LogQueue.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "LogQueue.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace cbforest {
+
+    LogQueue& LogQueue::shared() {
+        // Never destroyed, since other threads may still be logging during process exit;
+        // instead an atexit handler delivers whatever's left.
+        static LogQueue* sQueue = [] {
+            auto queue = new LogQueue;
+            atexit([] {LogQueue::shared().stop();});
+            return queue;
+        }();
+        return *sQueue;
+    }
+
+
+    LogQueue::LogQueue() {
+        for (size_t i = 0; i < kCapacity; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+            _slots[i].heapText = NULL;
+        }
+    }
+
+
+    bool LogQueue::post(logLevel level, const char *format, va_list args) noexcept {
+        // Claim a slot:
+        Slot *slot;
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &_slots[pos & (kCapacity - 1)];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);     // queue is full
+                return false;
+            } else {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Format the message into it. The arguments can't be saved for later, since they may
+        // point to temporaries that won't outlive this call.
+        va_list args2;
+        va_copy(args2, args);
+        int len = vsnprintf(slot->text, kInlineSize, format, args);
+        slot->heapText = NULL;
+        if (len >= (int)kInlineSize) {
+            slot->heapText = (char*)malloc(len + 1);
+            if (slot->heapText)
+                vsnprintf(slot->heapText, len + 1, format, args2);
+        }
+        va_end(args2);
+        slot->level = level;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        // Wake the delivery thread if it's blocked. The fence pairs with the one in run(): either
+        // this sees _waiting, or the delivery thread sees the new message before it blocks.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cond.notify_one();
+        }
+        return true;
+    }
+
+
+    bool LogQueue::isEmpty() const {
+        size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        auto &slot = _slots[pos & (kCapacity - 1)];
+        return slot.sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+
+    // Called only on the delivery thread.
+    bool LogQueue::deliverNext() {
+        size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        Slot &slot = _slots[pos & (kCapacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+            return false;
+        auto callback = LogCallback;
+        if (callback)
+            callback(slot.level, (slot.heapText ? slot.heapText : slot.text));
+        free(slot.heapText);
+        slot.heapText = NULL;
+        slot.sequence.store(pos + kCapacity, std::memory_order_release);
+        _dequeuePos.store(pos + 1, std::memory_order_release);
+
+        uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped > _droppedReported && callback) {
+            char message[80];
+            sprintf(message, "Log queue overflowed; dropped %llu messages",
+                    (unsigned long long)(dropped - _droppedReported));
+            _droppedReported = dropped;
+            callback(kWarning, message);
+        }
+        return true;
+    }
+
+
+    void LogQueue::run() {
+        for (;;) {
+            while (deliverNext())
+                ;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _flushCond.notify_all();
+            _waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (isEmpty()) {
+                if (_stopping)
+                    break;
+                _cond.wait(lock);
+            }
+            _waiting.store(false, std::memory_order_relaxed);
+        }
+        _waiting.store(false, std::memory_order_relaxed);
+    }
+
+
+    void LogQueue::start() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_running)
+            return;
+        _stopping = false;
+        _running = true;
+        _thread = std::thread([this] {run();});
+    }
+
+
+    void LogQueue::stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_running)
+                return;
+            _stopping = true;
+            _cond.notify_one();
+        }
+        _thread.join();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+    }
+
+
+    void LogQueue::flush() {
+        size_t target = _enqueuePos.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_running || _thread.get_id() == std::this_thread::get_id())
+            return;
+        _cond.notify_one();
+        // A message whose slot was claimed but not yet filled in holds up the drain, so this
+        // waits for the dequeue position rather than for the queue to be empty:
+        _flushCond.wait(lock, [&] {
+            return _dequeuePos.load(std::memory_order_acquire) >= target || !_running;
+        });
+    }
+
+}
@@ -0,0 +1,85 @@
+//
+//  LogQueue.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__LogQueue__
+#define __CBForest__LogQueue__
+#include "Database.hh"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdarg.h>
+#include <thread>
+
+
+namespace cbforest {
+
+    /** A bounded queue of formatted log messages, which a background thread delivers to
+        LogCallback. Any number of threads can post to it without taking a lock or allocating
+        (unless a message is too long to fit in a slot.) If the queue is full, the message is
+        dropped and counted, and the count is reported in a warning once there's room.
+        The algorithm is Dmitry Vyukov's bounded MPMC queue, with a single consumer. */
+    class LogQueue {
+    public:
+        /** The process-wide queue used by _Log when asynchronous logging is enabled. */
+        static LogQueue& shared();
+
+        /** Formats a message into the queue. Returns false if it was dropped. */
+        bool post(logLevel, const char *format, va_list args) noexcept;
+
+        /** Starts the delivery thread, if it isn't already running. */
+        void start();
+
+        /** Delivers all queued messages, then stops the delivery thread. */
+        void stop();
+
+        /** Blocks until every message posted before the call has been delivered (or dropped.) */
+        void flush();
+
+        bool running() const                {return _running;}
+        uint64_t droppedCount() const       {return _dropped.load(std::memory_order_relaxed);}
+
+        static const size_t kCapacity = 1024;       // must be a power of 2
+        static const size_t kInlineSize = 240;      // longer messages are allocated on the heap
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            logLevel level;
+            char *heapText;
+            char text[kInlineSize];
+        };
+
+        LogQueue();
+        bool isEmpty() const;
+        bool deliverNext();
+        void run();
+
+        Slot _slots[kCapacity];
+        std::atomic<size_t> _enqueuePos {0};
+        std::atomic<size_t> _dequeuePos {0};
+        std::atomic<uint64_t> _dropped {0};
+        uint64_t _droppedReported {0};
+
+        std::mutex _mutex;
+        std::condition_variable _cond;          // wakes the delivery thread
+        std::condition_variable _flushCond;     // signaled when the delivery thread drains
+        std::atomic<bool> _waiting {false};     // is the delivery thread blocked on _cond?
+        bool _stopping {false};
+        std::atomic<bool> _running {false};
+        std::thread _thread;
+    };
+
+}
+
+#endif /* defined(__CBForest__LogQueue__) */
@@ -38,6 +38,15 @@ namespace cbforest {
         Document state = _store.get(stateKey);
         CollatableReader reader(state.body());
         if (reader.peekTag() == CollatableReader::kArray) {
+            // If another handle on the index has saved the state since this one last read or
+            // saved it, this one's observers haven't seen its changes, so they must start over:
+            bool changedElsewhere = (_stateReadAt > 0 && state.sequence() != _stateReadAt);
+            _stateReadAt = state.sequence();
+            if (changedElsewhere) {
+                Debug("MapReduceIndex<%p>: State was changed by another handle", this);
+                erased();
+            }
+
             reader.beginArray();
             _lastSequenceIndexed = reader.readInt();
             _lastSequenceChangedAt = reader.readInt();
@@ -53,14 +62,31 @@ namespace cbforest {
             }
             if (reader.peekTag() != CollatableTypes::kEndSequence)
                 _lastPurgeCount = (uint64_t)reader.readInt();
+            _lastGeoKeyScheme = kGeohashKeys;
+            if (reader.peekTag() != CollatableTypes::kEndSequence)
+                _lastGeoKeyScheme = (GeoKeyScheme)reader.readInt();
+            if (reader.peekTag() != CollatableTypes::kEndSequence)
+                _eraseCount = (uint64_t)reader.readInt();   // may have been erased by another handle
+
+            if (!_geoKeySchemeSet) {
+                // Query and update the index with the scheme it was built with:
+                _geoKeyScheme = _lastGeoKeyScheme;
+            } else if (_geoKeyScheme != _lastGeoKeyScheme) {
+                Debug("MapReduceIndex<%p>: Index was built with geo key scheme %d, not %d",
+                      this, _lastGeoKeyScheme, _geoKeyScheme);
+                invalidate();
+            }
+        } else if (_lastSequenceIndexed > 0) {
+            // The state is gone, so another handle has erased the index:
+            deleted();
         }
         Debug("MapReduceIndex<%p>: Read state (lastSeq=%lld, lastChanged=%lld, lastMapVersion='%s', indexType=%d, rowCount=%d, lastPurgeCount=%llu)",
               this, _lastSequenceIndexed, _lastSequenceChangedAt, _lastMapVersion.c_str(), _indexType, _rowCount, _lastPurgeCount);
     }
 
     void MapReduceIndex::saveState(Transaction& t) {
-        CBFAssert(t.database()->contains(_store));
         _lastMapVersion = _mapVersion;
+        _lastGeoKeyScheme = _geoKeyScheme;
 
         CollatableBuilder stateKey;
         stateKey.addNull();
@@ -68,10 +94,11 @@ namespace cbforest {
         CollatableBuilder state;
         state.beginArray();
         state << _lastSequenceIndexed << _lastSequenceChangedAt << _lastMapVersion << _indexType
-              << _rowCount << kCurFormatVersion << _lastPurgeCount;
+              << _rowCount << kCurFormatVersion << _lastPurgeCount << (int)_lastGeoKeyScheme
+              << _eraseCount;
         state.endArray();
 
-        _stateReadAt = t(_store).set(stateKey, state);
+        _stateReadAt = t(storeIn(t)).set(stateKey, state);
         Debug("MapReduceIndex<%p>: Saved state (lastSeq=%lld, lastChanged=%lld, lastMapVersion='%s', indexType=%d, rowCount=%d, lastPurgeCount=%llu)",
               this, _lastSequenceIndexed, _lastSequenceChangedAt, _lastMapVersion.c_str(), _indexType, _rowCount, _lastPurgeCount);
     }
@@ -83,6 +110,8 @@ namespace cbforest {
         _lastPurgeCount = 0;
         _stateReadAt = 0;
         _rowCount = 0;
+        ++_eraseCount;
+        erased();
     }
 
     sequence MapReduceIndex::lastSequenceIndexed() const {
@@ -125,6 +154,16 @@ namespace cbforest {
         }
     }
 
+    void MapReduceIndex::setGeoKeyScheme(GeoKeyScheme scheme) {
+        readState();
+        _geoKeyScheme = scheme;
+        _geoKeySchemeSet = true;
+        if (scheme != _lastGeoKeyScheme) {
+            Debug("MapReduceIndex<%p>: Geo key scheme changed to %d", this, scheme);
+            invalidate();
+        }
+    }
+
     void MapReduceIndex::invalidate() {
         if (_lastSequenceIndexed > 0) {
             Debug("MapReduceIndex: Erasing invalidated index");
@@ -133,6 +172,8 @@ namespace cbforest {
         _lastSequenceIndexed = _lastSequenceChangedAt = _lastPurgeCount = 0;
         _rowCount = 0;
         _stateReadAt = 0;
+        ++_eraseCount;
+        erased();
     }
 
     void MapReduceIndex::erase() {
@@ -141,6 +182,8 @@ namespace cbforest {
         _lastSequenceIndexed = _lastSequenceChangedAt = _lastPurgeCount = 0;
         _rowCount = 0;
         _stateReadAt = 0;
+        ++_eraseCount;
+        erased();
     }
 
     alloc_slice MapReduceIndex::getSpecialEntry(slice docID, sequence seq, unsigned entryID) const
@@ -200,6 +243,7 @@ namespace cbforest {
 
         std::vector<Collatable> keys;
         std::vector<alloc_slice> values;
+        MapReduceIndex::GeoKeyScheme geoKeyScheme {MapReduceIndex::kGeohashKeys};
 
         void emit(Collatable key, alloc_slice value) {
             CollatableReader keyReader(key);
@@ -224,7 +268,7 @@ namespace cbforest {
         void reset() {
             keys.clear();
             values.clear();
-            // _tokenizer is stateless
+            // _tokenizers are stateless
         }
 
     private:
@@ -235,30 +279,41 @@ namespace cbforest {
         }
 
         void emitTextTokens(slice text, std::string languageCode, slice value) {
-            if (!_tokenizer || _tokenizer->stemmer() != languageCode) {
-                _tokenizer = std::unique_ptr<Tokenizer> {
-                    new Tokenizer(languageCode, (languageCode == "en")) };
-            }
-            std::unordered_map<std::string, CollatableBuilder> tokens;
+            // Keep one Tokenizer per language, so mixed-language docs don't keep recreating them:
+            auto iTokenizer = _tokenizers.find(languageCode);
+            if (iTokenizer == _tokenizers.end())
+                iTokenizer = _tokenizers.emplace(languageCode,
+                                                 Tokenizer(languageCode, (languageCode == "en"))).first;
+            // Collect the occurrences of each distinct token, linking together the occurrences
+            // of each token so they can be emitted in order:
+            _tokens.clear();
+            _occurrences.clear();
+            _tokenOccurrences.clear();
             int specialKey = -1;
-            for (TokenIterator i(*_tokenizer, slice(text), false); i; ++i) {
+            for (TokenIterator i(iTokenizer->second, slice(text), false); i; ++i) {
                 if (specialKey < 0) {
                     // Emit the full text being indexed, and the value, under a special key.
                     specialKey = emitSpecial(text, value);
                 }
-                // Add the word position to the value array for this token:
-                CollatableBuilder& tokValue = tokens[i.token()];
-                if (tokValue.empty()) {
-                    tokValue.beginArray();
-                    tokValue << specialKey;
-                }
-                tokValue << i.wordOffset() << i.wordLength();
+                bool added;
+                unsigned tokenIndex = _tokens.insert(i.token(), added);
+                int32_t occurrence = (int32_t)_occurrences.size();
+                _occurrences.push_back({(uint32_t)i.wordOffset(), (uint32_t)i.wordLength(), -1});
+                if (added)
+                    _tokenOccurrences.push_back({occurrence, occurrence});
+                else
+                    _occurrences[_tokenOccurrences[tokenIndex].second].next = occurrence;
+                _tokenOccurrences[tokenIndex].second = occurrence;
             }
 
-            // Emit each token string and value array as a key:
-            for (auto kv = tokens.begin(); kv != tokens.end(); ++kv) {
-                CollatableBuilder collKey(kv->first);
-                CollatableBuilder& collValue = kv->second;
+            // Emit each token string as a key, with an array of its word positions as the value:
+            for (unsigned t = 0; t < _tokens.count(); ++t) {
+                CollatableBuilder collKey(_tokens[t]);
+                CollatableBuilder collValue;
+                collValue.beginArray();
+                collValue << specialKey;
+                for (int32_t o = _tokenOccurrences[t].first; o >= 0; o = _occurrences[o].next)
+                    collValue << _occurrences[o].offset << _occurrences[o].length;
                 collValue.endArray();
                 _emit(collKey, collValue);
             }
@@ -272,14 +327,26 @@ namespace cbforest {
                   boundingBox.longitude.min, boundingBox.longitude.max);
             // Emit the bbox, geoJSON, and value, under a special key:
             unsigned specialKey = emitSpecial(boundingBox, geoJSON, value);
-            CollatableBuilder collValue(specialKey);
-
-            // Now emit a set of geohashes that cover the given area:
-            auto hashes = boundingBox.coveringHashes();
-            for (auto iHash = hashes.begin(); iHash != hashes.end(); ++iHash) {
-                Debug("    hash='%s'", (const char*)(*iHash));
-                CollatableBuilder collKey(*iHash);
-                _emit(collKey, collValue);
+            // Each geohash row's value is the special key followed by the bbox, so queries can
+            // reject non-intersecting rows without having to look up the special key:
+            CollatableBuilder collValue;
+            collValue << specialKey << boundingBox;
+
+            // Now emit a set of geohashes (or Hilbert cells) that cover the given area:
+            if (geoKeyScheme == MapReduceIndex::kHilbertKeys) {
+                auto cells = boundingBox.coveringHilbertCells();
+                for (auto iCell = cells.begin(); iCell != cells.end(); ++iCell) {
+                    Debug("    cell='%s'", (const char*)(*iCell));
+                    CollatableBuilder collKey(slice((const char*)*iCell));
+                    _emit(collKey, collValue);
+                }
+            } else {
+                auto hashes = boundingBox.coveringHashes();
+                for (auto iHash = hashes.begin(); iHash != hashes.end(); ++iHash) {
+                    Debug("    hash='%s'", (const char*)(*iHash));
+                    CollatableBuilder collKey(*iHash);
+                    _emit(collKey, collValue);
+                }
             }
         }
 
@@ -310,7 +377,16 @@ namespace cbforest {
             return (unsigned)result;
         }
 
-        std::unique_ptr<Tokenizer> _tokenizer;
+        std::unordered_map<std::string, Tokenizer> _tokenizers;
+
+        // Scratch space for emitTextTokens, reused between calls to avoid allocation:
+        struct TokenOccurrence {
+            uint32_t offset, length;    // byte range of the word in the text
+            int32_t next;               // next occurrence of the same token, or -1
+        };
+        TokenTable _tokens;
+        std::vector<TokenOccurrence> _occurrences;
+        std::vector<std::pair<int32_t,int32_t>> _tokenOccurrences; // first/last occurrence of each token
     };
 
 
@@ -318,16 +394,26 @@ namespace cbforest {
 
 
     // In charge of updating one view's index. Owned by a MapReduceIndexer.
+    // The Transaction belongs to the MapReduceIndexer, and may be shared with other writers.
     class MapReduceIndexWriter: IndexWriter {
     public:
         MapReduceIndexWriter(MapReduceIndex *idx, Transaction *t)
         :IndexWriter(idx, *t),
          index(idx),
-         _documentType(index->documentType()),
-         _transaction(t)
-        { }
+         transaction(t),
+         _documentType(index->documentType())
+        {
+            _emitter.geoKeyScheme = index->geoKeyScheme();
+        }
 
         MapReduceIndex* const index;
+        Transaction* const transaction;
+
+        // True if the index's KeyStore was opened on another index's Database to share its
+        // Transaction, in which case it needs to be closed afterwards.
+        bool borrowsKeyStore() const {
+            return transaction->database() != index->database();
+        }
 
         bool shouldIndexDocument(const Document& doc) const {
             return doc.sequence() > index->_lastSequenceIndexed;
@@ -357,21 +443,17 @@ namespace cbforest {
             return false;
         }
 
+        // Saves the index's state; the caller then commits the transaction.
         void finish(sequence finalSequence) {
-            if (finalSequence > 0) {
-                index->_lastSequenceIndexed = std::max(index->_lastSequenceIndexed,
-                                                       finalSequence);
-                index->saveState(*_transaction);
-                _transaction->commit();
-            } else {
-                _transaction->abort();
-            }
+            index->_lastSequenceIndexed = std::max(index->_lastSequenceIndexed, finalSequence);
+            index->saveState(*transaction);
         }
 
+        using IndexWriter::notifyObservers;
+
     private:
         alloc_slice const _documentType;
         Emitter _emitter;
-        std::unique_ptr<Transaction> _transaction;
     };
 
     
@@ -380,9 +462,9 @@ namespace cbforest {
     
     void MapReduceIndexer::addIndex(MapReduceIndex* index) {
         CBFAssert(index);
+        CBFAssert(_writers.empty());    // can't add indexes once indexing has started
         index->checkForPurge(); // has to be called before creating the transaction
-        auto writer = new MapReduceIndexWriter(index, new Transaction(index->database()));
-        _writers.push_back(writer);
+        _indexes.push_back(index);
         if (index->documentType().buf)
             _docTypes.insert(index->documentType());
         else
@@ -390,7 +472,31 @@ namespace cbforest {
     }
 
 
+    // Creates the writers, and the transactions they write in. Indexes in the same file share
+    // a single transaction, since only one can be open on a file at a time; this also means
+    // the file is committed to only once.
+    void MapReduceIndexer::createWriters() {
+        if (!_writers.empty())
+            return;
+        for (auto index : _indexes) {
+            Transaction *t = nullptr;
+            for (auto trans : _transactions) {
+                if (trans->database()->filename() == index->database()->filename()) {
+                    t = trans;
+                    break;
+                }
+            }
+            if (!t) {
+                t = new Transaction(index->database());
+                _transactions.push_back(t);
+            }
+            _writers.push_back(new MapReduceIndexWriter(index, t));
+        }
+    }
+
+
     sequence MapReduceIndexer::startingSequence() {
+        createWriters();
         _latestDbSequence = _writers[0]->index->sourceStore().lastSequence();
 
         // First find the minimum sequence that not all indexes have indexed yet.
@@ -414,15 +520,42 @@ namespace cbforest {
 
 
     void MapReduceIndexer::finished(sequence seq) {
-        for (auto writer = _writers.begin(); writer != _writers.end(); ++writer) {
-            (*writer)->finish(seq);
+        if (seq > 0) {
+            for (auto writer = _writers.begin(); writer != _writers.end(); ++writer)
+                (*writer)->finish(seq);
+            for (auto t = _transactions.begin(); t != _transactions.end(); ++t)
+                (*t)->commit();
+            for (auto writer = _writers.begin(); writer != _writers.end(); ++writer) {
+                (*writer)->index->notifyErased();
+                (*writer)->notifyObservers();
+            }
+        } else {
+            for (auto t = _transactions.begin(); t != _transactions.end(); ++t)
+                (*t)->abort();
+            for (auto index : _indexes)
+                index->notifyErased();
         }
     }
 
     MapReduceIndexer::~MapReduceIndexer() {
+        // Note which KeyStores were borrowed from another index's Database, while the
+        // transactions (which know that Database) still exist:
+        std::vector<std::pair<Database*, std::string>> borrowed;
+        for (auto writer = _writers.begin(); writer != _writers.end(); ++writer) {
+            if ((*writer)->borrowsKeyStore())
+                borrowed.push_back({(*writer)->transaction->database(), (*writer)->index->name()});
+        }
+        for (auto t = _transactions.begin(); t != _transactions.end(); ++t) {
+            delete *t;
+        }
         for (auto writer = _writers.begin(); writer != _writers.end(); ++writer) {
             delete *writer;
         }
+        // In case finished() wasn't called, report any erasure the writers held back:
+        for (auto index : _indexes)
+            index->notifyErased();
+        for (auto b = borrowed.begin(); b != borrowed.end(); ++b)
+            b->first->closeKeyStore(b->second);
     }
 
     bool MapReduceIndexer::shouldMapDocIntoView(const Document &doc, unsigned viewNumber) {
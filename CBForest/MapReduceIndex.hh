@@ -42,6 +42,18 @@ namespace cbforest {
         void setDocumentType(slice docType)     {_documentType = docType;}
         alloc_slice documentType() const        {return _documentType;}
 
+        /** How geo-JSON keys are stored in the index. */
+        enum GeoKeyScheme {
+            kGeohashKeys = 0,   ///< Geohash strings (geohash::hash)
+            kHilbertKeys,       ///< Quadtree paths in Hilbert-curve order (geohash::hilbertCell)
+        };
+
+        /** Sets the geo key scheme. If it's different from the one the index was built with,
+            the index is invalidated. If it's never called, the index keeps using the scheme
+            it was built with (geohash for a new index.) */
+        void setGeoKeyScheme(GeoKeyScheme);
+        GeoKeyScheme geoKeyScheme() const       {return _geoKeyScheme;}
+
         /** The last source database sequence number to be indexed. */
         sequence lastSequenceIndexed() const;
 
@@ -54,6 +66,13 @@ namespace cbforest {
         /** Removes all the data in the index. */
         void erase();
 
+        /** The number of times the index has been erased or invalidated. It's saved in the
+            index's state, so it also counts erasures by other handles on the index, once
+            they've saved the state (call lastSequenceChangedAt() first to re-read it.)
+            Together with lastSequenceChangedAt, this tells whether the index's rows may have
+            changed. */
+        uint64_t eraseCount() const             {return _eraseCount;}
+
         /** Reads the full text passed to the call to emitTextTokens(), given some info about the
             document and the fullTextID available from IndexEnumerator::getTextToken(). */
         alloc_slice readFullText(slice docID, sequence seq, unsigned fullTextID) const;
@@ -76,10 +95,13 @@ namespace cbforest {
         Database* const _sourceDatabase;
         std::string _mapVersion, _lastMapVersion;
         int _indexType {0};
+        GeoKeyScheme _geoKeyScheme {kGeohashKeys}, _lastGeoKeyScheme {kGeohashKeys};
+        bool _geoKeySchemeSet {false};  // has setGeoKeyScheme been called?
         sequence _lastSequenceIndexed {0}, _lastSequenceChangedAt {0};
         sequence _stateReadAt {0}; // index sequence # at which state was last valid
         uint64_t _lastPurgeCount {0};   // db lastPurgeCount when index was last built
         uint64_t _rowCount {0};
+        uint64_t _eraseCount {0};
         alloc_slice _documentType;
 
         friend class MapReduceIndexer;
@@ -87,7 +109,8 @@ namespace cbforest {
     };
 
 
-    /** An activity that updates one or more map-reduce indexes. */
+    /** An activity that updates one or more map-reduce indexes. Indexes may share a file
+        (as KeyStores of it); their updates are then made in a single transaction. */
     class MapReduceIndexer {
     public:
         ~MapReduceIndexer();
@@ -97,7 +120,8 @@ namespace cbforest {
         /** If set, indexing will only occur if this index needs to be updated. */
         void triggerOnIndex(MapReduceIndex* index)  {_triggerIndex = index;}
 
-        /** Determines at which sequence indexing should start.
+        /** Determines at which sequence indexing should start, and begins the transaction(s).
+            Must be called after adding the indexes and before emitting anything.
             Returns UINT64_MAX if no re-indexing is necessary. */
         sequence startingSequence();
 
@@ -133,6 +157,10 @@ namespace cbforest {
         void finished(sequence seq =1);
 
     private:
+        void createWriters();
+
+        std::vector<MapReduceIndex*> _indexes;
+        std::vector<Transaction*> _transactions;    // one per index file
         std::vector<MapReduceIndexWriter*> _writers;
         MapReduceIndex* _triggerIndex {nullptr};
         sequence _latestDbSequence {0};
@@ -0,0 +1,203 @@
+//
+//  MemoryBudget.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "MemoryBudget.hh"
+#include "DocCache.hh"
+#include "LogInternal.hh"
+
+
+namespace cbforest {
+
+    const double MemoryBudget::kBufferCacheShare = 0.5;
+    const size_t MemoryBudget::kWALEntrySize = 128;
+    const double MemoryBudget::kMinDocCacheShare = 0.25;
+    const MemoryBudget::clock::duration MemoryBudget::kRebalanceInterval = std::chrono::seconds(5);
+
+
+    MemoryBudget& MemoryBudget::shared() {
+        // Never destroyed, since Databases may be closed (and unregistered) during process exit.
+        static MemoryBudget* sBudget = new MemoryBudget;
+        return *sBudget;
+    }
+
+
+    void MemoryBudget::setBudget(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (bytes == 0 && _budget > 0) {
+            // Back to the default of no DocCaches, rather than leaving the last shares:
+            for (auto &i : _files)
+                i.second.docCache->setCapacity(0);
+        }
+        _budget = bytes;
+        if (_forestDBInitialized && bytes > 0)
+            Log("MemoryBudget: Buffer cache size (%llu) can't change until ForestDB is shut down",
+                (unsigned long long)_bufferCacheSize);
+        _rebalance();
+    }
+
+    uint64_t MemoryBudget::budget() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _budget;
+    }
+
+    void MemoryBudget::configure(Database::config &config) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_budget > 0)
+            config.buffercache_size = (uint64_t)(_budget * kBufferCacheShare);
+    }
+
+
+    void MemoryBudget::addFile(const std::string &path, const Database::config &config,
+                               DatabaseStats &stats, DocCache &docCache,
+                               std::function<size_t()> keyFilterBytes)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_forestDBInitialized) {
+            // The first file opened initializes ForestDB's buffer cache:
+            _forestDBInitialized = true;
+            _bufferCacheSize = config.buffercache_size;
+        }
+        Entry &entry = _files[path];
+        if (entry.refCount++ == 0) {
+            entry.walThreshold = config.wal_threshold;
+            entry.stats = &stats;
+            entry.docCache = &docCache;
+            entry.keyFilterBytes = keyFilterBytes;
+            entry.lastActivity = activity(stats);
+            _rebalance();
+        }
+    }
+
+    void MemoryBudget::removeFile(const std::string &path) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _files.find(path);
+        if (i == _files.end() || --i->second.refCount > 0)
+            return;
+        if (_budget > 0)
+            i->second.docCache->setCapacity(0);     // free its memory while it's closed
+        _files.erase(i);
+        _rebalance();
+    }
+
+    void MemoryBudget::forestDBShutDown() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _forestDBInitialized = false;
+    }
+
+
+    void MemoryBudget::checkRebalance() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_budget > 0 && clock::now() - _lastRebalance >= kRebalanceInterval)
+            _rebalance();
+    }
+
+    void MemoryBudget::rebalance() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rebalance();
+    }
+
+    // Caller must lock _mutex.
+    void MemoryBudget::_rebalance() {
+        _lastRebalance = clock::now();
+        if (_budget == 0 || _files.empty())
+            return;
+        uint64_t used = _bufferCacheSize + walEstimate() + keyFilterBytes();
+        uint64_t docBudget = (_budget > used) ? _budget - used : 0;
+
+        // Each file's activity since the last rebalance. Only files whose DocCache is used
+        // (i.e. not view indexes) get a share:
+        std::vector<uint64_t> activities;
+        uint64_t totalActivity = 0;
+        size_t n = 0;
+        for (auto &i : _files) {
+            uint64_t now = activity(*i.second.stats);
+            uint64_t recent = (now > i.second.lastActivity) ? now - i.second.lastActivity : 0;
+            i.second.lastActivity = now;
+            if (!i.second.docCache->used())
+                recent = 0;
+            else
+                ++n;
+            activities.push_back(recent);
+            totalActivity += recent;
+        }
+        if (n == 0)
+            return;
+
+        uint64_t minShare = (uint64_t)(docBudget * kMinDocCacheShare / n);
+        uint64_t activeBudget = docBudget - minShare * n;
+        unsigned f = 0;
+        for (auto &i : _files) {
+            uint64_t share = 0;
+            if (i.second.docCache->used()) {
+                share = minShare;
+                if (totalActivity > 0)
+                    share += (uint64_t)((double)activeBudget * activities[f] / totalActivity);
+                else
+                    share += activeBudget / n;
+            }
+            i.second.docCache->setCapacity((size_t)share);
+            ++f;
+        }
+    }
+
+
+    void MemoryBudget::trim(TrimLevel level) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Log("MemoryBudget: Trimming memory (level %d)", level);
+        for (auto &i : _files) {
+            DocCache *cache = i.second.docCache;
+            if (level == kTrimCritical)
+                cache->clear();
+            else
+                cache->trimTo(cache->size() / 2);
+        }
+    }
+
+
+    MemoryBudget::Usage MemoryBudget::usage() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Usage u {};
+        u.budget = _budget;
+        u.bufferCache = _forestDBInitialized ? _bufferCacheSize : 0;
+        u.wal = walEstimate();
+        u.keyFilters = keyFilterBytes();
+        for (auto &i : _files) {
+            u.docCaches += i.second.docCache->size();
+            u.docCacheCapacity += i.second.docCache->capacity();
+        }
+        u.openFiles = (unsigned)_files.size();
+        return u;
+    }
+
+    // Caller must lock _mutex.
+    uint64_t MemoryBudget::walEstimate() const {
+        uint64_t total = 0;
+        for (auto &i : _files)
+            total += i.second.walThreshold * kWALEntrySize;
+        return total;
+    }
+
+    // Caller must lock _mutex.
+    uint64_t MemoryBudget::keyFilterBytes() const {
+        uint64_t total = 0;
+        for (auto &i : _files)
+            total += i.second.keyFilterBytes();
+        return total;
+    }
+
+    uint64_t MemoryBudget::activity(const DatabaseStats &stats) {
+        return stats.gets + stats.sets + stats.deletes + stats.iteratorSteps;
+    }
+
+}
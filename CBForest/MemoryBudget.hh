@@ -0,0 +1,127 @@
+//
+//  MemoryBudget.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__MemoryBudget__
+#define __CBForest__MemoryBudget__
+#include "Database.hh"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cbforest {
+
+    class DocCache;
+
+    /** Process-wide accounting of the memory used by open database files, and optionally a
+        total budget for it. Every open Database registers its file.
+        With a budget, ForestDB's buffer cache gets a fixed share of it (ForestDB only reads the
+        size when it initializes, i.e. when the first file is opened), and what's left after the
+        write-ahead logs and key filters is divided among the DocCaches that are used (see
+        DocCache::noteUsed; index files' aren't): each gets a minimum share, and the rest goes
+        to the files in proportion to their recent activity. The division is recomputed when
+        files are opened or closed, and periodically as they're accessed. Without a budget (the
+        default) DocCache sizes are left alone. */
+    class MemoryBudget {
+    public:
+        struct Usage {
+            uint64_t budget;                // 0 if none
+            uint64_t bufferCache;           // ForestDB's buffer cache size (allocated as it fills)
+            uint64_t wal;                   // estimated memory of open files' WAL indexes
+            uint64_t docCaches;             // bytes used by DocCaches
+            uint64_t docCacheCapacity;      // sum of the DocCaches' capacities
+            uint64_t keyFilters;            // bytes used by KeyFilters
+            unsigned openFiles;
+        };
+
+        enum TrimLevel {
+            kTrimModerate,                  // evict half of every DocCache
+            kTrimCritical,                  // empty every DocCache
+        };
+
+        static MemoryBudget& shared();
+
+        /** Sets the total budget in bytes; 0 removes it, and sets the DocCaches' capacities
+            back to 0 (disabled), the default. */
+        void setBudget(uint64_t bytes);
+        uint64_t budget();
+
+        /** Sets a config's buffer cache size to its share of the budget, if there is one.
+            Call before opening a file. */
+        void configure(Database::config&);
+
+        /** Registers an open file. Calls are counted, so every call must be balanced by a call
+            to removeFile. `keyFilterBytes` returns the memory used by the file's KeyFilters. */
+        void addFile(const std::string &path, const Database::config&,
+                     DatabaseStats&, DocCache&, std::function<size_t()> keyFilterBytes);
+        void removeFile(const std::string &path);
+
+        /** Call when ForestDB has been shut down, so its next buffer cache size is known. */
+        void forestDBShutDown();
+
+        /** Cheap enough to call on every access; now and then it redivides the budget. */
+        void noteAccess() {
+            if (++_accessCount % kAccessesPerCheck == 0)
+                checkRebalance();
+        }
+
+        /** Redivides the DocCache budget among the open files. */
+        void rebalance();
+
+        /** Frees memory, in response to memory pressure from the OS. */
+        void trim(TrimLevel);
+
+        Usage usage();
+
+        static const double kBufferCacheShare;      // fraction of the budget
+        static const size_t kWALEntrySize;          // est. memory per WAL entry
+        static const double kMinDocCacheShare;      // fraction divided equally among files
+
+    private:
+        typedef std::chrono::steady_clock clock;
+        struct Entry {
+            unsigned refCount {0};
+            uint64_t walThreshold {0};
+            DatabaseStats *stats {nullptr};
+            DocCache *docCache {nullptr};
+            std::function<size_t()> keyFilterBytes;
+            uint64_t lastActivity {0};      // activity count at the last rebalance
+        };
+
+        MemoryBudget() { }
+        void checkRebalance();
+        void _rebalance();
+        uint64_t walEstimate() const;
+        uint64_t keyFilterBytes() const;
+        static uint64_t activity(const DatabaseStats&);
+
+        static const unsigned kAccessesPerCheck = 1024;
+        static const clock::duration kRebalanceInterval;
+
+        std::mutex _mutex;                  // guards everything below
+        std::unordered_map<std::string, Entry> _files;
+        uint64_t _budget {0};
+        uint64_t _bufferCacheSize {0};      // as ForestDB was (or will be) initialized with
+        bool _forestDBInitialized {false};
+        clock::time_point _lastRebalance;
+
+        std::atomic<unsigned> _accessCount {0};
+    };
+
+}
+
+#endif /* defined(__CBForest__MemoryBudget__) */
@@ -0,0 +1,159 @@
+//
+//  QueryCache.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "QueryCache.hh"
+#include "MapReduceIndex.hh"
+#include "LogInternal.hh"
+#include "varint.hh"
+
+
+namespace cbforest {
+
+    void QueryCache::setCapacity(size_t bytes) {
+        _capacity = bytes;
+        trim(bytes);
+    }
+
+    void QueryCache::clear() {
+        _items.clear();
+        _itemsByKey.clear();
+        _size = 0;
+    }
+
+    // Evicts least recently used items until the cache fits in maxSize.
+    void QueryCache::trim(size_t maxSize) {
+        while (_size > maxSize) {
+            Item &item = _items.back();
+            _size -= item.cost;
+            _itemsByKey.erase(item.key);
+            _items.pop_back();
+        }
+    }
+
+    // Empties the cache if the index's rows may have changed since they were cached.
+    void QueryCache::validate() {
+        sequence storeSequence = _index.storeSequence();
+        if (_valid && storeSequence == _storeSequence && _index.eraseCount() == _eraseCount)
+            return;     // the index hasn't been written to
+        sequence changedAt = _index.lastSequenceChangedAt();    // (re-reads the saved state)
+        uint64_t eraseCount = _index.eraseCount();
+        if (!_valid || changedAt != _lastSequenceChangedAt || eraseCount != _eraseCount) {
+            if (!_items.empty())
+                Debug("QueryCache: Index '%s' changed; emptying", _index.name().c_str());
+            clear();
+            ++_generation;
+            _lastSequenceChangedAt = changedAt;
+            _eraseCount = eraseCount;
+            _valid = true;
+        }
+        _storeSequence = storeSequence;
+    }
+
+    uint64_t QueryCache::generation() {
+        validate();
+        return _generation;
+    }
+
+
+    QueryCache::RowsRef QueryCache::get(const std::string &queryKey) {
+        if (!enabled())
+            return RowsRef();
+        validate();
+        auto i = _itemsByKey.find(queryKey);
+        if (i == _itemsByKey.end())
+            return RowsRef();
+        _items.splice(_items.begin(), _items, i->second);   // move to front
+        return i->second->rows;
+    }
+
+    void QueryCache::put(const std::string &queryKey, Rows &&rows, uint64_t gen) {
+        if (!enabled() || generation() != gen)
+            return;
+        size_t itemCost = kItemOverhead + 2 * queryKey.size();
+        for (auto &row : rows)
+            itemCost += cost(row);
+        if (itemCost > _capacity)
+            return;
+        auto i = _itemsByKey.find(queryKey);
+        if (i != _itemsByKey.end()) {
+            _size -= i->second->cost;
+            _items.erase(i->second);
+            _itemsByKey.erase(i);
+        }
+        _items.push_front({queryKey, std::make_shared<const Rows>(std::move(rows)), itemCost});
+        _itemsByKey[queryKey] = _items.begin();
+        _size += itemCost;
+        trim(_capacity);
+    }
+
+
+    static void addCommonOptions(CollatableBuilder &key, const DocEnumerator::Options &options)
+    {
+        key << (double)options.skip << (double)options.limit;
+        key.addBool(options.descending);
+        key.addBool((options.contentOptions & KeyStore::kMetaOnly) != 0);
+    }
+
+    // Finishes a query key by appending the resume token. It's binary, so it's appended as raw
+    // bytes after its length; as a Collatable string, different tokens could come out the same.
+    static std::string withResumeToken(const CollatableBuilder &key, slice resumeAfter) {
+        std::string result = (std::string)key.data();
+        char lengthBuf[kMaxVarintLen64];
+        result.append(lengthBuf, PutUVarInt(lengthBuf, resumeAfter.size));
+        if (resumeAfter.size > 0)
+            result.append((const char*)resumeAfter.buf, resumeAfter.size);
+        return result;
+    }
+
+    std::string QueryCache::keyFor(Collatable startKey, slice startKeyDocID,
+                                   Collatable endKey, slice endKeyDocID,
+                                   const DocEnumerator::Options &options, slice resumeAfter)
+    {
+        // The docIDs and inclusive flags don't matter without their keys:
+        CollatableBuilder key;
+        key.beginArray();
+        addCommonOptions(key, options);
+        if (startKey.empty()) {
+            key.addNull();
+        } else {
+            key << startKey << startKeyDocID;
+            key.addBool(options.inclusiveStart);
+        }
+        if (endKey.empty()) {
+            key.addNull();
+        } else {
+            key << endKey << endKeyDocID;
+            key.addBool(options.inclusiveEnd);
+        }
+        key.endArray();
+        return withResumeToken(key, resumeAfter);
+    }
+
+    std::string QueryCache::keyFor(const std::vector<KeyRange> &keyRanges,
+                                   const DocEnumerator::Options &options, slice resumeAfter)
+    {
+        CollatableBuilder key;
+        key.beginArray();
+        addCommonOptions(key, options);
+        key.beginArray();
+        for (auto &range : keyRanges) {
+            key << range.start << range.end;
+            key.addBool(range.inclusiveEnd);
+        }
+        key.endArray();
+        key.endArray();
+        return withResumeToken(key, resumeAfter);
+    }
+
+}
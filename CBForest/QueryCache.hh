@@ -0,0 +1,105 @@
+//
+//  QueryCache.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__QueryCache__
+#define __CBForest__QueryCache__
+#include "Index.hh"
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cbforest {
+
+    class MapReduceIndex;
+
+    /** A size-bounded LRU cache of the results of a MapReduceIndex's queries, so that repeating
+        a query on an unchanged index returns its rows from memory instead of reading the index.
+        Results are looked up by a key made from the query's parameters (see keyFor.) All the
+        cached results belong to one state of the index, identified by its lastSequenceChangedAt
+        and eraseCount, and the cache is emptied when that changes. Checking is cheap while the
+        index's KeyStore hasn't been written to at all, since then it can't have changed.
+        The capacity starts at 0, which disables the cache. It isn't thread-safe. */
+    class QueryCache {
+    public:
+        typedef std::vector<IndexRow> Rows;
+        typedef std::shared_ptr<const Rows> RowsRef;
+
+        explicit QueryCache(MapReduceIndex &index)  :_index(index) { }
+
+        /** Sets the maximum number of bytes the cache may use. 0 disables it, and empties it. */
+        void setCapacity(size_t bytes);
+        size_t capacity() const             {return _capacity;}
+        bool enabled() const                {return _capacity > 0;}
+
+        /** The number of bytes currently used, including bookkeeping overhead. */
+        size_t size() const                 {return _size;}
+
+        /** Returns the rows of a query, if cached since the index last changed. */
+        RowsRef get(const std::string &queryKey);
+
+        /** Identifies the index state that newly read rows belong to. Get it before starting a
+            query whose rows will be passed to put(). */
+        uint64_t generation();
+
+        /** Adds the rows of a query, unless the index has changed since `generation` was
+            returned by generation(), or they don't fit. */
+        void put(const std::string &queryKey, Rows&&, uint64_t generation);
+
+        /** Removes everything. */
+        void clear();
+
+        /** The approximate memory used by a cached row. */
+        static size_t cost(const IndexRow &row) {return kRowOverhead + row.rowKey.size
+                                                                      + row.value.size;}
+
+        /** Query keys. Parameters that have no effect on the results are left out, so that
+            equivalent queries share results. */
+        static std::string keyFor(Collatable startKey, slice startKeyDocID,
+                                  Collatable endKey, slice endKeyDocID,
+                                  const DocEnumerator::Options&, slice resumeAfter);
+        static std::string keyFor(const std::vector<KeyRange>&,
+                                  const DocEnumerator::Options&, slice resumeAfter);
+
+    private:
+        struct Item {
+            std::string key;
+            RowsRef rows;
+            size_t cost;
+        };
+
+        void validate();
+        void trim(size_t maxSize);
+
+        static const size_t kItemOverhead = 128, kRowOverhead = 64;
+
+        MapReduceIndex &_index;
+        size_t _capacity {0};
+        size_t _size {0};
+        std::list<Item> _items;             // most recently used first
+        std::unordered_map<std::string, std::list<Item>::iterator> _itemsByKey;
+
+        // The index state the cached rows belong to:
+        bool _valid {false};
+        uint64_t _generation {0};
+        sequence _storeSequence {0};
+        sequence _lastSequenceChangedAt {0};
+        uint64_t _eraseCount {0};
+    };
+
+}
+
+#endif /* defined(__CBForest__QueryCache__) */
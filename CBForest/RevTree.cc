@@ -100,6 +100,21 @@ namespace cbforest {
         }
     }
 
+    void RevTree::decodeShared(alloc_slice raw_tree, sequence seq, uint64_t docOffset) {
+        decode(raw_tree, seq, docOffset);
+        _insertedData.push_back(raw_tree);
+    }
+
+    void RevTree::copyDecoded(const std::vector<Revision> &revs,
+                              alloc_slice raw_tree, uint64_t docOffset)
+    {
+        _bodyOffset = docOffset;
+        _revs = revs;
+        for (auto rev = _revs.begin(); rev != _revs.end(); ++rev)
+            rev->owner = this;
+        _insertedData.push_back(raw_tree);      // the revs point into it
+    }
+
     alloc_slice RevTree::encode() {
         sort();
 
@@ -132,6 +132,13 @@ namespace cbforest {
 #endif
 
     protected:
+        /** Decodes a tree from a ref-counted buffer, which it keeps a reference to. */
+        void decodeShared(alloc_slice raw_tree, sequence seq, uint64_t docOffset);
+
+        /** Makes this tree a copy of revisions that were decoded from `raw_tree` earlier,
+            instead of decoding it again. */
+        void copyDecoded(const std::vector<Revision>&, alloc_slice raw_tree, uint64_t docOffset);
+
         virtual bool isBodyOfRevisionAvailable(const Revision*, uint64_t atOffset) const;
         virtual alloc_slice readBodyOfRevision(const Revision*, uint64_t atOffset) const;
 #if DEBUG
@@ -0,0 +1,103 @@
+//
+//  Stats.cc
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#include "Stats.hh"
+#include <math.h>
+#include <algorithm>
+
+
+namespace cbforest {
+
+    // Returns the index of the highest 1 bit of n, which must be nonzero.
+    static inline unsigned highBit(uint64_t n) {
+        unsigned bit = 0;
+        if (n >> 32) {n >>= 32; bit += 32;}
+        if (n >> 16) {n >>= 16; bit += 16;}
+        if (n >>  8) {n >>=  8; bit +=  8;}
+        if (n >>  4) {n >>=  4; bit +=  4;}
+        if (n >>  2) {n >>=  2; bit +=  2;}
+        if (n >>  1) {bit += 1;}
+        return bit;
+    }
+
+    // Values below kSubBuckets get a bucket each. Above that, each power of two is split into
+    // kSubBuckets buckets, indexed by the kSubBucketBits bits following the highest 1 bit.
+    unsigned LatencyHistogram::bucketForValue(uint64_t value) {
+        if (value < kSubBuckets)
+            return (unsigned)value;
+        unsigned shift = highBit(value) - kSubBucketBits;
+        return ((shift + 1) << kSubBucketBits) + (unsigned)((value >> shift) & (kSubBuckets - 1));
+    }
+
+    uint64_t LatencyHistogram::maxValueInBucket(unsigned bucket) {
+        if (bucket < kSubBuckets)
+            return bucket;
+        unsigned shift = (bucket >> kSubBucketBits) - 1;
+        uint64_t minValue = (uint64_t)(kSubBuckets + (bucket & (kSubBuckets - 1))) << shift;
+        return minValue + (((uint64_t)1 << shift) - 1);
+    }
+
+    void LatencyHistogram::record(uint64_t nanos) {
+        _buckets[bucketForValue(nanos)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _total.fetch_add(nanos, std::memory_order_relaxed);
+        uint64_t curMax = _max.load(std::memory_order_relaxed);
+        while (nanos > curMax && !_max.compare_exchange_weak(curMax, nanos,
+                                                             std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t LatencyHistogram::percentile(double pct) const {
+        // Sum the buckets rather than using _count, since they may be changing concurrently:
+        uint64_t counts[kNumBuckets];
+        uint64_t total = 0;
+        for (unsigned b = 0; b < kNumBuckets; ++b)
+            total += (counts[b] = _buckets[b].load(std::memory_order_relaxed));
+        if (total == 0)
+            return 0;
+        auto target = (uint64_t)ceil(total * std::min(std::max(pct, 0.0), 100.0) / 100.0);
+        target = std::max(target, (uint64_t)1);
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < kNumBuckets; ++b) {
+            seen += counts[b];
+            if (seen >= target)
+                return std::min(maxValueInBucket(b), maxNanos());
+        }
+        return maxNanos();
+    }
+
+    void LatencyHistogram::reset() {
+        for (unsigned b = 0; b < kNumBuckets; ++b)
+            _buckets[b].store(0, std::memory_order_relaxed);
+        _count.store(0, std::memory_order_relaxed);
+        _total.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
+
+
+    void DatabaseStats::reset() {
+        std::atomic<uint64_t>* counters[] = {&gets, &sets, &deletes, &iteratorSteps, &bytesRead,
+                                             &bytesWritten, &indexRowsAdded, &indexRowsRemoved,
+                                             &compactions, &docCacheHits, &docCacheMisses,
+                                             &keyFilterSkips, &keyFilterFalsePositives};
+        for (auto counter : counters)
+            counter->store(0, std::memory_order_relaxed);
+        transactionWait.reset();
+        commit.reset();
+        revTreeDecode.reset();
+        revTreeEncode.reset();
+        fileSync.reset();
+    }
+
+}
@@ -0,0 +1,106 @@
+//
+//  Stats.hh
+//  CBForest
+//
+//  Copyright (c) 2016 Couchbase. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#ifndef __CBForest__Stats__
+#define __CBForest__Stats__
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+
+namespace cbforest {
+
+    /** A histogram of durations, in the style of HdrHistogram: buckets are logarithmic with
+        3 bits of sub-bucket precision, so any duration is recorded to within 12.5% in a fixed
+        amount of memory. Recording is lock-free and can be done from any thread. */
+    class LatencyHistogram {
+    public:
+        LatencyHistogram()                      {reset();}
+
+        void record(uint64_t nanos);
+
+        uint64_t count() const                  {return _count.load(std::memory_order_relaxed);}
+        uint64_t totalNanos() const             {return _total.load(std::memory_order_relaxed);}
+        uint64_t maxNanos() const               {return _max.load(std::memory_order_relaxed);}
+
+        /** Returns the duration that the given percentage (0-100) of samples didn't exceed,
+            rounded up to the top of its bucket. */
+        uint64_t percentile(double pct) const;
+
+        void reset();
+
+    private:
+        static const unsigned kSubBucketBits = 3;
+        static const unsigned kSubBuckets = 1 << kSubBucketBits;
+        static const unsigned kNumBuckets = (64 - kSubBucketBits + 1) << kSubBucketBits;
+
+        static unsigned bucketForValue(uint64_t);
+        static uint64_t maxValueInBucket(unsigned bucket);
+
+        std::atomic<uint64_t> _buckets[kNumBuckets];
+        std::atomic<uint64_t> _count, _total, _max;
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+    };
+
+
+    /** Records the time from its construction to its destruction into a LatencyHistogram. */
+    class LatencyTimer {
+    public:
+        explicit LatencyTimer(LatencyHistogram &h)  :_histogram(h), _start(clock::now()) { }
+        ~LatencyTimer() {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _start);
+            _histogram.record(elapsed.count());
+        }
+    private:
+        typedef std::chrono::steady_clock clock;
+        LatencyHistogram &_histogram;
+        clock::time_point _start;
+    };
+
+
+    /** Activity counters for a database file, shared by all Database instances on that file.
+        They accumulate for the lifetime of the process, or until reset. */
+    struct DatabaseStats {
+        std::atomic<uint64_t> gets {0};             // documents read by key, sequence or offset
+        std::atomic<uint64_t> sets {0};
+        std::atomic<uint64_t> deletes {0};
+        std::atomic<uint64_t> iteratorSteps {0};    // documents returned by DocEnumerators
+        std::atomic<uint64_t> bytesRead {0};        // meta + body bytes of documents read
+        std::atomic<uint64_t> bytesWritten {0};     // key + meta + body bytes of documents set
+        std::atomic<uint64_t> indexRowsAdded {0};
+        std::atomic<uint64_t> indexRowsRemoved {0};
+        std::atomic<uint64_t> compactions {0};
+        std::atomic<uint64_t> docCacheHits {0};     // lookups in the file's DocCache
+        std::atomic<uint64_t> docCacheMisses {0};
+        std::atomic<uint64_t> keyFilterSkips {0};   // lookups of absent keys the filter caught
+        std::atomic<uint64_t> keyFilterFalsePositives {0};  // absent keys the filter let through
+
+        LatencyHistogram transactionWait;           // waiting for another Transaction to end
+        LatencyHistogram commit;
+        LatencyHistogram revTreeDecode;
+        LatencyHistogram revTreeEncode;
+        LatencyHistogram fileSync;                  // background fsyncs (see FileSyncer)
+
+        static void add(std::atomic<uint64_t> &counter, uint64_t n =1) {
+            counter.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void reset();
+    };
+
+}
+
+#endif /* defined(__CBForest__Stats__) */
@@ -17,6 +17,9 @@
 #include "english_stopwords.h"
 #include "LogInternal.hh"
 #include "Error.hh"
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
 
 #ifndef __unused
 #define __unused
@@ -35,19 +38,26 @@ namespace cbforest {
 
     static const struct sqlite3_tokenizer_module* sModule;
     static std::unordered_map<std::string, word_set> sStemmerToStopwords;
+    static std::once_flag sModuleOnce;
 
-    // Reads a space-delimited list of words from a C string (as found in english_stopwords.h)
-    static word_set readWordList(const char* cString) {
-        word_set stopwords;
-        const char* space;
-        do {
-            space = strchr(cString, ' ');
-            size_t length = space ? (space-cString) : strlen(cString);
-            std::string word(cString, length);
-            stopwords[word] = true;
-            cString = space+1;
-        } while (space);
-        return stopwords;
+    // Per-thread cache of configured tokenizers, keyed by stemmer + diacritics flag + token
+    // chars. A tokenizer can't be shared between threads, because the unicodesn tokenizer keeps
+    // its Snowball stemmer's state in it, and xNext modifies that. The tokenizers are freed
+    // when their thread exits.
+    struct TokenizerCache : public std::unordered_map<std::string, sqlite3_tokenizer*> {
+        ~TokenizerCache() {
+            for (auto &i : *this)
+                sModule->xDestroy(i.second);
+        }
+    };
+    static thread_local TokenizerCache sTokenizerCache;
+
+    static void initModule() {
+        std::call_once(sModuleOnce, [] {
+            sqlite3Fts3UnicodeSnTokenizer(&sModule);
+            sStemmerToStopwords["en"] = sStemmerToStopwords["english"] =
+                                                                word_set(kEnglishStopWords);
+        });
     }
 
     std::string Tokenizer::defaultStemmer;
@@ -56,22 +66,12 @@ namespace cbforest {
     Tokenizer::Tokenizer(std::string stemmer, bool removeDiacritics)
     :_stemmer(stemmer),
      _removeDiacritics(removeDiacritics),
-     _tokenizer(NULL),
      _tokenChars("'’")
     {
-        if (!sModule) { //FIX: Make this thread-safe
-            sqlite3Fts3UnicodeSnTokenizer(&sModule);
-            sStemmerToStopwords["en"] = sStemmerToStopwords["english"] =
-                                                                readWordList(kEnglishStopWords);
-        }
-    }
-
-    Tokenizer::~Tokenizer() {
-        if (_tokenizer)
-            sModule->xDestroy(_tokenizer);
+        initModule();
     }
 
-    sqlite3_tokenizer* Tokenizer::createTokenizer() {
+    sqlite3_tokenizer* Tokenizer::createTokenizer() const {
         const char* argv[10];
         int argc = 0;
         if (!_removeDiacritics)
@@ -94,14 +94,92 @@ namespace cbforest {
         return tokenizer;
     }
 
+    // Returns this thread's sqlite3_tokenizer for this configuration, creating it if necessary.
     sqlite3_tokenizer* Tokenizer::getTokenizer() {
-        if (!_tokenizer)
-            _tokenizer = createTokenizer();
-        return _tokenizer;
+        std::string key = _stemmer;
+        key += '\0';
+        key += (_removeDiacritics ? '1' : '0');
+        key += _tokenChars;
+
+        auto i = sTokenizerCache.find(key);
+        if (i != sTokenizerCache.end())
+            return i->second;
+        sqlite3_tokenizer *tokenizer = createTokenizer();
+        if (tokenizer)
+            sTokenizerCache[key] = tokenizer;
+        return tokenizer;
     }
 
     const word_set& Tokenizer::stopwords() const {
-        return sStemmerToStopwords[_stemmer];
+        static const word_set kNoStopwords;
+        auto i = sStemmerToStopwords.find(_stemmer);    // read-only after initModule()
+        return (i != sStemmerToStopwords.end()) ? i->second : kNoStopwords;
+    }
+
+
+#pragma mark WORD_SET:
+
+
+    word_set::word_set(const char* cString) {
+        const char* space;
+        do {
+            space = strchr(cString, ' ');
+            size_t length = space ? (space-cString) : strlen(cString);
+            if (length > 0)
+                _words.push_back(slice(cString, length));
+            cString = space+1;
+        } while (space);
+        std::sort(_words.begin(), _words.end());
+        _words.erase(std::unique(_words.begin(), _words.end()), _words.end());
+    }
+
+    bool word_set::contains(slice word) const {
+        return std::binary_search(_words.begin(), _words.end(), word);
+    }
+
+
+#pragma mark TOKENTABLE:
+
+
+    unsigned TokenTable::insert(slice token, bool &added) {
+        if (_entries.size() + 1 > _slots.size() / 2)
+            rehash(std::max(_slots.size() * 2, (size_t)32));
+        uint32_t hash = token.hash();
+        size_t mask = _slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            int32_t index = _slots[i];
+            if (index < 0) {
+                // Not found; add it:
+                _slots[i] = (int32_t)_entries.size();
+                _entries.push_back({(uint32_t)_bytes.size(), (uint32_t)token.size, hash});
+                _bytes.append((const char*)token.buf, token.size);
+                added = true;
+                return (unsigned)_slots[i];
+            }
+            const entry &e = _entries[index];
+            if (e.hash == hash && e.length == token.size
+                               && memcmp(&_bytes[e.offset], token.buf, token.size) == 0) {
+                added = false;
+                return (unsigned)index;
+            }
+        }
+    }
+
+    void TokenTable::rehash(size_t slotCount) {
+        _slots.assign(slotCount, -1);
+        size_t mask = slotCount - 1;
+        for (size_t index = 0; index < _entries.size(); ++index) {
+            size_t i = _entries[index].hash & mask;
+            while (_slots[i] >= 0)
+                i = (i + 1) & mask;
+            _slots[i] = (int32_t)index;
+        }
+    }
+
+    void TokenTable::clear() {
+        _bytes.clear();
+        _entries.clear();
+        std::fill(_slots.begin(), _slots.end(), -1);
     }
 
 
@@ -149,12 +227,13 @@ namespace cbforest {
             trimQuotes(tokenBytes, tokenLength);
             if (tokenLength == 0)
                 continue;
-            _token = std::string(tokenBytes, tokenLength);
-            if (_stopwords.count(_token) > 0)
+            _token = slice(tokenBytes, tokenLength);
+            if (_stopwords.contains(_token))
                 continue; // it's a stop-word
             if (_unique) {
-                auto result = _seen.emplace(_token, true);
-                if (!result.second)
+                bool added;
+                _seen.insert(_token, added);
+                if (!added)
                     continue; // already seen this token, go on to next one
             }
             _wordOffset = startOffset;
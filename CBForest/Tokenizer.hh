@@ -10,7 +10,8 @@
 #define __CBForest__Tokenizer__
 
 #include "slice.hh"
-#include <unordered_map>
+#include <string>
+#include <vector>
 
 struct sqlite3_tokenizer;
 struct sqlite3_tokenizer_cursor;
@@ -18,10 +19,65 @@ struct sqlite3_tokenizer_cursor;
 namespace cbforest {
 
     class TokenIterator;
-    typedef std::unordered_map<std::string, bool> word_set;
+
+
+    /** An immutable set of words, stored as a sorted array and searched by binary search.
+        The words are slices pointing into the (static) string the set was created from. */
+    class word_set {
+    public:
+        word_set()                          { }
+        /** Creates a set from a space-delimited list of words, which must remain valid for the
+            lifetime of the set. */
+        explicit word_set(const char* words);
+
+        bool contains(slice word) const;
+        bool empty() const                  {return _words.empty();}
+        size_t size() const                 {return _words.size();}
+
+    private:
+        std::vector<slice> _words;
+    };
+
+
+    /** A set of token strings, whose bytes are copied into a single arena and indexed by an
+        open-addressed hash table. Each distinct token is assigned a sequential index.
+        clear() keeps the allocated capacity, so a table that's reused stops allocating once
+        it's grown to fit its input. */
+    class TokenTable {
+    public:
+        /** Returns the index of the token, adding it if it's not already present.
+            On return, `added` will be true if the token was new. */
+        unsigned insert(slice token, bool &added);
+
+        /** The number of distinct tokens. */
+        unsigned count() const              {return (unsigned)_entries.size();}
+
+        /** Returns a token given its index. The slice is invalidated by the next insert. */
+        slice operator[] (unsigned i) const {
+            auto &e = _entries[i];
+            return slice(&_bytes[e.offset], e.length);
+        }
+
+        void clear();
+
+    private:
+        struct entry {
+            uint32_t offset, length;        // location of token in _bytes
+            uint32_t hash;
+        };
+        void rehash(size_t slotCount);
+
+        std::string _bytes;
+        std::vector<entry> _entries;
+        std::vector<int32_t> _slots;        // indexes into _entries, or -1 if empty
+    };
+
 
     /** A Tokenizer manages tokenization of strings. An instance is configured with a specific
-        language and can then generate TokenIterators from strings. */
+        language and can then generate TokenIterators from strings.
+        Tokenizers are cheap to create: the underlying FTS tokenizer for a given configuration
+        (stemmer, diacritics, token chars) is created once per thread and reused, so instances
+        on different threads can tokenize concurrently. Each TokenIterator has its own cursor. */
     class Tokenizer {
     public:
         static std::string defaultStemmer;
@@ -35,22 +91,20 @@ namespace cbforest {
         Tokenizer(std::string stemmer = defaultStemmer,
                   bool removeDiacritics = defaultRemoveDiacritics);
 
-        ~Tokenizer();
-
-        const std::string& stemmer()        {return _stemmer;}
+        const std::string& stemmer() const  {return _stemmer;}
+        bool removeDiacritics() const       {return _removeDiacritics;}
 
         /** Defines extra characters that should be considered part of a token. */
         void setTokenChars(std::string s)   {_tokenChars = s;}
         std::string tokenChars() const      {return _tokenChars;}
 
     private:
-        sqlite3_tokenizer* createTokenizer();
+        sqlite3_tokenizer* createTokenizer() const;
         sqlite3_tokenizer* getTokenizer();
         const word_set &stopwords() const;
 
         std::string _stemmer;
         bool _removeDiacritics;
-        struct sqlite3_tokenizer* _tokenizer;
         std::string _tokenChars;
         friend class TokenIterator;
     };
@@ -67,8 +121,9 @@ namespace cbforest {
 
         /** True if the iterator has a token, false if it's reached the end. */
         bool hasToken() const           {return _hasToken;}
-        /** The current token. */
-        std::string token() const       {return _token;}
+        /** The current token. This points into the tokenizer's buffer, so it's only valid until
+            the iterator is advanced or destroyed; copy it if you need to keep it. */
+        slice token() const             {return _token;}
         /** The byte offset in the input string where the tokenized word begins. */
         size_t wordOffset() const      {return _wordOffset;}
         /** The length in bytes of the tokenized word.
@@ -89,9 +144,9 @@ namespace cbforest {
         sqlite3_tokenizer_cursor* _cursor;
         const word_set &_stopwords;
         const bool _unique;
-        std::unordered_map<std::string, bool> _seen;
+        TokenTable _seen;
         bool _hasToken;
-        std::string _token;
+        slice _token;
         size_t _wordOffset, _wordLength;
     };
 
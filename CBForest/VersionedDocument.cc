@@ -15,6 +15,7 @@
 
 #include "VersionedDocument.hh"
 #include "Error.hh"
+#include "MemoryBudget.hh"
 #include "varint.hh"
 #include <ostream>
 
@@ -41,17 +42,70 @@ namespace cbforest {
     }
 
     void VersionedDocument::read() {
+        DocCache *cache = _db.docCache();
+        if (cache) {
+            if (cache->noteUsed())
+                MemoryBudget::shared().rebalance();     // give it a share of the budget now
+            MemoryBudget::shared().noteAccess();
+        }
+        if (cache && cache->enabled()) {
+            readWithCache(*cache);
+        } else {
+            _db.read(_doc);
+            decode();
+        }
+    }
+
+    // Reads the metadata first, and if the cache has the rev tree of that exact version of the
+    // doc (same sequence and file offset), uses it instead of reading and decoding the body.
+    // Otherwise decodes the tree from a shared copy of the body, and caches it.
+    void VersionedDocument::readWithCache(DocCache &cache) {
+        _db.read(_doc, KeyStore::kMetaOnly);
+        if (_doc.exists()) {
+            auto entry = cache.getRevTree(_doc.key(), _doc.sequence(), _doc.offset());
+            if (entry) {
+                RevTree::copyDecoded(entry->revs, entry->body, _doc.offset());
+                _unknown = false;
+                decodeMeta();
+                return;
+            }
+        }
         _db.read(_doc);
-        decode();
+        if (!_doc.exists() || !_doc.body().buf) {
+            decode();
+            return;
+        }
+
+        alloc_slice body(_doc.body());
+        {
+            LatencyTimer timer(_db.stats().revTreeDecode);
+            RevTree::decodeShared(body, _doc.sequence(), _doc.offset());
+        }
+        _unknown = false;
+        decodeMeta();
+
+        auto entry = std::make_shared<DocCache::Entry>();
+        entry->body = body;
+        entry->revs = allRevisions();
+        for (auto rev = entry->revs.begin(); rev != entry->revs.end(); ++rev)
+            rev->owner = NULL;
+        entry->sequence = _doc.sequence();
+        entry->offset = _doc.offset();
+        cache.putRevTree(_doc.key(), entry);
     }
 
     void VersionedDocument::decode() {
         _unknown = false;
-        if (_doc.body().buf)
+        if (_doc.body().buf) {
+            LatencyTimer timer(_db.stats().revTreeDecode);
             RevTree::decode(_doc.body(), _doc.sequence(), _doc.offset());
+        }
         else if (_doc.body().size > 0)
             _unknown = true;        // i.e. doc was read as meta-only
+        decodeMeta();
+    }
 
+    void VersionedDocument::decodeMeta() {
         if (_doc.exists()) {
             slice docType;
             if (!readMeta(_doc, _flags, _revID, docType))
@@ -125,27 +179,36 @@ namespace cbforest {
     bool VersionedDocument::isBodyOfRevisionAvailable(const Revision* rev, uint64_t atOffset) const {
         if (RevTree::isBodyOfRevisionAvailable(rev, atOffset))
             return true;
-        if (atOffset == 0 || atOffset >= _doc.offset())
-            return false;
-        VersionedDocument oldVersDoc(_db, _db.getByOffsetNoErrors(atOffset, rev->sequence));
-        if (!oldVersDoc.exists() || oldVersDoc.sequence() != rev->sequence)
-            return false;
-        const Revision* oldRev = oldVersDoc.get(rev->revID);
-        return (oldRev && RevTree::isBodyOfRevisionAvailable(oldRev, atOffset));
+        return readOldBody(rev, atOffset).buf != NULL;
     }
 
     alloc_slice VersionedDocument::readBodyOfRevision(const Revision* rev, uint64_t atOffset) const {
         if (RevTree::isBodyOfRevisionAvailable(rev, atOffset))
             return RevTree::readBodyOfRevision(rev, atOffset);
+        return readOldBody(rev, atOffset);
+    }
+
+    // Reads a revision's body from the earlier version of the doc stored at `atOffset`,
+    // or from the cache.
+    alloc_slice VersionedDocument::readOldBody(const Revision* rev, uint64_t atOffset) const {
         if (atOffset == 0 || atOffset >= _doc.offset())
             return alloc_slice();
+        DocCache *cache = _db.docCache();
+        if (cache) {
+            alloc_slice body = cache->getOldBody(atOffset, rev->sequence, rev->revID);
+            if (body.buf)
+                return body;
+        }
         VersionedDocument oldVersDoc(_db, _db.getByOffsetNoErrors(atOffset, rev->sequence));
         if (!oldVersDoc.exists() || oldVersDoc.sequence() != rev->sequence)
             return alloc_slice();
         const Revision* oldRev = oldVersDoc.get(rev->revID);
-        if (!oldRev)
+        if (!oldRev || !oldRev->inlineBody().buf)
             return alloc_slice();
-        return alloc_slice(oldRev->inlineBody());
+        alloc_slice body(oldRev->inlineBody());
+        if (cache)
+            cache->putOldBody(atOffset, rev->sequence, rev->revID, body);
+        return body;
     }
 
     void VersionedDocument::save(Transaction& transaction) {
@@ -155,10 +218,17 @@ namespace cbforest {
         if (currentRevision()) {
             // Don't call _doc.setBody() because it'll invalidate all the pointers from Revisions into
             // the existing body buffer.
-            _doc.updateSequence( transaction(_db).set(_doc.key(), _doc.meta(), encode()) );
+            alloc_slice body;
+            {
+                LatencyTimer timer(_db.stats().revTreeEncode);
+                body = encode();
+            }
+            _doc.updateSequence( transaction(_db).set(_doc.key(), _doc.meta(), body) );
         } else {
             transaction(_db).del(_doc.key());
         }
+        if (_db.docCache())
+            _db.docCache()->removeRevTree(_doc.key());  // just to free the space; it's stale now
         _changed = false;
     }
 
@@ -17,6 +17,7 @@
 #define __CBForest__VersionedDocument__
 #include "RevTree.hh"
 #include "Document.hh"
+#include "DocCache.hh"
 
 namespace cbforest {
 
@@ -80,6 +81,9 @@ namespace cbforest {
 
     private:
         void decode();
+        void decodeMeta();
+        void readWithCache(DocCache&);
+        alloc_slice readOldBody(const Revision*, uint64_t atOffset) const;
         VersionedDocument(const VersionedDocument&) = delete;
 
         KeyStore&   _db;
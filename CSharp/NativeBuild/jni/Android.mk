@@ -158,6 +158,15 @@ LOCAL_SRC_FILES :=	$(SQLITE3_PATH)/fts3_unicode2.c \
 					$(CBFOREST_PATH)/Index.cc \
 					$(CBFOREST_PATH)/FullTextIndex.cc \
 					$(CBFOREST_PATH)/KeyStore.cc \
+					$(CBFOREST_PATH)/MemoryBudget.cc \
+					$(CBFOREST_PATH)/QueryCache.cc \
+					$(CBFOREST_PATH)/LiveQuery.cc \
+					$(CBFOREST_PATH)/FileSyncer.cc \
+					$(CBFOREST_PATH)/CompactionScheduler.cc \
+					$(CBFOREST_PATH)/BloomFilter.cc \
+					$(CBFOREST_PATH)/DocCache.cc \
+					$(CBFOREST_PATH)/LogQueue.cc \
+					$(CBFOREST_PATH)/Stats.cc \
 					$(CBFOREST_PATH)/RevID.cc \
 					$(CBFOREST_PATH)/RevTree.cc \
 					$(CBFOREST_PATH)/VersionedDocument.cc \
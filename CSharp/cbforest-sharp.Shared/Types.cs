@@ -529,6 +529,11 @@ namespace CBForest
         /// Option flags
         /// </summary>
         public C4EnumeratorFlags flags;
+
+        /// <summary>
+        /// All-docs only: the docID to start just after (the last one seen)
+        /// </summary>
+        public C4Slice resumeAfter;
     }
 
     /// <summary>
@@ -646,6 +651,12 @@ namespace CBForest
         public C4Key** keys;
         private UIntPtr _keysCount;
 
+        /// <summary>
+        /// A token from c4queryenum_getResumeToken; the query starts just after that row
+        /// </summary>
+        public C4Slice resumeAfter;
+        private byte _keysOnly;
+
         /// <summary>
         /// Gets or sets whether or not to enumerate in descending order
         /// </summary>
@@ -685,6 +696,15 @@ namespace CBForest
             set { _rankFullText = Convert.ToByte(value); }
         }
 
+        /// <summary>
+        /// Gets or sets whether to skip reading the rows' values (map/reduce queries only)
+        /// </summary>
+        public bool keysOnly
+        { 
+            get { return Convert.ToBoolean(_keysOnly); }
+            set { _keysOnly = Convert.ToByte(value); }
+        }
+
         /// <summary>
         /// Gets or sets wthe number of keys in the keys array
         /// </summary>